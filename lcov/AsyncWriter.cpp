@@ -0,0 +1,75 @@
+#include "pch.h"
+#include "AsyncWriter.h"
+
+#include <algorithm>
+#include <utility>
+
+AsyncWriter::AsyncWriter(std::ostream& out, std::size_t buffers, std::size_t bufferBytes) : out_(out) {
+	// The caller holds one buffer at a time; the rest start out free.
+	for (std::size_t i = 1; i < std::max<std::size_t>(buffers, 2); ++i) {
+		free_.emplace_back();
+		free_.back().reserve(bufferBytes);
+	}
+	thread_ = std::thread([this] { Run(); });
+}
+
+AsyncWriter::~AsyncWriter() {
+	Stop();
+}
+
+bool AsyncWriter::Write(std::string& block) {
+	if (block.empty())
+		return !failed_;
+
+	std::unique_lock lock{mutex_};
+	cv_.wait(lock, [&] { return !free_.empty() || failed_; });
+	if (failed_) {
+		block.clear();
+		return false;
+	}
+	queue_.push_back(std::move(block));
+	block = std::move(free_.back());
+	free_.pop_back();
+	cv_.notify_all();
+	return true;
+}
+
+void AsyncWriter::Run() {
+	std::unique_lock lock{mutex_};
+	while (true) {
+		cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+		if (queue_.empty())
+			return;
+		auto block = std::move(queue_.front());
+		queue_.pop_front();
+
+		// Only this thread touches the stream while it runs.
+		lock.unlock();
+		if (!failed_) {
+			out_.write(block.data(), static_cast<std::streamsize>(block.size()));
+			if (!out_)
+				failed_ = true;
+		}
+		block.clear();
+		lock.lock();
+
+		free_.push_back(std::move(block));
+		cv_.notify_all();
+	}
+}
+
+bool AsyncWriter::Finish() {
+	// The thread only exits once the queue is empty.
+	Stop();
+	return !failed_;
+}
+
+void AsyncWriter::Stop() {
+	{
+		std::lock_guard lock{mutex_};
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	if (thread_.joinable())
+		thread_.join();
+}
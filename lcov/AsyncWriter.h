@@ -0,0 +1,50 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Writes blocks to a stream on a dedicated thread, so rendering continues while the previous block is on its way to disk.
+ *
+ * Blocks come from a fixed pool: Write queues the filled block and hands back an empty one of the same capacity,
+ * waiting while every other block is still queued. That bound is the backpressure that keeps memory flat when the
+ * disk (or a network share) is slower than rendering. A failed write stops further writes; the caller learns about it
+ * from Write/Finish returning false.
+ */
+class LCOV_API AsyncWriter {
+public:
+	// buffers: blocks in the pool, including the one the caller is filling (at least 2).
+	AsyncWriter(std::ostream& out, std::size_t buffers, std::size_t bufferBytes);
+	~AsyncWriter();
+
+	AsyncWriter(const AsyncWriter&) = delete;
+	AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+	// Queues block and swaps in an empty buffer from the pool. Returns false once a write has failed.
+	bool Write(std::string& block);
+	// Writes everything queued and stops the thread. Returns false if any write failed.
+	bool Finish();
+
+private:
+	void Run();
+	void Stop();
+
+	std::ostream& out_;
+	std::atomic<bool> failed_{false};
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<std::string> queue_;
+	std::vector<std::string> free_;
+	bool stopping_ = false;
+	std::thread thread_;
+};
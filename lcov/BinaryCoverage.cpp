@@ -0,0 +1,295 @@
+#include "pch.h"
+#include "BinaryCoverage.h"
+
+#include "MappedFile.h"
+
+#include "Plugin/Exporter/ModuleCoverage.hpp"
+#include "Plugin/Exporter/FileCoverage.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+namespace {
+	// Longest file-type marker skipped before the first message.
+	constexpr std::size_t MaxMarkerBytes = 64;
+
+	// Protobuf wire format: just the varint and length-delimited types used by CoverageData.proto.
+	class WireReader {
+	public:
+		explicit WireReader(std::string_view bytes) : bytes_(bytes) {}
+
+		[[nodiscard]] bool AtEnd() const noexcept { return bytes_.empty(); }
+
+		bool Varint(std::uint64_t& value) {
+			value = 0;
+			for (unsigned shift = 0; shift < 64 && !bytes_.empty(); shift += 7) {
+				const auto byte = static_cast<unsigned char>(bytes_.front());
+				bytes_.remove_prefix(1);
+				value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+
+		bool Bytes(std::string_view& value) {
+			std::uint64_t size = 0;
+			if (!Varint(size) || size > bytes_.size())
+				return false;
+			value = bytes_.substr(0, static_cast<std::size_t>(size));
+			bytes_.remove_prefix(static_cast<std::size_t>(size));
+			return true;
+		}
+
+		// Reads a field key; wireType 0 is a varint, 2 is length-delimited.
+		bool Key(std::uint32_t& field, std::uint32_t& wireType) {
+			std::uint64_t key = 0;
+			if (!Varint(key))
+				return false;
+			field = static_cast<std::uint32_t>(key >> 3);
+			wireType = static_cast<std::uint32_t>(key & 7);
+			return true;
+		}
+
+		bool Skip(std::uint32_t wireType) {
+			std::uint64_t ignored = 0;
+			std::string_view bytes;
+			switch (wireType) {
+			case 0: return Varint(ignored);
+			case 1: return Advance(8);
+			case 2: return Bytes(bytes);
+			case 5: return Advance(4);
+			default: return false;
+			}
+		}
+
+	private:
+		bool Advance(std::size_t count) {
+			if (count > bytes_.size())
+				return false;
+			bytes_.remove_prefix(count);
+			return true;
+		}
+
+		std::string_view bytes_;
+	};
+
+	// UTF-8 to UTF-16 (Windows) or UTF-32; invalid sequences become U+FFFD.
+	std::wstring Utf8ToWide(std::string_view utf8) {
+		std::wstring wide;
+		wide.reserve(utf8.size());
+		for (std::size_t i = 0; i < utf8.size();) {
+			const auto lead = static_cast<unsigned char>(utf8[i]);
+			const std::size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+			std::uint32_t cp = length == 1 ? lead : length == 2 ? lead & 0x1F : length == 3 ? lead & 0x0F : lead & 0x07;
+			bool valid = length != 0 && i + length <= utf8.size();
+			for (std::size_t k = 1; valid && k < length; ++k) {
+				const auto next = static_cast<unsigned char>(utf8[i + k]);
+				valid = (next & 0xC0) == 0x80;
+				cp = (cp << 6) | (next & 0x3F);
+			}
+			if (!valid || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+				cp = 0xFFFD;
+				i += 1;
+			} else {
+				i += length;
+			}
+			if constexpr (sizeof(wchar_t) == 2) {
+				if (cp >= 0x10000) {
+					cp -= 0x10000;
+					wide.push_back(static_cast<wchar_t>(0xD800 + (cp >> 10)));
+					wide.push_back(static_cast<wchar_t>(0xDC00 + (cp & 0x3FF)));
+					continue;
+				}
+			}
+			wide.push_back(static_cast<wchar_t>(cp));
+		}
+		return wide;
+	}
+
+	std::filesystem::path Utf8Path(std::string_view utf8) {
+		return std::filesystem::path(std::u8string(utf8.begin(), utf8.end()));
+	}
+
+	struct Header {
+		std::string_view name;
+		std::uint64_t count = 0;
+		std::int32_t exitCode = 0;
+		bool hasCount = false;
+	};
+
+	// CoverageData and ModuleCoverage share the layout: a string (1) and a count (2); CoverageData adds exitCode (3).
+	bool ReadHeader(WireReader& input, Header& header) {
+		std::string_view message;
+		if (!input.Bytes(message))
+			return false;
+		WireReader fields{message};
+		while (!fields.AtEnd()) {
+			std::uint32_t field = 0;
+			std::uint32_t wireType = 0;
+			if (!fields.Key(field, wireType))
+				return false;
+			std::uint64_t value = 0;
+			if (field == 1 && wireType == 2) {
+				if (!fields.Bytes(header.name))
+					return false;
+			} else if ((field == 2 || field == 3) && wireType == 0) {
+				if (!fields.Varint(value))
+					return false;
+				if (field == 2) {
+					header.count = value;
+					header.hasCount = true;
+				} else {
+					header.exitCode = static_cast<std::int32_t>(value);
+				}
+			} else if (!fields.Skip(wireType)) {
+				return false;
+			}
+		}
+		return header.hasCount;
+	}
+
+	// Without a file, the message is only checked.
+	bool ReadLine(std::string_view message, Plugin::FileCoverage* file) {
+		WireReader fields{message};
+		std::uint64_t lineNumber = 0;
+		std::uint64_t executed = 0;
+		while (!fields.AtEnd()) {
+			std::uint32_t field = 0;
+			std::uint32_t wireType = 0;
+			if (!fields.Key(field, wireType))
+				return false;
+			if (field == 1 && wireType == 0) {
+				if (!fields.Varint(lineNumber))
+					return false;
+			} else if (field == 2 && wireType == 0) {
+				if (!fields.Varint(executed))
+					return false;
+			} else if (!fields.Skip(wireType)) {
+				return false;
+			}
+		}
+		if (file)
+			file->AddLine(static_cast<unsigned int>(lineNumber), executed != 0);
+		return true;
+	}
+
+	// Without a module, the message is only checked.
+	bool ReadFile(WireReader& input, Plugin::ModuleCoverage* module) {
+		std::string_view message;
+		if (!input.Bytes(message))
+			return false;
+		// The path comes first in the serialized message; lines are added as they are read.
+		WireReader fields{message};
+		Plugin::FileCoverage* file = nullptr;
+		bool hasPath = false;
+		while (!fields.AtEnd()) {
+			std::uint32_t field = 0;
+			std::uint32_t wireType = 0;
+			std::string_view bytes;
+			if (!fields.Key(field, wireType))
+				return false;
+			if (wireType != 2) {
+				if (!fields.Skip(wireType))
+					return false;
+				continue;
+			}
+			if (!fields.Bytes(bytes))
+				return false;
+			if (field == 1 && !hasPath) {
+				hasPath = true;
+				if (module)
+					file = &module->AddFile(Utf8Path(bytes));
+			} else if (field == 2 && hasPath) {
+				if (!ReadLine(bytes, file))
+					return false;
+			} else if (field == 2) {
+				return false;
+			}
+		}
+		return hasPath;
+	}
+
+	// Decodes a whole run. beginModule returns where the module's files go (null to only check them), and endModule
+	// is called once they are all read.
+	bool Decode(std::string_view bytes, const std::function<void(const Header& run)>& onRun,
+	            const std::function<Plugin::ModuleCoverage*(const std::filesystem::path& path)>& beginModule,
+	            const std::function<void()>& endModule) {
+		WireReader input{bytes};
+		Header run;
+		if (!ReadHeader(input, run))
+			return false;
+		onRun(run);
+		for (std::uint64_t m = 0; m < run.count; ++m) {
+			Header module;
+			if (!ReadHeader(input, module))
+				return false;
+			auto* moduleCoverage = beginModule(Utf8Path(module.name));
+			for (std::uint64_t f = 0; f < module.count; ++f) {
+				if (!ReadFile(input, moduleCoverage))
+					return false;
+			}
+			endModule();
+		}
+		return input.AtEnd();
+	}
+
+	// Decoding must consume the whole file, so a marker is only skipped where everything after it decodes. Returns
+	// where the first message starts, or npos.
+	std::size_t FindRun(std::string_view bytes) {
+		for (std::size_t offset = 0; offset <= std::min(MaxMarkerBytes, bytes.size()); ++offset) {
+			if (Decode(bytes.substr(offset), [](const Header&) {}, [](const std::filesystem::path&) { return nullptr; }, [] {}))
+				return offset;
+		}
+		return std::string_view::npos;
+	}
+}
+
+std::unique_ptr<Plugin::CoverageData> DecodeBinaryCoverage(std::string_view bytes) {
+	const auto offset = FindRun(bytes);
+	if (offset == std::string_view::npos)
+		return nullptr;
+	std::unique_ptr<Plugin::CoverageData> data;
+	Decode(bytes.substr(offset),
+	       [&](const Header& run) { data = std::make_unique<Plugin::CoverageData>(Utf8ToWide(run.name), run.exitCode); },
+	       [&](const std::filesystem::path& path) { return &data->AddModule(path); }, [] {});
+	return data;
+}
+
+std::unique_ptr<Plugin::CoverageData> ReadBinaryCoverage(const std::filesystem::path& path, ExporterConfigLog& log) {
+	MappedFile file;
+	if (!file.Open(path)) {
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot read binary coverage file: " + path.string());
+		return nullptr;
+	}
+	auto data = DecodeBinaryCoverage(file.View());
+	if (!data)
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Not an OpenCppCoverage binary coverage file: " + path.string());
+	return data;
+}
+
+bool ReadBinaryCoverageModules(const std::filesystem::path& path, ExporterConfigLog& log,
+                               const std::function<void(const Plugin::ModuleCoverage& module)>& onModule) {
+	MappedFile file;
+	if (!file.Open(path)) {
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot read binary coverage file: " + path.string());
+		return false;
+	}
+	// The file is checked in full first, so onModule never sees part of a file that turns out to be invalid.
+	const auto bytes = file.View();
+	const auto offset = FindRun(bytes);
+	if (offset == std::string_view::npos) {
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Not an OpenCppCoverage binary coverage file: " + path.string());
+		return false;
+	}
+	std::optional<Plugin::ModuleCoverage> module;
+	return Decode(bytes.substr(offset), [](const Header&) {},
+	              [&](const std::filesystem::path& modulePath) { return &module.emplace(modulePath); },
+	              [&] {
+		              onModule(*module);
+		              module.reset();
+	              });
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "Plugin/Exporter/CoverageData.hpp"
+
+/**
+ * Reads a coverage file written by OpenCppCoverage's binary exporter (--export_type=binary), so the LCOV export can run
+ * later, on any machine, without OpenCppCoverage or protobuf.
+ *
+ * The file is a series of protobuf messages (OpenCppCoverage's CoverageData.proto), each preceded by its varint
+ * length: one CoverageData {name = 1, moduleCount = 2, exitCode = 3}, then for every module a ModuleCoverage
+ * {path = 1, fileCount = 2} followed by fileCount FileCoverage {path = 1, lines = 2} messages, where each line is
+ * {lineNumber = 1, hasBeenExecuted = 2}. Unknown fields are skipped; a short file-type marker before the first message
+ * is tolerated. Returns null and logs an error when the file cannot be read or decoded.
+ */
+LCOV_API std::unique_ptr<Plugin::CoverageData> ReadBinaryCoverage(const std::filesystem::path& path, ExporterConfigLog& log);
+// Same, for file contents already in memory.
+LCOV_API std::unique_ptr<Plugin::CoverageData> DecodeBinaryCoverage(std::string_view bytes);
+/**
+ * Reads the same file one module at a time: onModule gets each module once all its files are decoded, and the module
+ * is freed when it returns, so at most one module is held (the file itself is mapped, not read into memory). The file
+ * is checked in full before the first call. Returns false and logs an error, without calling onModule, when the file
+ * cannot be read or decoded.
+ */
+LCOV_API bool ReadBinaryCoverageModules(const std::filesystem::path& path, ExporterConfigLog& log,
+                                        const std::function<void(const Plugin::ModuleCoverage& module)>& onModule);
@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "ConfigTree.h"
+
+#include <mutex>
+#include <utility>
+
+struct ConfigTree::Scope {
+	// Root configuration: borrowed from the exporter
+	explicit Scope(const ExporterConfig& cfg) : config(&cfg), resolver(cfg) {}
+	// Nested configuration: owned by the tree
+	explicit Scope(std::unique_ptr<ExporterConfig> cfg) : owned(std::move(cfg)), config(owned.get()), resolver(*config) {}
+
+	std::unique_ptr<ExporterConfig> owned;
+	const ExporterConfig* config;
+	PathResolver resolver;
+};
+
+ConfigTree::ConfigTree(const ExporterConfig& root)
+	: nested_(root.NestedConfigs()), rootScope_(std::make_unique<Scope>(root)) {
+	if (const auto path = root.ConfigPath())
+		rootConfigPath_ = path->lexically_normal();
+}
+
+ConfigTree::~ConfigTree() = default;
+
+PathClassification ConfigTree::Classify(const std::filesystem::path& path) {
+	return ScopeFor(path).resolver.Classify(path);
+}
+
+bool ConfigTree::Classify(const std::filesystem::path& path, std::pmr::string& sfPathUtf8) {
+	return ScopeFor(path).resolver.Classify(path, sfPathUtf8);
+}
+
+std::uint64_t ConfigTree::FingerprintFor(const std::filesystem::path& path) {
+	return ScopeFor(path).config->Fingerprint();
+}
+
+std::size_t ConfigTree::NestedConfigCount() const {
+	std::shared_lock lock{mutex_};
+	return nestedScopes_.size();
+}
+
+std::uint64_t ConfigTree::CanonicalizationCount() const {
+	std::shared_lock lock{mutex_};
+	auto count = rootScope_->resolver.CanonicalizationCount();
+	for (const auto& scope : nestedScopes_)
+		count += scope->resolver.CanonicalizationCount();
+	return count;
+}
+
+ExporterConfigLog ConfigTree::TakeLog() {
+	std::unique_lock lock{mutex_};
+	return std::exchange(log_, {});
+}
+
+ConfigTree::Scope& ConfigTree::ScopeFor(const std::filesystem::path& path) {
+	if (!nested_)
+		return *rootScope_;
+
+	const auto dir = path.parent_path();
+	{
+		std::shared_lock lock{mutex_};
+		if (const auto* node = Find(dir))
+			return *node->scope;
+	}
+	std::unique_lock lock{mutex_};
+	return Probe(dir);
+}
+
+// Node of an already probed directory, or null when it (or an ancestor) has not been probed yet.
+const ConfigTree::Node* ConfigTree::Find(const std::filesystem::path& dir) const {
+	const Node* node = &trie_;
+	for (const auto& component : dir) {
+		const auto it = node->children.find(component.native());
+		if (it == node->children.end())
+			return nullptr;
+		node = it->second.get();
+	}
+	return node->scope ? node : nullptr;
+}
+
+// Walks down from the root of dir, probing every directory that has no node yet. Called with the lock held.
+ConfigTree::Scope& ConfigTree::Probe(const std::filesystem::path& dir) {
+	Node* node = &trie_;
+	Scope* scope = rootScope_.get();
+	std::filesystem::path current;
+	for (const auto& component : dir) {
+		current /= component;
+		auto& child = node->children[component.native()];
+		if (!child) {
+			child = std::make_unique<Node>();
+			child->scope = scope;
+			// A bare drive ("C:") is not a directory: "C:" / ".covlcov" would be relative to that drive's current
+			// directory. Its root ("C:\") is the next component.
+			if (current.has_root_name() && !current.has_root_directory() && !current.has_relative_path()) {
+				node = child.get();
+				continue;
+			}
+
+			const auto candidate = current / L".covlcov";
+			std::error_code ec;
+			probes_.fetch_add(1, std::memory_order_relaxed);
+			if (std::filesystem::exists(candidate, ec) && !ec) {
+				if (candidate.lexically_normal() == rootConfigPath_) {
+					child->scope = rootScope_.get();
+				} else {
+					auto cfg = std::make_unique<ExporterConfig>(current);
+					log_.AddMsg(ExporterConfigLog::MsgLevel::Info, "Nested .covlcov governs files under: " + current.string());
+					log_.Append(std::move(cfg->Log));
+					nestedScopes_.push_back(std::make_unique<Scope>(std::move(cfg)));
+					child->scope = nestedScopes_.back().get();
+				}
+			}
+		}
+		node = child.get();
+		scope = node->scope;
+	}
+	node->scope = scope;
+	return *scope;
+}
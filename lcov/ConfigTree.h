@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+#include "PathResolver.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <shared_mutex>
+#include <vector>
+
+/**
+ * Per-file configuration lookup for monorepos ("nestedConfigs: true" in the root .covlcov).
+ *
+ * Each source file is governed by the nearest .covlcov in its directory or above it, with that file's baseDir,
+ * includeByBaseDir and include/exclude rules; files with none fall back to the root configuration. Directories are
+ * kept in a trie of path components. A node is probed for a .covlcov once and then remembers the configuration that
+ * governs it, so each directory costs one exists() call per export however many files live under it.
+ *
+ * Without nestedConfigs every file is classified by the root configuration, exactly like PathResolver.
+ * Classify is safe to call from several threads at once.
+ */
+class LCOV_API ConfigTree {
+public:
+	explicit ConfigTree(const ExporterConfig& root);
+	~ConfigTree();
+
+	ConfigTree(const ConfigTree&) = delete;
+	ConfigTree& operator=(const ConfigTree&) = delete;
+
+	PathClassification Classify(const std::filesystem::path& path);
+	// Appends the SF path as generic UTF-8 when the file is included; see PathResolver::Classify.
+	bool Classify(const std::filesystem::path& path, std::pmr::string& sfPathUtf8);
+	// Fingerprint of the configuration governing path (changes to it must invalidate cached records)
+	std::uint64_t FingerprintFor(const std::filesystem::path& path);
+
+	[[nodiscard]] bool Nested() const noexcept { return nested_; }
+	// Nested .covlcov files loaded so far, and directories probed for one
+	[[nodiscard]] std::size_t NestedConfigCount() const;
+	[[nodiscard]] std::uint64_t ProbeCount() const noexcept { return probes_.load(std::memory_order_relaxed); }
+	// weakly_canonical calls made by all resolvers
+	[[nodiscard]] std::uint64_t CanonicalizationCount() const;
+	// Messages of the nested configurations loaded so far, moved out of the tree.
+	ExporterConfigLog TakeLog();
+
+private:
+	struct Scope;
+	struct Node {
+		std::map<std::filesystem::path::string_type, std::unique_ptr<Node>, std::less<>> children;
+		Scope* scope = nullptr;
+	};
+
+	Scope& ScopeFor(const std::filesystem::path& path);
+	const Node* Find(const std::filesystem::path& dir) const;
+	Scope& Probe(const std::filesystem::path& dir);
+
+	bool nested_;
+	std::filesystem::path rootConfigPath_;
+	std::unique_ptr<Scope> rootScope_;
+	std::vector<std::unique_ptr<Scope>> nestedScopes_;
+	ExporterConfigLog log_;
+
+	mutable std::shared_mutex mutex_;
+	Node trie_;
+	std::atomic<std::uint64_t> probes_{0};
+};
@@ -0,0 +1,134 @@
+#include "pch.h"
+#include "CoverageGate.h"
+
+#include "ExporterConfig.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+	// Files below the `file` floor listed one by one; the rest are only counted.
+	constexpr std::size_t MaxListedFiles = 20;
+
+	std::string Percent(std::uint64_t hit, std::uint64_t found) {
+		if (found == 0)
+			return "n/a";
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.2f%%", static_cast<double>(hit) * 100 / static_cast<double>(found));
+		return text;
+	}
+
+	std::string Minimum(double minimum) {
+		char text[32];
+		std::snprintf(text, sizeof(text), "%g%%", minimum);
+		return text;
+	}
+
+	std::string Describe(std::string_view what, std::uint64_t hit, std::uint64_t found, double minimum) {
+		return std::string(what) + ": " + Percent(hit, found) + " (" + std::to_string(hit) + " of " + std::to_string(found) +
+		       " lines), minimum " + Minimum(minimum);
+	}
+}
+
+CoverageGate::CoverageGate(const CoverageThresholds& thresholds)
+	: total_(thresholds.total), fileFloor_(thresholds.file) {
+	for (const auto& [path, minimum] : thresholds.directories) {
+		if (directoryIndex_.try_emplace(path, directories_.size()).second)
+			directories_.push_back({path, minimum, {}, false});
+	}
+	for (const auto& [path, minimum] : thresholds.files) {
+		if (fileIndex_.try_emplace(path, files_.size()).second)
+			files_.push_back({path, minimum, {}, false});
+	}
+}
+
+void CoverageGate::Add(std::string_view sfPathUtf8, std::uint64_t linesFound, std::uint64_t linesHit) {
+	reportTotals_.found += linesFound;
+	reportTotals_.hit += linesHit;
+
+	if (!directories_.empty()) {
+		// Each '/' ends one directory of the path: "src", "src/core", ...
+		for (auto slash = sfPathUtf8.find('/'); slash != std::string_view::npos; slash = sfPathUtf8.find('/', slash + 1)) {
+			const auto it = directoryIndex_.find(sfPathUtf8.substr(0, slash));
+			if (it == directoryIndex_.end())
+				continue;
+			auto& target = directories_[it->second];
+			target.matched = true;
+			target.totals.found += linesFound;
+			target.totals.hit += linesHit;
+		}
+	}
+
+	if (!files_.empty()) {
+		if (const auto it = fileIndex_.find(sfPathUtf8); it != fileIndex_.end()) {
+			auto& target = files_[it->second];
+			target.matched = true;
+			target.totals.found += linesFound;
+			target.totals.hit += linesHit;
+			return;
+		}
+	}
+
+	if (fileFloor_ && !Meets({linesFound, linesHit}, *fileFloor_))
+		belowFloor_.push_back({std::string(sfPathUtf8), {linesFound, linesHit}});
+}
+
+// A file or directory without instrumented lines meets any threshold.
+bool CoverageGate::Meets(const Totals& totals, double minimum) noexcept {
+	if (totals.found == 0)
+		return true;
+	return static_cast<double>(totals.hit) * 100 >= minimum * static_cast<double>(totals.found);
+}
+
+bool CoverageGate::Evaluate(ExporterConfigLog& log) const {
+	using MsgLevel = ExporterConfigLog::MsgLevel;
+	auto report = [&](bool met, const std::string& text) {
+		log.AddMsg(met ? MsgLevel::Info : MsgLevel::Error, "  " + text + (met ? " - passed" : " - FAILED"));
+	};
+
+	const auto failed = FailedCount();
+	log.AddMsg(failed == 0 ? MsgLevel::Info : MsgLevel::Error,
+	           "Coverage thresholds: " + std::string(failed == 0 ? "PASSED" : "FAILED") + " (" + std::to_string(ThresholdCount() - failed) +
+	           " of " + std::to_string(ThresholdCount()) + " met)");
+
+	if (total_)
+		report(Meets(reportTotals_, *total_), Describe("total", reportTotals_.hit, reportTotals_.found, *total_));
+	for (const auto* targets : {&directories_, &files_}) {
+		const char* kind = targets == &directories_ ? "directory " : "file ";
+		for (const auto& target : *targets) {
+			if (!target.matched) {
+				log.AddMsg(MsgLevel::Info, "  " + std::string(kind) + target.path + ": no files in the report, not checked");
+				continue;
+			}
+			report(Meets(target.totals, target.minimum), Describe(kind + target.path, target.totals.hit, target.totals.found, target.minimum));
+		}
+	}
+	if (fileFloor_) {
+		report(belowFloor_.empty(), std::to_string(belowFloor_.size()) + " files below the per-file minimum of " + Minimum(*fileFloor_));
+		const auto listed = std::min(belowFloor_.size(), MaxListedFiles);
+		for (std::size_t i = 0; i < listed; ++i) {
+			const auto& file = belowFloor_[i];
+			log.AddMsg(MsgLevel::Error, "    " + file.path + ": " + Percent(file.totals.hit, file.totals.found) + " (" +
+			           std::to_string(file.totals.hit) + " of " + std::to_string(file.totals.found) + " lines)");
+		}
+		if (belowFloor_.size() > listed)
+			log.AddMsg(MsgLevel::Error, "    ... and " + std::to_string(belowFloor_.size() - listed) + " more");
+	}
+	return failed == 0;
+}
+
+bool CoverageGate::Passed() const noexcept {
+	return FailedCount() == 0;
+}
+
+std::size_t CoverageGate::ThresholdCount() const noexcept {
+	const auto matched = [](const auto& target) { return target.matched; };
+	return (total_ ? 1 : 0) + (fileFloor_ ? 1 : 0) + static_cast<std::size_t>(std::ranges::count_if(directories_, matched)) +
+	       static_cast<std::size_t>(std::ranges::count_if(files_, matched));
+}
+
+std::size_t CoverageGate::FailedCount() const noexcept {
+	const auto failing = [](const Target& target) { return target.matched && !Meets(target.totals, target.minimum); };
+	return (total_ && !Meets(reportTotals_, *total_) ? 1 : 0) + (belowFloor_.empty() ? 0 : 1) +
+	       static_cast<std::size_t>(std::ranges::count_if(directories_, failing)) + static_cast<std::size_t>(std::ranges::count_if(files_, failing));
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ExporterConfigLog;
+
+// Minimum line coverage, in percent, from "thresholds" in .covlcov. Paths are SF paths as written to the report.
+struct CoverageThresholds {
+	// Whole report
+	std::optional<double> total;
+	// Every file with instrumented lines
+	std::optional<double> file;
+	// All files under a directory, together
+	std::vector<std::pair<std::string, double>> directories;
+	// Single files, instead of the `file` floor
+	std::vector<std::pair<std::string, double>> files;
+
+	[[nodiscard]] bool Empty() const noexcept {
+		return !total && !file && directories.empty() && files.empty();
+	}
+};
+
+// Thrown by LCOVExporter::Export, after the report is written, when a coverage threshold is not met.
+class CoverageGateFailure : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+/**
+ * Checks coverage thresholds against the LF/LH of the records as they are written, so gating needs no second pass
+ * over the report.
+ *
+ * Each file is compared with its floor when it is added, and its counts go to the report total and to the total of
+ * every thresholded directory above it (found by looking up each of its parent directories, so the cost per file
+ * depends on its depth, not on the number of thresholds). Not thread-safe; files are added in report order.
+ */
+class LCOV_API CoverageGate {
+public:
+	explicit CoverageGate(const CoverageThresholds& thresholds);
+
+	void Add(std::string_view sfPathUtf8, std::uint64_t linesFound, std::uint64_t linesHit);
+
+	// Logs the result of every threshold, failures as errors. Returns whether all of them were met.
+	bool Evaluate(ExporterConfigLog& log) const;
+	[[nodiscard]] bool Passed() const noexcept;
+	// Thresholds checked and thresholds not met (the file floor counts once)
+	[[nodiscard]] std::size_t ThresholdCount() const noexcept;
+	[[nodiscard]] std::size_t FailedCount() const noexcept;
+
+private:
+	struct Totals {
+		std::uint64_t found = 0;
+		std::uint64_t hit = 0;
+	};
+	struct Target {
+		std::string path;
+		double minimum = 0;
+		Totals totals;
+		bool matched = false;
+	};
+	struct BelowFloor {
+		std::string path;
+		Totals totals;
+	};
+	struct TransparentHash {
+		using is_transparent = void;
+		std::size_t operator()(std::string_view text) const noexcept { return std::hash<std::string_view>{}(text); }
+	};
+	using TargetIndex = std::unordered_map<std::string, std::size_t, TransparentHash, std::equal_to<>>;
+
+	static bool Meets(const Totals& totals, double minimum) noexcept;
+
+	std::optional<double> total_;
+	std::optional<double> fileFloor_;
+	Totals reportTotals_;
+	std::vector<Target> directories_;
+	TargetIndex directoryIndex_;
+	std::vector<Target> files_;
+	TargetIndex fileIndex_;
+	std::vector<BelowFloor> belowFloor_;
+};
@@ -0,0 +1,364 @@
+#include "pch.h"
+#include "CoverageSnapshot.h"
+
+#include "TracefileMerger.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+static_assert(std::endian::native == std::endian::little, "Snapshots are read and written in little-endian order");
+
+namespace {
+	constexpr std::string_view Magic = "covlcovS";
+	constexpr std::uint32_t Version = 1;
+	constexpr std::size_t HeaderSize = 48;
+	constexpr std::size_t FileEntrySize = 24;
+
+	template <typename T>
+	void AppendRaw(RecordBuffer& out, T value) {
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		out.Append(std::string_view(bytes, sizeof(T)));
+	}
+
+	template <typename T>
+	T LoadRaw(const char* at) {
+		T value;
+		std::memcpy(&value, at, sizeof(T));
+		return value;
+	}
+
+	template <typename T>
+	bool ReadRaw(std::string_view& in, T& value) {
+		if (in.size() < sizeof(T))
+			return false;
+		value = LoadRaw<T>(in.data());
+		in.remove_prefix(sizeof(T));
+		return true;
+	}
+
+	std::uint64_t ZigZag(std::int64_t delta) {
+		return (static_cast<std::uint64_t>(delta) << 1) ^ static_cast<std::uint64_t>(delta >> 63);
+	}
+
+	std::size_t VarintSize(std::uint64_t value) {
+		std::size_t size = 1;
+		while (value >= 0x80) {
+			value >>= 7;
+			++size;
+		}
+		return size;
+	}
+
+	void AppendVarint(RecordBuffer& out, std::uint64_t value) {
+		while (value >= 0x80) {
+			out.Append(static_cast<char>(value | 0x80));
+			value >>= 7;
+		}
+		out.Append(static_cast<char>(value));
+	}
+
+	bool ReadVarint(std::string_view& in, std::uint64_t& value) {
+		value = 0;
+		for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7) {
+			const auto byte = static_cast<unsigned char>(in.front());
+			in.remove_prefix(1);
+			value |= std::uint64_t{byte & 0x7Fu} << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	// Encoded file handed from EncodeFile to AddEncoded:
+	//   u32 path size | path | u32 line count | u32 hit count | u32 data size | data
+	template <typename Line, typename LineNumber, typename Executed>
+	void Encode(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<Line>& lines, LineNumber lineNumber,
+	            Executed executed) {
+		std::size_t dataSize = (lines.size() + 7) / 8;
+		std::uint32_t hitCount = 0;
+		std::int64_t previous = 0;
+		for (const auto& line : lines) {
+			const auto number = static_cast<std::int64_t>(lineNumber(line));
+			dataSize += VarintSize(ZigZag(number - previous));
+			previous = number;
+			hitCount += executed(line) ? 1 : 0;
+		}
+
+		out.Reserve(out.Size() + 16 + sfPathUtf8.size() + dataSize);
+		AppendRaw(out, static_cast<std::uint32_t>(sfPathUtf8.size()));
+		out.Append(sfPathUtf8);
+		AppendRaw(out, static_cast<std::uint32_t>(lines.size()));
+		AppendRaw(out, hitCount);
+		AppendRaw(out, static_cast<std::uint32_t>(dataSize));
+
+		previous = 0;
+		for (const auto& line : lines) {
+			const auto number = static_cast<std::int64_t>(lineNumber(line));
+			AppendVarint(out, ZigZag(number - previous));
+			previous = number;
+		}
+		for (std::size_t i = 0; i < lines.size(); i += 8) {
+			unsigned bits = 0;
+			for (std::size_t b = 0; b < 8 && i + b < lines.size(); ++b)
+				bits |= (executed(lines[i + b]) ? 1u : 0u) << b;
+			out.Append(static_cast<char>(bits));
+		}
+	}
+}
+
+void SnapshotWriter::EncodeFile(RecordBuffer& out, std::string_view sfPathUtf8,
+                                const std::vector<Plugin::LineCoverage>& lines) {
+	Encode(out, sfPathUtf8, lines, [](const Plugin::LineCoverage& line) { return line.GetLineNumber(); },
+	       [](const Plugin::LineCoverage& line) { return line.HasBeenExecuted(); });
+}
+
+void SnapshotWriter::EncodeFile(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<LineHits>& lines) {
+	Encode(out, sfPathUtf8, lines, [](const LineHits& line) { return line.line; },
+	       [](const LineHits& line) { return line.hits != 0; });
+}
+
+std::uint32_t SnapshotWriter::Intern(std::string_view path) {
+	const auto [it, inserted] = stringIndex_.try_emplace(std::string(path), static_cast<std::uint32_t>(strings_.size()));
+	if (inserted)
+		strings_.push_back(it->first);
+	return it->second;
+}
+
+void SnapshotWriter::AddEncoded(std::string_view encoded) {
+	while (!encoded.empty()) {
+		std::uint32_t pathSize = 0;
+		FileEntry entry{};
+		ReadRaw(encoded, pathSize);
+		entry.path = Intern(encoded.substr(0, pathSize));
+		encoded.remove_prefix(pathSize);
+		ReadRaw(encoded, entry.lineCount);
+		ReadRaw(encoded, entry.hitCount);
+		ReadRaw(encoded, entry.dataSize);
+		entry.dataOffset = data_.size();
+		data_.append(encoded.substr(0, entry.dataSize));
+		encoded.remove_prefix(entry.dataSize);
+		files_.push_back(entry);
+	}
+}
+
+bool SnapshotWriter::Write(const std::filesystem::path& outputPath) const {
+	RecordWriter writer{outputPath};
+	if (!writer.IsOpen())
+		return false;
+
+	std::size_t stringBytes = 0;
+	for (const auto& string : strings_)
+		stringBytes += string.size();
+	const std::uint64_t fileTableOffset = HeaderSize;
+	const std::uint64_t stringTableOffset = fileTableOffset + files_.size() * FileEntrySize;
+	const std::uint64_t dataOffset = stringTableOffset + (strings_.size() + 1) * sizeof(std::uint32_t) + stringBytes;
+
+	auto& out = writer.Buffer();
+	out.Append(Magic);
+	AppendRaw(out, Version);
+	AppendRaw(out, static_cast<std::uint32_t>(strings_.size()));
+	AppendRaw(out, static_cast<std::uint32_t>(files_.size()));
+	AppendRaw(out, std::uint32_t{0});
+	AppendRaw(out, fileTableOffset);
+	AppendRaw(out, stringTableOffset);
+	AppendRaw(out, dataOffset);
+
+	for (const auto& file : files_) {
+		AppendRaw(out, file.path);
+		AppendRaw(out, file.lineCount);
+		AppendRaw(out, file.hitCount);
+		AppendRaw(out, file.dataSize);
+		AppendRaw(out, file.dataOffset);
+		writer.FlushIfFull();
+	}
+
+	std::uint32_t offset = 0;
+	for (const auto& string : strings_) {
+		AppendRaw(out, offset);
+		offset += static_cast<std::uint32_t>(string.size());
+	}
+	AppendRaw(out, offset);
+	for (const auto& string : strings_) {
+		out.Append(string);
+		writer.FlushIfFull();
+	}
+
+	for (std::string_view data = data_; !data.empty();) {
+		const auto block = data.substr(0, RecordWriter::FlushThreshold);
+		out.Append(block);
+		data.remove_prefix(block.size());
+		writer.FlushIfFull();
+	}
+	return writer.Finish();
+}
+
+bool SnapshotReader::Open(const std::filesystem::path& path) {
+	fileCount_ = 0;
+	stringCount_ = 0;
+	if (!file_.Open(path))
+		return false;
+	if (!Validate()) {
+		file_.Close();
+		fileCount_ = 0;
+		stringCount_ = 0;
+		return false;
+	}
+	return true;
+}
+
+bool SnapshotReader::Validate() {
+	const auto bytes = file_.View();
+	if (bytes.size() < HeaderSize || !bytes.starts_with(Magic))
+		return false;
+
+	std::string_view header = bytes.substr(Magic.size());
+	std::uint32_t version = 0, stringCount = 0, fileCount = 0, reserved = 0;
+	std::uint64_t fileTableOffset = 0, stringTableOffset = 0, dataOffset = 0;
+	ReadRaw(header, version);
+	ReadRaw(header, stringCount);
+	ReadRaw(header, fileCount);
+	ReadRaw(header, reserved);
+	ReadRaw(header, fileTableOffset);
+	ReadRaw(header, stringTableOffset);
+	ReadRaw(header, dataOffset);
+	if (version != Version)
+		return false;
+
+	// Sections must follow each other in order and fit in the file.
+	const std::uint64_t stringOffsetsSize = (std::uint64_t{stringCount} + 1) * sizeof(std::uint32_t);
+	if (fileTableOffset != HeaderSize || stringTableOffset != fileTableOffset + std::uint64_t{fileCount} * FileEntrySize ||
+		stringTableOffset + stringOffsetsSize > dataOffset || dataOffset > bytes.size())
+		return false;
+
+	fileCount_ = fileCount;
+	stringCount_ = stringCount;
+	fileTable_ = bytes.substr(fileTableOffset, stringTableOffset - fileTableOffset);
+	stringOffsets_ = bytes.substr(stringTableOffset, stringOffsetsSize);
+	stringBytes_ = bytes.substr(stringTableOffset + stringOffsetsSize, dataOffset - stringTableOffset - stringOffsetsSize);
+	data_ = bytes.substr(dataOffset);
+
+	// Check every offset once here so the accessors can trust them.
+	std::uint32_t previous = 0;
+	for (std::size_t i = 0; i <= stringCount_; ++i) {
+		const auto offset = LoadRaw<std::uint32_t>(stringOffsets_.data() + i * sizeof(std::uint32_t));
+		if (offset < previous || offset > stringBytes_.size())
+			return false;
+		previous = offset;
+	}
+	for (std::size_t i = 0; i < fileCount_; ++i) {
+		const char* entry = fileTable_.data() + i * FileEntrySize;
+		const auto path = LoadRaw<std::uint32_t>(entry);
+		const auto lineCount = LoadRaw<std::uint32_t>(entry + 4);
+		const auto dataSize = LoadRaw<std::uint32_t>(entry + 12);
+		const auto offset = LoadRaw<std::uint64_t>(entry + 16);
+		if (path >= stringCount_ || offset > data_.size() || dataSize > data_.size() - offset ||
+			(std::uint64_t{lineCount} + 7) / 8 > dataSize)
+			return false;
+	}
+	return true;
+}
+
+SnapshotReader::FileView SnapshotReader::File(std::size_t index) const {
+	const char* entry = fileTable_.data() + index * FileEntrySize;
+	FileView file;
+	file.path = LoadRaw<std::uint32_t>(entry);
+	file.lineCount = LoadRaw<std::uint32_t>(entry + 4);
+	file.hitCount = LoadRaw<std::uint32_t>(entry + 8);
+	file.data = data_.substr(LoadRaw<std::uint64_t>(entry + 16), LoadRaw<std::uint32_t>(entry + 12));
+	return file;
+}
+
+std::string_view SnapshotReader::SourceFile(std::size_t index) const {
+	const auto path = File(index).path;
+	const auto begin = LoadRaw<std::uint32_t>(stringOffsets_.data() + path * sizeof(std::uint32_t));
+	const auto end = LoadRaw<std::uint32_t>(stringOffsets_.data() + (path + 1) * sizeof(std::uint32_t));
+	return stringBytes_.substr(begin, end - begin);
+}
+
+std::uint32_t SnapshotReader::HitCount(std::size_t index) const {
+	return File(index).hitCount;
+}
+
+void SnapshotReader::ReadLines(std::size_t index, std::vector<LineHits>& lines) const {
+	const auto file = File(index);
+	lines.clear();
+	lines.reserve(file.lineCount);
+
+	auto varints = file.data.substr(0, file.data.size() - (file.lineCount + 7) / 8);
+	const auto bitmap = file.data.substr(varints.size());
+	std::int64_t previous = 0;
+	for (std::uint32_t i = 0; i < file.lineCount; ++i) {
+		std::uint64_t zigzag = 0;
+		if (!ReadVarint(varints, zigzag))
+			break;
+		previous += static_cast<std::int64_t>(zigzag >> 1) ^ -static_cast<std::int64_t>(zigzag & 1);
+		const bool executed = (static_cast<unsigned char>(bitmap[i / 8]) >> (i % 8)) & 1u;
+		lines.push_back({static_cast<std::uint32_t>(previous), executed ? 1u : 0u});
+	}
+}
+
+bool SnapshotReader::WriteLcov(const std::filesystem::path& outputPath) const {
+	RecordWriter writer{outputPath};
+	if (!writer.IsOpen())
+		return false;
+
+	std::vector<LineHits> lines;
+	for (std::size_t i = 0; i < fileCount_; ++i) {
+		ReadLines(i, lines);
+		RenderFileRecord(writer.Buffer(), SourceFile(i), lines);
+		writer.FlushIfFull();
+	}
+	return writer.Finish();
+}
+
+std::filesystem::path SnapshotSidecarPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".snap";
+	return path;
+}
+
+bool MergeSnapshots(const std::vector<std::filesystem::path>& inputs, const std::filesystem::path& outputPath,
+                    ExporterConfigLog& log) {
+	std::unordered_map<std::string_view, std::vector<LineHits>> files;
+	std::vector<SnapshotReader> readers(inputs.size());
+	std::vector<LineHits> lines;
+	bool ok = true;
+
+	for (std::size_t r = 0; r < inputs.size(); ++r) {
+		auto& reader = readers[r];
+		if (!reader.Open(inputs[r])) {
+			log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot read coverage snapshot: " + inputs[r].string());
+			ok = false;
+			continue;
+		}
+		for (std::size_t i = 0; i < reader.FileCount(); ++i) {
+			reader.ReadLines(i, lines);
+			if (!std::ranges::is_sorted(lines, {}, &LineHits::line))
+				std::ranges::stable_sort(lines, {}, &LineHits::line);
+			// Paths stay valid while the readers keep their files mapped.
+			TracefileMerger::MergeLines(files[reader.SourceFile(i)], std::move(lines));
+			lines = {};
+		}
+	}
+
+	std::vector<const std::pair<const std::string_view, std::vector<LineHits>>*> entries;
+	entries.reserve(files.size());
+	for (const auto& entry : files)
+		entries.push_back(&entry);
+	std::ranges::sort(entries, {}, [](const auto* entry) { return entry->first; });
+
+	SnapshotWriter writer;
+	RecordBuffer encoded;
+	for (const auto* entry : entries) {
+		encoded.Clear();
+		SnapshotWriter::EncodeFile(encoded, entry->first, entry->second);
+		writer.AddEncoded(encoded.View());
+	}
+	if (!writer.Write(outputPath)) {
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot write coverage snapshot: " + outputPath.string());
+		return false;
+	}
+	return ok;
+}
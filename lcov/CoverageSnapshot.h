@@ -0,0 +1,105 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+#include "MappedFile.h"
+#include "RecordWriter.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+/**
+ * Builds a binary coverage snapshot: a compact, memory-mappable alternative to an LCOV tracefile.
+ *
+ * Layout (little-endian, version 1):
+ *   header      "covlcovS" | u32 version | u32 string count | u32 file count | u32 reserved
+ *               | u64 file table offset | u64 string table offset | u64 data offset
+ *   file table  per file: u32 path index | u32 line count | u32 hit count | u32 data size | u64 data offset
+ *   strings     u32 offsets[string count + 1] into the UTF-8 bytes that follow; SF paths are interned
+ *   data        per file: line numbers as zigzag varint deltas, then executed flags packed 8 per byte
+ *
+ * Files keep their export order, so converting a snapshot back to LCOV reproduces the exporter's report.
+ */
+class LCOV_API SnapshotWriter {
+public:
+	// Encodes one file into `out` for a later AddEncoded. Needs no shared state, so workers can call it.
+	static void EncodeFile(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<Plugin::LineCoverage>& lines);
+	// Same, with hit counts; any non-zero count is stored as executed.
+	static void EncodeFile(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<LineHits>& lines);
+
+	// Appends files produced by EncodeFile, in order.
+	void AddEncoded(std::string_view encoded);
+	bool Write(const std::filesystem::path& outputPath) const;
+
+	[[nodiscard]] std::size_t FileCount() const noexcept { return files_.size(); }
+
+private:
+	struct FileEntry {
+		std::uint32_t path;
+		std::uint32_t lineCount;
+		std::uint32_t hitCount;
+		std::uint32_t dataSize;
+		std::uint64_t dataOffset;
+	};
+
+	std::uint32_t Intern(std::string_view path);
+
+	std::unordered_map<std::string, std::uint32_t> stringIndex_;
+	std::vector<std::string_view> strings_; // views of stringIndex_ keys, in index order
+	std::vector<FileEntry> files_;
+	std::string data_;
+};
+
+/**
+ * Reads a snapshot written by SnapshotWriter straight from a memory mapping. Files are decoded only when asked for, so
+ * converting or merging a snapshot never holds more than one decoded file at a time.
+ */
+class LCOV_API SnapshotReader {
+public:
+	// Maps and validates the snapshot. Returns false if it cannot be read or is not a valid snapshot.
+	bool Open(const std::filesystem::path& path);
+
+	[[nodiscard]] std::size_t FileCount() const noexcept { return fileCount_; }
+	[[nodiscard]] std::string_view SourceFile(std::size_t index) const;
+	[[nodiscard]] std::uint32_t HitCount(std::size_t index) const;
+	// Decodes a file's lines; hits are 1 for executed lines and 0 otherwise.
+	void ReadLines(std::size_t index, std::vector<LineHits>& lines) const;
+
+	// Writes the snapshot as an LCOV tracefile, one record per file, in snapshot order.
+	bool WriteLcov(const std::filesystem::path& outputPath) const;
+
+private:
+	struct FileView {
+		std::uint32_t path;
+		std::uint32_t lineCount;
+		std::uint32_t hitCount;
+		std::string_view data;
+	};
+
+	[[nodiscard]] FileView File(std::size_t index) const;
+	bool Validate();
+
+	MappedFile file_;
+	std::size_t fileCount_ = 0;
+	std::size_t stringCount_ = 0;
+	std::string_view fileTable_;
+	std::string_view stringOffsets_;
+	std::string_view stringBytes_;
+	std::string_view data_;
+};
+
+// Snapshot written next to the report when "snapshot: true": "<output>.snap".
+LCOV_API std::filesystem::path SnapshotSidecarPath(const std::filesystem::path& outputPath);
+
+/**
+ * Merges snapshots into one, without going through LCOV text. Lines are unioned per SF path and a line is executed if
+ * it was executed in any input. The output is ordered by SF path.
+ */
+LCOV_API bool MergeSnapshots(const std::vector<std::filesystem::path>& inputs, const std::filesystem::path& outputPath,
+                             ExporterConfigLog& log);
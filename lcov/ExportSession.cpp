@@ -0,0 +1,46 @@
+#include "pch.h"
+#include "ExportSession.h"
+
+#include <cstring>
+
+ExportSession::Scratch::Scratch(std::size_t bytes)
+	: block_(std::make_unique<std::byte[]>(bytes)), resource_(block_.get(), bytes) {}
+
+ExportSession::Lease::~Lease() {
+	if (scratch_)
+		session_->GiveBack(*scratch_);
+}
+
+ExportSession::ExportSession(std::size_t scratchBytes) : scratchBytes_(scratchBytes) {}
+
+std::string_view ExportSession::Keep(std::string_view text) {
+	if (text.empty())
+		return {};
+	auto* copy = static_cast<char*>(arena_.allocate(text.size(), 1));
+	std::memcpy(copy, text.data(), text.size());
+	return {copy, text.size()};
+}
+
+ExportSession::Lease ExportSession::Borrow() {
+	std::lock_guard lock{mutex_};
+	if (free_.empty()) {
+		// Reserved together, so GiveBack never needs to allocate.
+		scratch_.push_back(std::make_unique<Scratch>(scratchBytes_));
+		free_.reserve(scratch_.size());
+		return Lease{*this, *scratch_.back()};
+	}
+	auto* scratch = free_.back();
+	free_.pop_back();
+	return Lease{*this, *scratch};
+}
+
+std::size_t ExportSession::ScratchCount() const {
+	std::lock_guard lock{mutex_};
+	return scratch_.size();
+}
+
+void ExportSession::GiveBack(Scratch& scratch) noexcept {
+	scratch.Rewind();
+	std::lock_guard lock{mutex_};
+	free_.push_back(&scratch);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Memory of one LCOVExporter::Export call.
+ *
+ * Per-file temporaries (SF paths, canonical paths to match, cache keys) are carved out of monotonic arenas instead of
+ * being allocated one by one. Each rendering thread borrows a Scratch arena for a chunk of files and rewinds it after
+ * every file, so it stays within its first block and a file costs no heap allocation. Data that must live until the
+ * end of the export goes into the session arena, and views into it stay valid until the session is destroyed, which
+ * releases everything at once.
+ */
+class LCOV_API ExportSession {
+public:
+	static constexpr std::size_t DefaultScratchBytes = 16 * 1024;
+
+	// Arena for one thread's per-file temporaries. Not thread-safe.
+	class Scratch {
+	public:
+		explicit Scratch(std::size_t bytes);
+
+		std::pmr::memory_resource* Resource() noexcept { return &resource_; }
+		// Frees everything allocated since the last rewind. Strings using the arena must be gone by then.
+		void Rewind() noexcept { resource_.release(); }
+
+	private:
+		std::unique_ptr<std::byte[]> block_;
+		std::pmr::monotonic_buffer_resource resource_;
+	};
+
+	// A Scratch arena lent to the calling thread, rewound and given back to the session at the end of the lease.
+	class Lease {
+	public:
+		Lease(ExportSession& session, Scratch& scratch) noexcept : session_(&session), scratch_(&scratch) {}
+		~Lease();
+		Lease(Lease&& other) noexcept : session_(other.session_), scratch_(std::exchange(other.scratch_, nullptr)) {}
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		Lease& operator=(Lease&&) = delete;
+
+		Scratch& operator*() const noexcept { return *scratch_; }
+		Scratch* operator->() const noexcept { return scratch_; }
+
+	private:
+		ExportSession* session_;
+		Scratch* scratch_;
+	};
+
+	explicit ExportSession(std::size_t scratchBytes = DefaultScratchBytes);
+	ExportSession(const ExportSession&) = delete;
+	ExportSession& operator=(const ExportSession&) = delete;
+
+	// Session arena. Only the thread running the export may allocate from it.
+	std::pmr::memory_resource* Resource() noexcept { return &arena_; }
+	// Copies text into the session arena; the view stays valid until the session is destroyed.
+	std::string_view Keep(std::string_view text);
+
+	// Borrows a Scratch arena, creating one when all are in use. Safe to call from several threads at once.
+	Lease Borrow();
+	// Scratch arenas created so far (at most one per thread rendering at the same time)
+	[[nodiscard]] std::size_t ScratchCount() const;
+
+private:
+	void GiveBack(Scratch& scratch) noexcept;
+
+	std::size_t scratchBytes_;
+	std::pmr::monotonic_buffer_resource arena_;
+	mutable std::mutex mutex_;
+	std::vector<std::unique_ptr<Scratch>> scratch_;
+	std::vector<Scratch*> free_;
+};
@@ -0,0 +1,104 @@
+#include "pch.h"
+#include "ExportStats.h"
+
+#include "RecordWriter.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string_view>
+
+#if defined(_WIN32)
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif
+
+namespace {
+	constexpr std::array<const char*, ExportStats::PhaseCount> PhaseNames = {
+		"configDiscovery", "configParse", "baseDirResolve", "classify", "render", "flush", "total"};
+
+	double Milliseconds(std::chrono::nanoseconds time) {
+		return std::chrono::duration<double, std::milli>(time).count();
+	}
+
+	std::string Format(const char* format, double value) {
+		char text[32];
+		std::snprintf(text, sizeof(text), format, value);
+		return text;
+	}
+}
+
+void ExportStats::AddTime(Phase phase, std::chrono::nanoseconds elapsed) noexcept {
+	phaseNs_[static_cast<std::size_t>(phase)].fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds ExportStats::Time(Phase phase) const noexcept {
+	return std::chrono::nanoseconds{phaseNs_[static_cast<std::size_t>(phase)].load(std::memory_order_relaxed)};
+}
+
+std::string ExportStats::ToJson(const std::filesystem::path& outputPath) const {
+	RecordBuffer output;
+	output.AppendUtf8(outputPath.generic_wstring());
+	RecordBuffer quoted;
+	quoted.AppendJsonString(output.View());
+
+	std::string json = "{\n  \"version\": 1,\n  \"output\": ";
+	json += quoted.View();
+	json += ",\n  \"threads\": " + std::to_string(threads) + ",\n  \"phasesMs\": {";
+	for (std::size_t i = 0; i < PhaseCount; ++i) {
+		json += i == 0 ? "" : ", ";
+		json += std::string("\"") + PhaseNames[i] + "\": " + Format("%.3f", Milliseconds(Time(static_cast<Phase>(i))));
+	}
+	json += "},\n  \"counters\": {";
+	const std::pair<const char*, std::uint64_t> counters[] = {
+		{"filesSeen", filesSeen}, {"filesIncluded", filesIncluded}, {"filesExcluded", filesExcluded},
+		{"recordsReused", recordsReused}, {"linesWritten", linesWritten}, {"recordBytes", recordBytes},
+		{"bytesWritten", bytesWritten}, {"canonicalizations", canonicalizations}, {"peakRssBytes", peakRssBytes}};
+	for (std::size_t i = 0; i < std::size(counters); ++i) {
+		json += i == 0 ? "" : ", ";
+		json += std::string("\"") + counters[i].first + "\": " + std::to_string(counters[i].second);
+	}
+	json += "}\n}\n";
+	return json;
+}
+
+std::string ExportStats::Summary() const {
+	auto ms = [&](Phase phase) { return Format("%.1f ms", Milliseconds(Time(phase))); };
+	return "Export stats: " + std::to_string(filesSeen) + " files (" + std::to_string(filesIncluded) + " included, " +
+	       std::to_string(filesExcluded) + " excluded, " + std::to_string(recordsReused) + " reused), " +
+	       std::to_string(linesWritten) + " lines, " + std::to_string(bytesWritten) + " bytes in " + ms(Phase::Total) +
+	       "; config " + Format("%.1f ms", Milliseconds(Time(Phase::ConfigDiscovery) + Time(Phase::ConfigParse))) +
+	       ", baseDir " + ms(Phase::BaseDirResolve) + ", classify " + ms(Phase::Classify) + ", render " + ms(Phase::Render) +
+	       ", flush " + ms(Phase::Flush) + "; " + std::to_string(canonicalizations) + " canonicalizations, peak RSS " +
+	       Format("%.1f MiB", static_cast<double>(peakRssBytes) / (1024.0 * 1024.0));
+}
+
+bool ExportStats::WriteJson(const std::filesystem::path& jsonPath, const std::filesystem::path& outputPath) const {
+	std::ofstream ofs(jsonPath, std::ios::binary | std::ios::trunc);
+	ofs << ToJson(outputPath);
+	return static_cast<bool>(ofs);
+}
+
+std::filesystem::path ExportStats::SidecarPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".stats.json";
+	return path;
+}
+
+std::uint64_t ExportStats::PeakMemoryBytes() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage{};
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#  if defined(__APPLE__)
+	return static_cast<std::uint64_t>(usage.ru_maxrss);
+#  else
+	return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#  endif
+#endif
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * Phase timers and counters of one export ("stats: true" in .covlcov).
+ *
+ * Everything is atomic so worker threads can add to it directly. Per-file phases (Classify, Render) are summed over
+ * all workers, so with several threads they measure CPU time rather than wall time. The exporter only passes an
+ * ExportStats around when stats are enabled; with a null pointer the helpers below do not even read the clock.
+ */
+class LCOV_API ExportStats {
+public:
+	enum class Phase {
+		ConfigDiscovery, // walking up to find .covlcov
+		ConfigParse,     // reading and parsing it
+		BaseDirResolve,  // resolving and canonicalizing baseDir
+		Classify,        // include/exclude decision and SF path of each file
+		Render,          // formatting records (and snapshot entries)
+		Flush,           // copying records to the writer and writing them to disk
+		Total
+	};
+	static constexpr std::size_t PhaseCount = static_cast<std::size_t>(Phase::Total) + 1;
+
+	void AddTime(Phase phase, std::chrono::nanoseconds elapsed) noexcept;
+	[[nodiscard]] std::chrono::nanoseconds Time(Phase phase) const noexcept;
+
+	std::atomic<std::uint64_t> filesSeen{0};
+	std::atomic<std::uint64_t> filesIncluded{0};
+	std::atomic<std::uint64_t> filesExcluded{0};
+	std::atomic<std::uint64_t> recordsReused{0};
+	std::atomic<std::uint64_t> linesWritten{0};
+	// Uncompressed record bytes, and the size of the report on disk
+	std::atomic<std::uint64_t> recordBytes{0};
+	std::atomic<std::uint64_t> bytesWritten{0};
+	std::atomic<std::uint64_t> canonicalizations{0};
+	std::atomic<std::uint64_t> peakRssBytes{0};
+	unsigned threads = 1;
+
+	// {"phasesMs": {...}, "counters": {...}} for the stats sidecar.
+	[[nodiscard]] std::string ToJson(const std::filesystem::path& outputPath) const;
+	// One line for ExporterConfigLog.
+	[[nodiscard]] std::string Summary() const;
+	bool WriteJson(const std::filesystem::path& jsonPath, const std::filesystem::path& outputPath) const;
+
+	// "<output>.stats.json"
+	static std::filesystem::path SidecarPath(const std::filesystem::path& outputPath);
+	// High-water mark of the process's resident memory (0 when unavailable).
+	static std::uint64_t PeakMemoryBytes();
+
+private:
+	std::array<std::atomic<std::int64_t>, PhaseCount> phaseNs_{};
+};
+
+// Adds the lifetime of the scope to a phase. Does nothing when stats is null.
+class ScopedPhaseTimer {
+public:
+	ScopedPhaseTimer(ExportStats* stats, ExportStats::Phase phase) : stats_(stats), phase_(phase) {
+		if (stats_)
+			start_ = std::chrono::steady_clock::now();
+	}
+	~ScopedPhaseTimer() {
+		if (stats_)
+			stats_->AddTime(phase_, std::chrono::steady_clock::now() - start_);
+	}
+
+	ScopedPhaseTimer(const ScopedPhaseTimer&) = delete;
+	ScopedPhaseTimer& operator=(const ScopedPhaseTimer&) = delete;
+
+private:
+	ExportStats* stats_;
+	ExportStats::Phase phase_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+// Runs fn and returns its result, timing it into a phase when stats is not null.
+template <typename Fn>
+decltype(auto) TimePhase(ExportStats* stats, ExportStats::Phase phase, Fn&& fn) {
+	ScopedPhaseTimer timer{stats, phase};
+	return fn();
+}
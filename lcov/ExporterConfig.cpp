@@ -5,18 +5,209 @@
 
 #include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+
+namespace {
+	// FNV-1a; stable across builds, unlike std::hash.
+	std::uint64_t Fnv1a(std::string_view bytes, std::uint64_t hash = 0xCBF29CE484222325ull) {
+		for (const unsigned char c : bytes) {
+			hash ^= c;
+			hash *= 0x100000001B3ull;
+		}
+		return hash;
+	}
+
+	int Rank(ExporterConfigLog::MsgLevel level) {
+		switch (level) {
+		case ExporterConfigLog::MsgLevel::Error: return 0;
+		case ExporterConfigLog::MsgLevel::Info: return 1;
+		default: return 2;
+		}
+	}
+
+	const char* LevelName(ExporterConfigLog::MsgLevel level) {
+		switch (level) {
+		case ExporterConfigLog::MsgLevel::Error: return "ERROR";
+		case ExporterConfigLog::MsgLevel::Info: return "INFO";
+		default: return "DEBUG";
+		}
+	}
+
+	// Keys are read without YAML's throwing conversions, so a malformed value is logged like any other invalid one
+	// instead of escaping LoadFromYaml. Both return nothing when the key is absent or invalid.
+	std::optional<std::string> ReadScalar(const YAML::Node& root, const char* key, ExporterConfigLog& log) {
+		const auto node = root[key];
+		if (!node)
+			return std::nullopt;
+		if (!node.IsScalar()) {
+			log.AddMsg(ExporterConfigLog::MsgLevel::Error, std::string("Invalid .covlcov: ") + key + " must be a single value");
+			return std::nullopt;
+		}
+		return node.Scalar();
+	}
+
+	std::optional<bool> ReadBool(const YAML::Node& root, const char* key, ExporterConfigLog& log) {
+		const auto node = root[key];
+		if (!node)
+			return std::nullopt;
+		bool value = false;
+		if (!node.IsScalar() || !YAML::convert<bool>::decode(node, value)) {
+			log.AddMsg(ExporterConfigLog::MsgLevel::Error, std::string("Invalid .covlcov: ") + key + " must be true or false" +
+			           (node.IsScalar() ? ", got: " + node.Scalar() : std::string()));
+			return std::nullopt;
+		}
+		return value;
+	}
+
+	// "include"/"exclude" accept a single pattern or a list of them.
+	std::vector<std::string> ReadPatternList(const YAML::Node& root, const char* key, ExporterConfigLog& log) {
+		std::vector<std::string> patterns;
+		const auto node = root[key];
+		if (!node)
+			return patterns;
+		if (node.IsScalar()) {
+			patterns.push_back(node.Scalar());
+			return patterns;
+		}
+		if (node.IsSequence() && std::ranges::all_of(node, [](const YAML::Node& item) { return item.IsScalar(); })) {
+			for (const auto& item : node)
+				patterns.push_back(item.Scalar());
+			return patterns;
+		}
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, std::string("Invalid .covlcov: ") + key + " must be a pattern or a list of patterns");
+		return patterns;
+	}
+
+	// A percentage from 0 to 100.
+	std::optional<double> ReadPercent(const YAML::Node& node, const std::string& key, ExporterConfigLog& log) {
+		const auto text = node.IsScalar() ? node.Scalar() : std::string();
+		double value = -1;
+		const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+		if (ec != std::errc{} || end != text.data() + text.size() || !(value >= 0 && value <= 100)) {
+			log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: " + key + " must be a percentage from 0 to 100, got: " + text);
+			return std::nullopt;
+		}
+		return value;
+	}
+
+	// Threshold paths are compared with SF paths: '/' separated, without a trailing '/' or a leading "./".
+	std::string NormalizeThresholdPath(std::string path) {
+		std::ranges::replace(path, '\\', '/');
+		while (path.size() > 1 && path.back() == '/')
+			path.pop_back();
+		while (path.starts_with("./"))
+			path.erase(0, 2);
+		return path;
+	}
+
+	// "thresholds": total, file, and maps of directories and files to their minimums.
+	CoverageThresholds ReadThresholds(const YAML::Node& node, ExporterConfigLog& log) {
+		CoverageThresholds thresholds;
+		if (!node.IsMap()) {
+			log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: thresholds must be a map");
+			return thresholds;
+		}
+		for (const auto& entry : node) {
+			const auto key = entry.first.Scalar();
+			if (key == "total" || key == "file") {
+				(key == "total" ? thresholds.total : thresholds.file) = ReadPercent(entry.second, "thresholds." + key, log);
+			} else if (key == "directories" || key == "files") {
+				if (!entry.second.IsMap()) {
+					log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: thresholds." + key + " must map paths to percentages");
+					continue;
+				}
+				auto& targets = key == "directories" ? thresholds.directories : thresholds.files;
+				for (const auto& target : entry.second) {
+					const auto path = target.first.Scalar();
+					if (const auto minimum = ReadPercent(target.second, "thresholds." + key + "." + path, log))
+						targets.emplace_back(NormalizeThresholdPath(path), *minimum);
+				}
+			} else {
+				log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: unknown thresholds key: " + key);
+			}
+		}
+		return thresholds;
+	}
+}
+
+struct ExporterConfigLog::LogFile {
+	std::mutex mutex;
+	std::ofstream ofs;
+};
 
 void ExporterConfigLog::AddMsg(MsgLevel level, const std::string& message) {
-	messages.emplace_back(level, message);
+	Add(level, std::string(message));
+}
+
+void ExporterConfigLog::Add(MsgLevel level, std::string&& message) {
+	if (!Enabled(level))
+		return;
+	if (file_) {
+		std::lock_guard lock{file_->mutex};
+		file_->ofs << "LCOV EXPORTER [" << LevelName(level) << "] " << message << '\n';
+	}
+	if (!capturesAll_ && Rank(level) > Rank(level_))
+		return;
+	if (bounded_ && level != MsgLevel::Error && messages.size() >= MaxMessages) {
+		++suppressed_;
+		return;
+	}
+	messages.emplace_back(level, std::move(message));
+}
+
+bool ExporterConfigLog::Enabled(MsgLevel level) const noexcept {
+	return capturesAll_ || file_ || Rank(level) <= Rank(level_);
+}
+
+void ExporterConfigLog::SetLevel(MsgLevel level) {
+	level_ = level;
+	if (!capturesAll_)
+		std::erase_if(messages, [&](const auto& message) { return Rank(message.first) > Rank(level_); });
+}
+
+bool ExporterConfigLog::SetLogFile(const std::filesystem::path& path) {
+	auto file = std::make_shared<LogFile>();
+	file->ofs.open(path, std::ios::binary | std::ios::trunc);
+	if (!file->ofs)
+		return false;
+	for (const auto& [level, msg] : messages)
+		file->ofs << "LCOV EXPORTER [" << LevelName(level) << "] " << msg << '\n';
+	file_ = std::move(file);
+	return true;
+}
+
+void ExporterConfigLog::BufferFor(const ExporterConfigLog& target) {
+	level_ = target.level_;
+	capturesAll_ = target.file_ != nullptr || target.capturesAll_;
+	bounded_ = false;
+}
+
+void ExporterConfigLog::Append(ExporterConfigLog&& other) {
+	for (auto& [level, msg] : other.messages)
+		Add(level, std::move(msg));
+	suppressed_ += std::exchange(other.suppressed_, 0);
+	other.messages.clear();
 }
 
 void ExporterConfigLog::LogMessages() {
 	for (const auto& [level, msg] : messages) {
-		std::cout << "LCOV EXPORTER [" << (level == MsgLevel::Info ? "INFO" : "ERROR") << "] " << msg << '\n';
+		std::cout << "LCOV EXPORTER [" << LevelName(level) << "] " << msg << '\n';
+	}
+	if (suppressed_ != 0) {
+		std::cout << "LCOV EXPORTER [INFO] " << suppressed_ << " more messages not shown"
+			<< (file_ ? " (all messages are in the log file)" : "") << '\n';
+	}
+	if (file_) {
+		std::lock_guard lock{file_->mutex};
+		file_->ofs.flush();
 	}
 }
 
@@ -37,9 +228,15 @@ ExporterConfig::ExporterConfig(std::filesystem::path startDir) {
 	if (ec)
 		startDir = std::filesystem::absolute(startDir, ec);
 
-	if (auto found = FindCovLcovUpwards(startDir)) {
+	// Always timed: two clock reads are negligible next to the file system walk.
+	const auto start = std::chrono::steady_clock::now();
+	const auto found = FindCovLcovUpwards(startDir);
+	const auto discovered = std::chrono::steady_clock::now();
+	discoveryTime_ = discovered - start;
+	if (found) {
 		LoadFromFile(*found);
 		loaded_ = true;
+		parseTime_ = std::chrono::steady_clock::now() - discovered;
 	}
 }
 
@@ -48,6 +245,10 @@ bool ExporterConfig::IsLoaded() const noexcept {
 	return loaded_;
 }
 
+bool ExporterConfig::IsYamlValid() const noexcept {
+	return isYamlValid;
+}
+
 std::optional<std::filesystem::path> ExporterConfig::ConfigPath() const {
 	if (!loaded_)
 		return std::nullopt;
@@ -87,10 +288,13 @@ void ExporterConfig::LoadFromFile(const std::filesystem::path& covlcovPath) {
 		return;
 	}
 
+	const std::string text{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+	fingerprint_ = Fnv1a(text, Fnv1a(covlcovPath_.string()));
+
 	YAML::Node root;
 	try {
 		isYamlValid = true;
-		root = YAML::Load(ifs);
+		root = YAML::Load(text);
 		if (!root.IsMap()) {
 			isYamlValid = false;
 			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: unable to parse.");
@@ -106,30 +310,249 @@ void ExporterConfig::LoadFromFile(const std::filesystem::path& covlcovPath) {
 }
 
 void ExporterConfig::LoadFromYaml(YAML::Node root) {
+	// Logging first, so the messages below already follow it.
+	if (const auto logFileText = ReadScalar(root, "logFile", Log)) {
+		std::filesystem::path logFile = *logFileText;
+		if (logFile.is_relative())
+			logFile = (covlcovPath_.has_parent_path() ? covlcovPath_.parent_path() : std::filesystem::current_path()) / logFile;
+		if (!Log.SetLogFile(logFile))
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot open .covlcov logFile for writing: " + logFile.string());
+	}
+	if (const auto logLevel = ReadScalar(root, "logLevel", Log)) {
+		const auto& level = *logLevel;
+		if (level == "error") {
+			Log.SetLevel(ExporterConfigLog::MsgLevel::Error);
+		} else if (level == "info") {
+			Log.SetLevel(ExporterConfigLog::MsgLevel::Info);
+		} else if (level == "debug") {
+			Log.SetLevel(ExporterConfigLog::MsgLevel::Debug);
+		} else {
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: logLevel must be error, info or debug, got: " + level);
+		}
+	}
 	if (root["baseDir"]) {
-		baseDir_ = root["baseDir"].as<std::string>();
+		if (const auto baseDir = ReadScalar(root, "baseDir", Log))
+			baseDir_ = *baseDir;
 		includeByBaseDir_ = true;
 	} else {
 		baseDir_ = std::filesystem::path(".");
 	}
-	if (root["includeByBaseDir"]) {
-		includeByBaseDir_ = root["includeByBaseDir"].as<bool>();
+	if (const auto value = ReadBool(root, "includeByBaseDir", Log))
+		includeByBaseDir_ = *value;
+	if (const auto threadsValue = ReadScalar(root, "threads", Log)) {
+		const auto& threads = *threadsValue;
+		if (threads == "auto") {
+			threads_ = 0;
+		} else {
+			unsigned value = 0;
+			const auto [end, ec] = std::from_chars(threads.data(), threads.data() + threads.size(), value);
+			if (ec != std::errc{} || end != threads.data() + threads.size() || value == 0) {
+				Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: threads must be a positive number or \"auto\", got: " + threads);
+			} else {
+				threads_ = value;
+			}
+		}
+	}
+	if (const auto value = ReadBool(root, "incremental", Log))
+		incremental_ = *value;
+	if (const auto value = ReadBool(root, "snapshot", Log))
+		snapshot_ = *value;
+	if (const auto value = ReadBool(root, "nestedConfigs", Log))
+		nestedConfigs_ = *value;
+	if (const auto value = ReadBool(root, "mergeDuplicates", Log))
+		mergeDuplicates_ = *value;
+	if (const auto shardsValue = ReadScalar(root, "shards", Log)) {
+		const auto& shards = *shardsValue;
+		unsigned value = 0;
+		const auto [end, ec] = std::from_chars(shards.data(), shards.data() + shards.size(), value);
+		if (ec != std::errc{} || end != shards.data() + shards.size() || value > 4096) {
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: shards must be a number from 0 to 4096, got: " + shards);
+		} else {
+			shards_ = value > 1 ? value : 0;
+		}
+	}
+	if (const auto shardByValue = ReadScalar(root, "shardBy", Log)) {
+		const auto& shardBy = *shardByValue;
+		if (shardBy == "module") {
+			shardBy_ = ShardBy::Module;
+		} else if (shardBy == "directory") {
+			shardBy_ = ShardBy::Directory;
+		} else if (shardBy == "hash") {
+			shardBy_ = ShardBy::Hash;
+		} else {
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: shardBy must be module, directory or hash, got: " + shardBy);
+		}
+	}
+	if (const auto profileValue = ReadScalar(root, "profile", Log)) {
+		const auto& profile = *profileValue;
+		if (profile == "full") {
+			profile_ = OutputProfile::Full;
+		} else if (profile == "compact") {
+			profile_ = OutputProfile::Compact;
+		} else if (profile == "hits-only") {
+			profile_ = OutputProfile::HitsOnly;
+		} else {
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: profile must be full, compact or hits-only, got: " + profile);
+		}
+	}
+	if (const auto value = ReadBool(root, "stats", Log))
+		stats_ = *value;
+	if (const auto value = ReadBool(root, "summary", Log))
+		summary_ = *value;
+	if (const auto value = ReadBool(root, "index", Log))
+		index_ = *value;
+	if (root["thresholds"]) {
+		thresholds_ = ReadThresholds(root["thresholds"], Log);
+	}
+	if (const auto patchDiff = ReadScalar(root, "patchDiff", Log)) {
+		patchDiff_ = *patchDiff;
+		if (patchDiff_->is_relative())
+			patchDiff_ = (covlcovPath_.has_parent_path() ? covlcovPath_.parent_path() : std::filesystem::current_path()) / *patchDiff_;
+	}
+	if (const auto testIndex = ReadScalar(root, "testIndex", Log)) {
+		testIndex_ = *testIndex;
+		if (testIndex_->is_relative())
+			testIndex_ = (covlcovPath_.has_parent_path() ? covlcovPath_.parent_path() : std::filesystem::current_path()) / *testIndex_;
+	}
+	if (const auto value = ReadBool(root, "asyncWrite", Log))
+		asyncWrite_ = *value;
+	if (const auto value = ReadBool(root, "preallocate", Log))
+		preallocate_ = *value;
+	if (const auto compressionLevel = ReadScalar(root, "compressionLevel", Log)) {
+		const auto& level = *compressionLevel;
+		int value = -1;
+		const auto [end, ec] = std::from_chars(level.data(), level.data() + level.size(), value);
+		if (ec != std::errc{} || end != level.data() + level.size() || value < 0 || value > 9) {
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Invalid .covlcov: compressionLevel must be a number from 0 to 9, got: " + level);
+		} else {
+			compressionLevel_ = value;
+		}
+	}
+	const auto include = ReadPatternList(root, "include", Log);
+	const auto exclude = ReadPatternList(root, "exclude", Log);
+	if (!include.empty() || !exclude.empty()) {
+		std::error_code ec;
+		auto anchor = std::filesystem::weakly_canonical(ResolveBaseDir(), ec);
+		if (ec)
+			anchor = ResolveBaseDir();
+		filter_ = PathFilter(include, exclude, anchor);
 	}
 	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Loaded .covlcov configuration from .covlcov at: " + covlcovPath_.string());
 	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "baseDir: " + (baseDir_.has_value() ? baseDir_.value().string() : "none"));
 	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "includeByBaseDir: " + std::to_string(includeByBaseDir_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "threads: " + (threads_ == 0 ? std::string("auto") : std::to_string(threads_)));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "incremental: " + std::to_string(incremental_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "snapshot: " + std::to_string(snapshot_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "asyncWrite: " + std::to_string(asyncWrite_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "preallocate: " + std::to_string(preallocate_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "compressionLevel: " + std::to_string(compressionLevel_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "nestedConfigs: " + std::to_string(nestedConfigs_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "mergeDuplicates: " + std::to_string(mergeDuplicates_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "shards: " + std::to_string(shards_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "profile: " + std::string(profile_ == OutputProfile::Full ? "full" : profile_ == OutputProfile::Compact ? "compact" : "hits-only"));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "stats: " + std::to_string(stats_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "summary: " + std::to_string(summary_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "index: " + std::to_string(index_));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "thresholds: " + std::to_string(thresholds_.directories.size()) + " directories, " +
+	           std::to_string(thresholds_.files.size()) + " files" + (thresholds_.total ? ", total" : "") + (thresholds_.file ? ", per-file floor" : ""));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "patchDiff: " + (patchDiff_ ? patchDiff_->string() : std::string("none")));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "testIndex: " + (testIndex_ ? testIndex_->string() : std::string("none")));
+	Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "include rules: " + std::to_string(include.size()) + ", exclude rules: " + std::to_string(exclude.size()));
+}
+
+unsigned ExporterConfig::Threads() const noexcept {
+	if (threads_ != 0)
+		return threads_;
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+bool ExporterConfig::Incremental() const noexcept {
+	return incremental_;
+}
+
+bool ExporterConfig::Snapshot() const noexcept {
+	return snapshot_;
+}
+
+bool ExporterConfig::AsyncWrite() const noexcept {
+	return asyncWrite_;
+}
+
+bool ExporterConfig::Preallocate() const noexcept {
+	return preallocate_;
+}
+
+int ExporterConfig::CompressionLevel() const noexcept {
+	return compressionLevel_;
+}
+
+bool ExporterConfig::NestedConfigs() const noexcept {
+	return nestedConfigs_;
+}
+
+bool ExporterConfig::MergeDuplicates() const noexcept {
+	return mergeDuplicates_;
+}
+
+unsigned ExporterConfig::Shards() const noexcept {
+	return shards_;
+}
+
+ShardBy ExporterConfig::ShardAssignment() const noexcept {
+	return shardBy_;
+}
+
+OutputProfile ExporterConfig::Profile() const noexcept {
+	return profile_;
+}
+
+bool ExporterConfig::Stats() const noexcept {
+	return stats_;
+}
+
+bool ExporterConfig::Summary() const noexcept {
+	return summary_;
+}
+
+bool ExporterConfig::Index() const noexcept {
+	return index_;
+}
+
+const CoverageThresholds& ExporterConfig::Thresholds() const noexcept {
+	return thresholds_;
+}
+
+std::optional<std::filesystem::path> ExporterConfig::PatchDiff() const {
+	return patchDiff_;
+}
+
+std::optional<std::filesystem::path> ExporterConfig::TestIndexPath() const {
+	return testIndex_;
+}
+
+std::uint64_t ExporterConfig::Fingerprint() const noexcept {
+	return fingerprint_;
+}
+
+const PathFilter& ExporterConfig::Filter() const noexcept {
+	return filter_;
 }
 
 std::filesystem::path ExporterConfig::GetResolvedBaseDir() const {
 	if (!loaded_ || !baseDir_.has_value())
 		return {};
+	return ResolveBaseDir();
+}
 
+// baseDir resolved against the .covlcov directory (the current directory when there is no file); "." when unset.
+std::filesystem::path ExporterConfig::ResolveBaseDir() const {
+	const auto baseDir = baseDir_.value_or(std::filesystem::path("."));
 	const auto cfgDir = covlcovPath_.has_parent_path()
 		                    ? covlcovPath_.parent_path()
 		                    : std::filesystem::current_path();
 
 
-	return baseDir_->is_absolute() ? *baseDir_ : ((*baseDir_ == std::filesystem::path(".")) ? cfgDir : (cfgDir / *baseDir_));
+	return baseDir.is_absolute() ? baseDir : ((baseDir == std::filesystem::path(".")) ? cfgDir : (cfgDir / baseDir));
 }
 
 /**
@@ -174,12 +597,22 @@ std::filesystem::path ExporterConfig::MakeSFPath(const std::filesystem::path& pa
  *
  * If a .covlcov file is loaded, only files within matching within the baseDir are included.
  *
+ * Files rejected by the "include"/"exclude" rules are never included.
+ *
  * If no baseDir
  *
  * @param path The path of the file to check
  * @return Whether the file should be included in the lcov report
  */
 bool ExporterConfig::ShouldIncludeInReportByPath(const std::filesystem::path& path) const {
+	if (!filter_.Empty()) {
+		std::error_code ec;
+		auto absFile = std::filesystem::weakly_canonical(path, ec);
+		if (ec) absFile = path;
+		if (!filter_.Matches(absFile))
+			return false;
+	}
+
 	if (!IncludeByBaseDir())
 		return true;
 
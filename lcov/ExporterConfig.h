@@ -1,28 +1,88 @@
 #pragma once
 
+#include "CoverageGate.h"
+#include "LcovApi.h"
+#include "PathFilter.h"
+#include "RecordWriter.h"
+
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 
 namespace YAML {
 	class Node;
 }
 
-class ExporterConfigLog {
+/**
+ * Messages of the exporter, printed to stdout by LogMessages.
+ *
+ * Messages above the active level ("logLevel" in .covlcov) are dropped before they are formatted: pass a callable
+ * returning the text and it is only called when the message is kept. With a log file ("logFile"), every message of
+ * every level is also written there. At most MaxMessages messages are held for the console; later ones are counted
+ * and reported as suppressed, except errors, which are always kept.
+ */
+class LCOV_API ExporterConfigLog {
 public:
 	enum class MsgLevel {
 		Info,
-		Error
+		Error,
+		Debug
 	};
+	static constexpr std::size_t MaxMessages = 1000;
 
 	void AddMsg(MsgLevel level, const std::string& message);
+	template <typename Format>
+		requires std::is_invocable_r_v<std::string, Format&>
+	void AddMsg(MsgLevel level, Format&& format) {
+		if (Enabled(level))
+			AddMsg(level, std::string(format()));
+	}
+	// Whether a message of this level would be kept or written to the log file.
+	[[nodiscard]] bool Enabled(MsgLevel level) const noexcept;
+
+	// Sets the console level and drops held messages above it.
+	void SetLevel(MsgLevel level);
+	[[nodiscard]] MsgLevel Level() const noexcept { return level_; }
+	// Writes every message, including those held so far, to a file (truncated) as well as the console.
+	bool SetLogFile(const std::filesystem::path& path);
+	// Makes this log a staging buffer for target (e.g. on a worker thread): it keeps, without a bound, every message
+	// target would keep or write to its file, until it is Append'ed to target.
+	void BufferFor(const ExporterConfigLog& target);
+
+	// Moves another log's messages to the end of this one, keeping their order.
+	void Append(ExporterConfigLog&& other);
 	void LogMessages();
 	bool HasErrors() const;
 
 	std::vector<std::pair<MsgLevel, std::string>> messages;
+
+private:
+	struct LogFile;
+
+	void Add(MsgLevel level, std::string&& message);
+
+	MsgLevel level_ = MsgLevel::Info;
+	bool capturesAll_ = false; // BufferFor a log with a file
+	bool bounded_ = true;
+	std::size_t suppressed_ = 0;
+	std::shared_ptr<LogFile> file_;
+};
+
+// How files are split between shards ("shardBy" in .covlcov).
+enum class ShardBy {
+	Module,
+	Directory,
+	Hash
 };
 
-class ExporterConfig {
+class LCOV_API ExporterConfig {
 public:
 	ExporterConfigLog Log;
 	/**
@@ -33,6 +93,8 @@ public:
 	explicit ExporterConfig(std::filesystem::path startDir);
 
 	bool IsLoaded() const noexcept;
+	// False when the .covlcov could not be read or parsed
+	bool IsYamlValid() const noexcept;
 	std::optional<std::filesystem::path> ConfigPath() const;
 
 	// If true, only include files under baseDir and emit SF paths relative to baseDir.
@@ -40,17 +102,61 @@ public:
 
 	// Helper used by exporter when iterating files.
 	bool ShouldIncludeInReportByPath(const std::filesystem::path& path) const;
+	// Compiled "include"/"exclude" rules (empty when neither is set)
+	const PathFilter& Filter() const noexcept;
 	// Resolved base directory (empty if baseDir not set or config not loaded)
 	std::filesystem::path GetResolvedBaseDir() const;
 
 	// Returns the path that should be written to LCOV "SF:" line.
 	// If IncludeByBaseDir() is true, returns path relative to resolved baseDir (when possible).
 	std::filesystem::path MakeSFPath(const std::filesystem::path& path) const;
+
+	// Number of threads used to render records. "threads: auto" resolves to the hardware concurrency.
+	unsigned Threads() const noexcept;
+
+	// If true, records of files whose coverage did not change are reused from the previous export's cache.
+	bool Incremental() const noexcept;
+	// If true, a binary coverage snapshot (see SnapshotWriter) is written next to the report.
+	bool Snapshot() const noexcept;
+	// If true (the default), plain output is written by a background thread while rendering continues.
+	bool AsyncWrite() const noexcept;
+	// If true, plain reports are sized exactly up front, preallocated and written through a memory mapping.
+	bool Preallocate() const noexcept;
+	// zlib level (0-9) used when the output path ends in ".gz".
+	int CompressionLevel() const noexcept;
+	// If true, files listed under several modules are written as one record with their coverage unioned.
+	bool MergeDuplicates() const noexcept;
+	// If true, each file is governed by the nearest .covlcov above it instead of this one alone (see ConfigTree).
+	bool NestedConfigs() const noexcept;
+	// Number of shard files to split the report into; 0 writes a single report (see ShardPlan.h).
+	unsigned Shards() const noexcept;
+	ShardBy ShardAssignment() const noexcept;
+	// Lines written per record ("profile": full, compact or hits-only; see OutputProfile).
+	OutputProfile Profile() const noexcept;
+	// If true, per-file and per-directory LF/LH with record offsets are written next to the report (see ReportSummary).
+	bool Summary() const noexcept;
+	// If true, a sorted SF path table with record offsets is written next to the report (see ReportIndex).
+	bool Index() const noexcept;
+	// Minimum line coverage the report must reach, checked as it is written (see CoverageGate). Empty when not set.
+	const CoverageThresholds& Thresholds() const noexcept;
+	// If true, phase timings and counters are written next to the report (see ExportStats).
+	bool Stats() const noexcept;
+	// Unified diff to measure patch coverage against (see PatchCoverage), relative paths resolved against .covlcov.
+	std::optional<std::filesystem::path> PatchDiff() const;
+	// Index each export adds its test's executed lines to (see TestIndex), relative paths resolved against .covlcov.
+	std::optional<std::filesystem::path> TestIndexPath() const;
+	// Time the constructor spent finding and loading .covlcov
+	std::chrono::nanoseconds DiscoveryTime() const noexcept { return discoveryTime_; }
+	std::chrono::nanoseconds ParseTime() const noexcept { return parseTime_; }
+	// Hash of the .covlcov content and location (0 when none was loaded). Changes invalidate the incremental cache.
+	std::uint64_t Fingerprint() const noexcept;
+
 	void LoadFromYaml(YAML::Node root);
 	void LoadFromFile(const std::filesystem::path& covlcovPath);
 
 private:
 	static std::optional<std::filesystem::path> FindCovLcovUpwards(const std::filesystem::path& startDir);
+	std::filesystem::path ResolveBaseDir() const;
 
 private:
 	bool loaded_{false};
@@ -58,5 +164,26 @@ private:
 
 	std::optional<std::filesystem::path> baseDir_; // raw from yaml
 	bool includeByBaseDir_ = false;
+	unsigned threads_ = 1; // 0 = auto
+	bool incremental_ = false;
+	bool snapshot_ = false;
+	int compressionLevel_ = 6;
+	bool asyncWrite_ = true;
+	bool preallocate_ = false;
+	bool stats_ = false;
+	bool summary_ = false;
+	bool index_ = false;
+	bool nestedConfigs_ = false;
+	bool mergeDuplicates_ = false;
+	unsigned shards_ = 0;
+	ShardBy shardBy_ = ShardBy::Module;
+	OutputProfile profile_ = OutputProfile::Full;
+	CoverageThresholds thresholds_;
+	std::optional<std::filesystem::path> patchDiff_;
+	std::optional<std::filesystem::path> testIndex_;
+	std::chrono::nanoseconds discoveryTime_{};
+	std::chrono::nanoseconds parseTime_{};
+	PathFilter filter_;
+	std::uint64_t fingerprint_ = 0;
 	bool isYamlValid = false;
 };
@@ -0,0 +1,156 @@
+#include "pch.h"
+#include "GzipWriter.h"
+
+#include <algorithm>
+#include <cwctype>
+
+#include <zlib.h>
+
+bool IsGzipPath(const std::filesystem::path& path) {
+	auto extension = path.extension().wstring();
+	std::ranges::transform(extension, extension.begin(), [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+	return extension == L".gz";
+}
+
+bool Gunzip(std::string_view input, std::string& output) {
+	output.clear();
+	z_stream stream{};
+	// 15 window bits + 16 accepts the gzip wrapper only.
+	if (inflateInit2(&stream, 15 + 16) != Z_OK)
+		return false;
+
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+	stream.avail_in = static_cast<uInt>(input.size());
+	char buffer[64 * 1024];
+	int result = Z_OK;
+	while (true) {
+		stream.next_out = reinterpret_cast<Bytef*>(buffer);
+		stream.avail_out = sizeof(buffer);
+		result = inflate(&stream, Z_NO_FLUSH);
+		output.append(buffer, sizeof(buffer) - stream.avail_out);
+		if (result == Z_STREAM_END) {
+			// The next member, if any, starts right after this one.
+			if (stream.avail_in == 0 || inflateReset(&stream) != Z_OK)
+				break;
+		} else if (result != Z_OK) {
+			break;
+		}
+	}
+	inflateEnd(&stream);
+	return result == Z_STREAM_END && stream.avail_in == 0;
+}
+
+GzipWriter::GzipWriter(std::ostream& out, int level, unsigned threads)
+	: out_(out), level_(level), window_(std::size_t{std::max(threads, 1u)} * 2) {
+	for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+		workers_.emplace_back([this] { Work(); });
+}
+
+GzipWriter::~GzipWriter() {
+	Stop();
+}
+
+bool GzipWriter::Compress(std::string_view input, int level, std::string& member) {
+	z_stream stream{};
+	// 15 window bits + 16 selects the gzip wrapper instead of zlib's own.
+	if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	member.resize(deflateBound(&stream, static_cast<uLong>(input.size())));
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+	stream.avail_in = static_cast<uInt>(input.size());
+	stream.next_out = reinterpret_cast<Bytef*>(member.data());
+	stream.avail_out = static_cast<uInt>(member.size());
+	const bool ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+	member.resize(ok ? stream.total_out : 0);
+	deflateEnd(&stream);
+	return ok;
+}
+
+void GzipWriter::Work() {
+	std::unique_lock lock{mutex_};
+	while (true) {
+		cv_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+		if (pending_.empty())
+			return;
+		auto* job = pending_.front();
+		pending_.pop_front();
+
+		lock.unlock();
+		job->ok = Compress(job->input, level_, job->member);
+		std::string{}.swap(job->input);
+		lock.lock();
+
+		job->done = true;
+		cv_.notify_all();
+	}
+}
+
+void GzipWriter::WriteReady(std::unique_lock<std::mutex>& lock, bool drain) {
+	while (!queue_.empty()) {
+		if (!queue_.front()->done) {
+			if (!drain && queue_.size() <= window_)
+				return;
+			cv_.wait(lock, [&] { return queue_.front()->done; });
+		}
+		auto job = std::move(queue_.front());
+		queue_.pop_front();
+
+		// Only the calling thread writes, so the stream needs no lock.
+		lock.unlock();
+		if (!job->ok)
+			failed_ = true;
+		if (!failed_) {
+			out_.write(job->member.data(), static_cast<std::streamsize>(job->member.size()));
+			failed_ = !out_;
+			wroteMember_ = true;
+		}
+		lock.lock();
+	}
+}
+
+bool GzipWriter::Write(std::string block) {
+	if (block.empty())
+		return !failed_;
+
+	std::unique_lock lock{mutex_};
+	auto job = std::make_unique<Job>();
+	job->input = std::move(block);
+	pending_.push_back(job.get());
+	queue_.push_back(std::move(job));
+	cv_.notify_all();
+	WriteReady(lock, false);
+	return !failed_;
+}
+
+bool GzipWriter::Finish() {
+	{
+		std::unique_lock lock{mutex_};
+		WriteReady(lock, true);
+	}
+	Stop();
+	// A zero-byte file is not valid gzip; an empty report is one empty member.
+	if (!wroteMember_ && !failed_) {
+		std::string member;
+		failed_ = !Compress({}, level_, member);
+		if (!failed_) {
+			out_.write(member.data(), static_cast<std::streamsize>(member.size()));
+			failed_ = !out_;
+			wroteMember_ = true;
+		}
+	}
+	return !failed_;
+}
+
+void GzipWriter::Stop() {
+	{
+		std::lock_guard lock{mutex_};
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	for (auto& worker : workers_) {
+		if (worker.joinable())
+			worker.join();
+	}
+	workers_.clear();
+}
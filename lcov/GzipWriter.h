@@ -0,0 +1,73 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// True when the path ends in ".gz" (any case), i.e. the report should be written gzip-compressed.
+LCOV_API bool IsGzipPath(const std::filesystem::path& path);
+// Inflates every gzip member of input, back to back, into output. Returns false if input is not complete gzip data.
+LCOV_API bool Gunzip(std::string_view input, std::string& output);
+
+/**
+ * Compresses blocks into independent gzip members on worker threads and writes them to a stream in submission order.
+ *
+ * A gzip file may hold several members back to back (RFC 1952, 2.2); gzip, zcat, zlib's gzread and lcov's own tools
+ * read them as one stream. Compressing each block on its own costs a little ratio but lets blocks be compressed in
+ * parallel while the caller keeps rendering. At most two blocks per thread are in flight, so memory stays flat.
+ */
+class LCOV_API GzipWriter {
+public:
+	// level: zlib compression level 0-9; threads: compression workers (at least one).
+	GzipWriter(std::ostream& out, int level, unsigned threads);
+	~GzipWriter();
+
+	GzipWriter(const GzipWriter&) = delete;
+	GzipWriter& operator=(const GzipWriter&) = delete;
+
+	// Queues a block and writes any members that are ready. Waits when too many blocks are in flight.
+	// Returns false once compressing or writing has failed.
+	bool Write(std::string block);
+	// Writes the remaining members and stops the workers; an empty member when nothing was written, so the output is
+	// always valid gzip. Returns false if anything failed.
+	bool Finish();
+
+	// Compresses input as one complete gzip member.
+	static bool Compress(std::string_view input, int level, std::string& member);
+
+private:
+	struct Job {
+		std::string input;
+		std::string member;
+		bool done = false;
+		bool ok = false;
+	};
+
+	void Work();
+	// Writes finished members from the front of the queue. With drain, waits until the queue is empty.
+	void WriteReady(std::unique_lock<std::mutex>& lock, bool drain);
+	void Stop();
+
+	std::ostream& out_;
+	int level_;
+	std::size_t window_;
+	bool failed_ = false;
+	bool wroteMember_ = false;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<std::unique_ptr<Job>> queue_; // submission order
+	std::deque<Job*> pending_;               // not yet picked up by a worker
+	bool stopping_ = false;
+	std::vector<std::thread> workers_;
+};
@@ -3,75 +3,76 @@
 
 #include "Plugin/Exporter/ModuleCoverage.hpp"
 #include "Plugin/Exporter/FileCoverage.hpp"
-#include "Plugin/Exporter/LineCoverage.hpp"
 #include "Plugin/OptionsParserException.hpp"
 
+#include <algorithm>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
 
+#include "CoverageGate.h"
 #include "ExporterConfig.h"
+#include "GzipWriter.h"
+#include "RecordWriter.h"
+#include "TracefileWriter.h"
+
+namespace {
+	// Export argument: "<output>[;diff=<unified diff>][;test=<test name>]".
+	struct ExportArgument {
+		std::filesystem::path output = L"lcov.info";
+		std::optional<std::filesystem::path> diff;
+		std::optional<std::wstring> test;
+		// Set when an option is not recognized
+		std::wstring invalidOption;
+	};
+
+	ExportArgument ParseExportArgument(const std::optional<std::wstring>& argument) {
+		ExportArgument parsed;
+		if (!argument)
+			return parsed;
+		std::wstring_view rest = *argument;
+		const auto output = rest.substr(0, rest.find(L';'));
+		if (!output.empty())
+			parsed.output = output;
+		rest.remove_prefix(std::min(rest.size(), output.size() + 1));
+		while (!rest.empty()) {
+			const auto option = rest.substr(0, rest.find(L';'));
+			rest.remove_prefix(std::min(rest.size(), option.size() + 1));
+			if (option.starts_with(L"diff=") && option.size() > 5) {
+				parsed.diff = option.substr(5);
+			} else if (option.starts_with(L"test=") && option.size() > 5) {
+				parsed.test = option.substr(5);
+			} else if (!option.empty()) {
+				parsed.invalidOption = option;
+			}
+		}
+		return parsed;
+	}
+}
 
 std::optional<std::filesystem::path> LCOVExporter::Export(const Plugin::CoverageData& coverageData,
                                                           const std::optional<std::wstring>& argument) {
-	std::filesystem::path outputPath = argument ? *argument : L"lcov.info";
-	std::wofstream ofs{outputPath, std::ios::binary};
-	if (!ofs) {
-		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error,
-		               "LCOV Exporter: Cannot create the output file for LCOV export: " +
-		               outputPath.string());
-		cfg.Log.LogMessages();
-		return outputPath;
-	}
-
-	if (cfg.Log.HasErrors()) {
-		cfg.Log.LogMessages();
-		return outputPath;
-	}
-
-	if (coverageData.GetModules().empty()) {
-		return outputPath;
-	}
-
-	if (cfg.GetResolvedBaseDir() != std::filesystem::path{}) {
-		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Base directory resolved to: " + cfg.GetResolvedBaseDir().string());
-		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Only files within base directory will be included in report");
-	}
-
+	const auto parsedArgument = ParseExportArgument(argument);
+	// OpenCppCoverage holds the whole run until Export returns, so the writer reads it in place and renders every file
+	// in one pass at Finish.
+	TracefileWriter writer{cfg, parsedArgument.output, parsedArgument.diff, TracefileWriter::Input::Retained};
+	// .covlcov's testIndex files the run's lines under the argument's test name, or else the run's own name.
+	std::string testName;
+	EncodeUtf8(testName, parsedArgument.test.value_or(coverageData.GetName()));
+	writer.SetTestName(std::move(testName));
 	for (const auto& mod : coverageData.GetModules()) {
-		for (const auto& file : mod->GetFiles()) {
-			const auto sfPath = cfg.MakeSFPath(file->GetPath());
-			if (!cfg.ShouldIncludeInReportByPath(file->GetPath())) {
-				cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Excluding file from report. Not within configured include path: " + sfPath.string());
-				continue;
-			}
-			ofs << "TN:" << '\n';
-			// Source file path
-			ofs << "SF:" << sfPath.generic_wstring() << '\n';
-			const auto& lines = file->GetLines();
-
-			// DA entries: one per line, hit count is 1 (executed) or 0 (not)
-			for (const auto& line : lines) {
-				if (line.HasBeenExecuted()) {
-					ofs << "DA:" << line.GetLineNumber() << ",1" << '\n';
-				} else {
-					// TODO: Should the inclusion of zero-hits be an option?
-					ofs << "DA:" << line.GetLineNumber() << ",0" << '\n';
-				}
-			}
-
-			// LF: lines found, LH: lines hit
-			auto coveredCount = std::ranges::count_if(lines, [](const auto& line) {
-				return line.HasBeenExecuted();
-			});
-			ofs << "LF:" << lines.size() << '\n';
-			ofs << "LH:" << coveredCount << '\n';
-			ofs << "end_of_record\n";
-		}
+		writer.BeginModule(mod->GetPath());
+		for (const auto& file : mod->GetFiles())
+			writer.AddFile(*file);
+		writer.EndModule();
 	}
-
-	cfg.Log.LogMessages();
-	return outputPath;
+	auto report = writer.Finish();
+	// OpenCppCoverage only fails the run (non-zero exit code) when the export throws.
+	if (writer.GateFailed())
+		throw CoverageGateFailure("LCOV Exporter: coverage thresholds not met, see the log above");
+	return report;
 }
 
 void LCOVExporter::CheckArgument(const std::optional<std::wstring>& argument) {
@@ -84,10 +85,25 @@ void LCOVExporter::CheckArgument(const std::optional<std::wstring>& argument) {
 	std::wcout << "LCOVExporter::CheckArgument: current working directory=\""
 		<< std::filesystem::current_path().wstring() << "\"\n";
 
+	const auto parsed = ParseExportArgument(argument);
+	if (!parsed.invalidOption.empty()) {
+		throw Plugin::OptionsParserException("Invalid option for LCOV export, expected diff=<file> or test=<name>.");
+	}
 	// Try to check if the argument is a file.
-	if (argument && !std::filesystem::path{*argument}.has_filename()) {
+	if (!parsed.output.has_filename()) {
 		throw Plugin::OptionsParserException("Invalid argument for LCOV export.");
 	}
+	if (IsGzipPath(parsed.output)) {
+		std::wcout << "LCOVExporter::CheckArgument: output will be gzip-compressed\n";
+	}
+	if (parsed.diff) {
+		if (!std::filesystem::is_regular_file(*parsed.diff))
+			throw Plugin::OptionsParserException("Diff file for LCOV patch coverage not found.");
+		std::wcout << "LCOVExporter::CheckArgument: patch coverage against \"" << parsed.diff->wstring() << "\"\n";
+	}
+	if (parsed.test) {
+		std::wcout << "LCOVExporter::CheckArgument: lines attributed to test \"" << *parsed.test << "\"\n";
+	}
 
 	std::wcout << std::wstring(5, '\n');
 }
@@ -96,7 +112,12 @@ std::wstring LCOVExporter::GetArgumentHelpDescription() {
 	return L" lcov exporter plugin help\n"
 		L"  LCOV format export (optional output file)\n"
 		L" --export_type=lcov:reports/coverage.info\n"
-		L"If omitted, defaults to lcov.info\n";
+		L"If omitted, defaults to lcov.info\n"
+		L"A path ending in .gz (e.g. coverage.info.gz) is written gzip-compressed\n"
+		L"Append ;diff=<file> to measure coverage of the lines changed by a unified diff\n"
+		L" --export_type=lcov:coverage.info;diff=changes.diff\n"
+		L"Append ;test=<name> to name the run in the .covlcov testIndex (default: the run's name)\n"
+		L" --export_type=lcov:coverage.info;test=ParserTests\n";
 }
 
 int LCOVExporter::GetExportPluginVersion() const { return 1; }
@@ -1,15 +1,10 @@
 #pragma once
 
 #include "ExporterConfig.h"
+#include "LcovApi.h"
 
 #include <filesystem>
 
-#ifdef LCOV_EXPORTS
-#  define LCOV_API __declspec(dllexport)
-#else
-#  define LCOV_API __declspec(dllimport)
-#endif
-
 #include "Plugin/Exporter/IExportPlugin.hpp"
 #include "Plugin/Exporter/CoverageData.hpp"
 
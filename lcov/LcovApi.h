@@ -0,0 +1,11 @@
+#pragma once
+
+#if defined(_WIN32)
+#  ifdef LCOV_EXPORTS
+#    define LCOV_API __declspec(dllexport)
+#  else
+#    define LCOV_API __declspec(dllimport)
+#  endif
+#else
+#  define LCOV_API __attribute__((visibility("default")))
+#endif
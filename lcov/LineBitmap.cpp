@@ -0,0 +1,51 @@
+#include "pch.h"
+#include "LineBitmap.h"
+
+#include <bit>
+
+void LineBitmap::Add(const std::vector<Plugin::LineCoverage>& lines) {
+	for (const auto& line : lines)
+		Set(static_cast<std::uint32_t>(line.GetLineNumber()), line.HasBeenExecuted());
+}
+
+void LineBitmap::Set(std::uint32_t line, bool executed) {
+	const std::uint32_t word = line / 64;
+	if (instrumented_.empty()) {
+		firstLine_ = word * 64;
+	} else if (line < firstLine_) {
+		// Rare: lines usually arrive in ascending order, so the bitmap only grows at the end.
+		const std::size_t extra = firstLine_ / 64 - word;
+		instrumented_.insert(instrumented_.begin(), extra, 0);
+		executed_.insert(executed_.begin(), extra, 0);
+		firstLine_ = word * 64;
+	}
+	const std::size_t index = word - firstLine_ / 64;
+	if (index >= instrumented_.size()) {
+		instrumented_.resize(index + 1, 0);
+		executed_.resize(index + 1, 0);
+	}
+	const auto bit = std::uint64_t{1} << (line % 64);
+	instrumented_[index] |= bit;
+	if (executed)
+		executed_[index] |= bit;
+}
+
+std::vector<Plugin::LineCoverage> LineBitmap::Lines() const {
+	std::vector<Plugin::LineCoverage> lines;
+	lines.reserve(LineCount());
+	for (std::size_t index = 0; index < instrumented_.size(); ++index) {
+		for (auto bits = instrumented_[index]; bits != 0; bits &= bits - 1) {
+			const auto bit = std::countr_zero(bits);
+			const auto line = firstLine_ + static_cast<std::uint32_t>(index * 64 + bit);
+			lines.emplace_back(line, (executed_[index] >> bit & 1) != 0);
+		}
+	}
+	return lines;
+}
+
+std::size_t LineBitmap::LineCount() const noexcept {
+	std::size_t count = 0;
+	for (const auto word : instrumented_)
+		count += std::popcount(word);
+	return count;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+/**
+ * Instrumented and executed flags of one source file, two bits per line between its first and last instrumented line.
+ *
+ * Used to union the coverage of a file that several modules were compiled from (a header, a static library source):
+ * adding each copy's lines keeps a line executed if any copy executed it, in memory that grows with the file's line
+ * span rather than with the number of copies.
+ */
+class LCOV_API LineBitmap {
+public:
+	void Add(const std::vector<Plugin::LineCoverage>& lines);
+	void Set(std::uint32_t line, bool executed);
+
+	// Union of everything added, in ascending line order.
+	[[nodiscard]] std::vector<Plugin::LineCoverage> Lines() const;
+	[[nodiscard]] std::size_t LineCount() const noexcept;
+
+private:
+	// Line number of bit 0 of the first word; a multiple of 64.
+	std::uint32_t firstLine_ = 0;
+	std::vector<std::uint64_t> instrumented_;
+	std::vector<std::uint64_t> executed_;
+};
@@ -0,0 +1,213 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+#if !defined(_WIN32)
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+MappedOutputFile::~MappedOutputFile() {
+	Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::filesystem::path& path) {
+	Close();
+	const HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                                FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size{};
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	if (size.QuadPart == 0) {
+		CloseHandle(file);
+		open_ = true;
+		return true;
+	}
+
+	mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping_ == nullptr)
+		return false;
+
+	data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+	if (data_ == nullptr) {
+		CloseHandle(mapping_);
+		mapping_ = nullptr;
+		return false;
+	}
+	size_ = static_cast<std::size_t>(size.QuadPart);
+	open_ = true;
+	return true;
+}
+
+void MappedFile::Close() noexcept {
+	if (data_ != nullptr)
+		UnmapViewOfFile(data_);
+	if (mapping_ != nullptr)
+		CloseHandle(mapping_);
+	data_ = nullptr;
+	mapping_ = nullptr;
+	size_ = 0;
+	open_ = false;
+}
+
+bool MappedOutputFile::Create(const std::filesystem::path& path, std::uint64_t size) {
+	Close();
+	const HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+	                                FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Sets the end of file once, so NTFS allocates the whole report in one extent where it can.
+	LARGE_INTEGER end{};
+	end.QuadPart = static_cast<LONGLONG>(size);
+	if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+		CloseHandle(file);
+		return false;
+	}
+	if (size == 0) {
+		CloseHandle(file);
+		open_ = true;
+		return true;
+	}
+
+	mapping_ = CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	if (mapping_ == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0));
+	if (data_ == nullptr) {
+		CloseHandle(mapping_);
+		CloseHandle(file);
+		mapping_ = nullptr;
+		return false;
+	}
+	file_ = file;
+	size_ = static_cast<std::size_t>(size);
+	open_ = true;
+	return true;
+}
+
+bool MappedOutputFile::Close() noexcept {
+	bool flushed = true;
+	if (data_ != nullptr) {
+		// FlushViewOfFile only starts writing the pages; FlushFileBuffers waits for them and reports failures.
+		flushed = FlushViewOfFile(data_, 0) != 0;
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_ != nullptr)
+		CloseHandle(mapping_);
+	if (file_ != nullptr) {
+		flushed = FlushFileBuffers(file_) != 0 && flushed;
+		CloseHandle(file_);
+	}
+	data_ = nullptr;
+	mapping_ = nullptr;
+	file_ = nullptr;
+	size_ = 0;
+	open_ = false;
+	return flushed;
+}
+
+#else
+
+bool MappedFile::Open(const std::filesystem::path& path) {
+	Close();
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st {};
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		::close(fd);
+		open_ = true;
+		return true;
+	}
+
+	void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	data_ = static_cast<const char*>(data);
+	size_ = static_cast<std::size_t>(st.st_size);
+	open_ = true;
+	return true;
+}
+
+void MappedFile::Close() noexcept {
+	if (data_ != nullptr)
+		::munmap(const_cast<char*>(data_), size_);
+	data_ = nullptr;
+	size_ = 0;
+	open_ = false;
+}
+
+bool MappedOutputFile::Create(const std::filesystem::path& path, std::uint64_t size) {
+	Close();
+	const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+#  if defined(__linux__)
+	// Reserve the blocks now: a full disk fails here instead of as SIGBUS on a mapped write.
+	const int error = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+	if (error != 0 && error != EOPNOTSUPP && error != EINVAL) {
+		::close(fd);
+		return false;
+	}
+#  endif
+	if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+		::close(fd);
+		return false;
+	}
+	if (size == 0) {
+		::close(fd);
+		open_ = true;
+		return true;
+	}
+
+	void* data = ::mmap(nullptr, static_cast<std::size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	data_ = static_cast<char*>(data);
+	size_ = static_cast<std::size_t>(size);
+	open_ = true;
+	return true;
+}
+
+bool MappedOutputFile::Close() noexcept {
+	bool flushed = true;
+	if (data_ != nullptr) {
+		// MS_SYNC waits for the write, so a failure (e.g. EIO) is reported here.
+		flushed = ::msync(data_, size_, MS_SYNC) == 0;
+		::munmap(data_, size_);
+	}
+	data_ = nullptr;
+	size_ = 0;
+	open_ = false;
+	return flushed;
+}
+
+#endif
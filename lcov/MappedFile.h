@@ -0,0 +1,62 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+// Read-only memory mapping of a whole file.
+class LCOV_API MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps the file, replacing any previous mapping. An empty file maps to an empty view.
+	bool Open(const std::filesystem::path& path);
+	void Close() noexcept;
+
+	[[nodiscard]] bool IsOpen() const noexcept { return open_; }
+	[[nodiscard]] std::string_view View() const noexcept { return {data_, size_}; }
+
+private:
+	const char* data_ = nullptr;
+	std::size_t size_ = 0;
+	bool open_ = false;
+#if defined(_WIN32)
+	void* mapping_ = nullptr;
+#endif
+};
+
+// Writable memory mapping of a new file whose final size is known up front. The file is allocated when it is created,
+// so writes through the mapping never extend it.
+class LCOV_API MappedOutputFile {
+public:
+	MappedOutputFile() = default;
+	~MappedOutputFile();
+	MappedOutputFile(const MappedOutputFile&) = delete;
+	MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+	// Creates (truncates) the file at exactly size bytes and maps it. Returns false if the file cannot be allocated
+	// or mapped, e.g. on a filesystem without mapping support.
+	bool Create(const std::filesystem::path& path, std::uint64_t size);
+	// Writes the mapped pages to disk and waits for them, then unmaps. Returns false if they could not be written.
+	bool Close() noexcept;
+
+	[[nodiscard]] bool IsOpen() const noexcept { return open_; }
+	[[nodiscard]] char* Data() noexcept { return data_; }
+	[[nodiscard]] std::size_t Size() const noexcept { return size_; }
+
+private:
+	char* data_ = nullptr;
+	std::size_t size_ = 0;
+	bool open_ = false;
+#if defined(_WIN32)
+	void* mapping_ = nullptr;
+	// Kept open for FlushFileBuffers on Close
+	void* file_ = nullptr;
+#endif
+};
@@ -0,0 +1,149 @@
+#include "pch.h"
+#include "ParallelRenderer.h"
+
+#include "RenderedChunk.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ParallelRenderer::Slot {
+	RenderedChunk chunk;
+	std::exception_ptr error;
+	bool ready = false;
+};
+
+ParallelRenderer::ParallelRenderer(unsigned threads) : threads_(std::max(threads, 1u)) {}
+
+ParallelRenderer::~ParallelRenderer() {
+	{
+		std::lock_guard lock{mutex_};
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	for (auto& thread : workers_)
+		thread.join();
+}
+
+void ParallelRenderer::Work() {
+	std::unique_lock lock{mutex_};
+	while (true) {
+		cv_.wait(lock, [&] { return stopping_ || (render_ && !abort_ && next_ < chunkCount_ && next_ < consumed_ + window_); });
+		if (stopping_)
+			return;
+		const auto index = next_++;
+		++busy_;
+		auto& slot = *slots_[index % window_];
+		const auto begin = index * chunkSize_;
+		const auto end = std::min(begin + chunkSize_, itemCount_);
+		const auto& render = *render_;
+		lock.unlock();
+
+		try {
+			render(begin, end, slot.chunk);
+		} catch (...) {
+			slot.error = std::current_exception();
+		}
+
+		lock.lock();
+		slot.ready = true;
+		--busy_;
+		cv_.notify_all();
+	}
+}
+
+void ParallelRenderer::Run(std::size_t itemCount, const RenderFn& render, const SinkFn& sink) {
+	if (itemCount == 0)
+		return;
+	if (slots_.empty())
+		slots_.push_back(std::make_unique<Slot>());
+
+	if (threads_ <= 1) {
+		// One chunk object reused for everything; its buffers keep their capacity between chunks and runs. It is cleared
+		// before each chunk, so nothing is left over from a run that threw.
+		constexpr std::size_t serialChunk = 256;
+		auto& chunk = slots_.front()->chunk;
+		for (std::size_t begin = 0; begin < itemCount; begin += serialChunk) {
+			chunk.Clear();
+			render(begin, std::min(begin + serialChunk, itemCount), chunk);
+			sink(chunk);
+		}
+		return;
+	}
+
+	// Enough chunks per thread to balance uneven file sizes, without making chunks tiny.
+	const std::size_t chunkSize = std::clamp<std::size_t>(itemCount / (std::size_t{threads_} * 16), 1, 1024);
+	const std::size_t chunkCount = (itemCount + chunkSize - 1) / chunkSize;
+	// At most window chunks are in flight: chunk i is only started once chunk i - window has been sunk and its slot
+	// cleared.
+	const std::size_t window = std::min(std::size_t{threads_} * 4, chunkCount);
+
+	{
+		std::lock_guard lock{mutex_};
+		while (slots_.size() < window)
+			slots_.push_back(std::make_unique<Slot>());
+		render_ = &render;
+		itemCount_ = itemCount;
+		chunkSize_ = chunkSize;
+		chunkCount_ = chunkCount;
+		window_ = window;
+		next_ = 0;
+		consumed_ = 0;
+		abort_ = false;
+	}
+	if (workers_.empty()) {
+		workers_.reserve(threads_);
+		for (unsigned i = 0; i < threads_; ++i)
+			workers_.emplace_back([this] { Work(); });
+	}
+	cv_.notify_all();
+
+	std::exception_ptr error;
+	for (std::size_t index = 0; index < chunkCount && !error; ++index) {
+		auto& slot = *slots_[index % window];
+		{
+			std::unique_lock lock{mutex_};
+			cv_.wait(lock, [&] { return slot.ready; });
+		}
+
+		if (slot.error) {
+			error = slot.error;
+		} else {
+			try {
+				sink(slot.chunk);
+			} catch (...) {
+				error = std::current_exception();
+			}
+		}
+		// The slot is reused for chunk index + window, with the buffers it grew.
+		slot.chunk.Clear();
+		slot.error = nullptr;
+
+		{
+			std::lock_guard lock{mutex_};
+			slot.ready = false;
+			++consumed_;
+			abort_ = error != nullptr;
+		}
+		cv_.notify_all();
+	}
+
+	// The run ends once no worker is still rendering for it; after an error, chunks rendered past it are dropped.
+	{
+		std::unique_lock lock{mutex_};
+		abort_ = true;
+		cv_.wait(lock, [&] { return busy_ == 0; });
+		render_ = nullptr;
+	}
+	if (error) {
+		for (auto& slot : slots_) {
+			slot->chunk.Clear();
+			slot->error = nullptr;
+			slot->ready = false;
+		}
+		std::rethrow_exception(error);
+	}
+}
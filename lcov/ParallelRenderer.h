@@ -0,0 +1,65 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Defined in RenderedChunk.h, with the payload of every export feature
+struct RenderedChunk;
+
+/**
+ * Renders independent items on worker threads and hands the results back in the original order.
+ *
+ * Items are split into contiguous chunks. Workers render chunks into private buffers, and the calling thread passes
+ * each finished chunk to the sink strictly in chunk order, so output is identical to a serial run. The number of
+ * chunks in flight is bounded, which keeps memory flat when the sink (usually disk) is slower than rendering. Chunk
+ * objects are reused once sunk (RenderedChunk::Clear), so their buffers keep their capacity. Workers and chunks are
+ * kept from one Run to the next: the threads are started by the first Run that needs them and stopped on destruction.
+ */
+class LCOV_API ParallelRenderer {
+public:
+	using RenderFn = std::function<void(std::size_t begin, std::size_t end, RenderedChunk& chunk)>;
+	using SinkFn = std::function<void(RenderedChunk& chunk)>;
+
+	// threads: number of worker threads; 0 or 1 renders on the calling thread.
+	explicit ParallelRenderer(unsigned threads);
+	~ParallelRenderer();
+
+	ParallelRenderer(const ParallelRenderer&) = delete;
+	ParallelRenderer& operator=(const ParallelRenderer&) = delete;
+
+	// One Run at a time; the render and sink functions may not Run the same renderer.
+	void Run(std::size_t itemCount, const RenderFn& render, const SinkFn& sink);
+
+	[[nodiscard]] unsigned Threads() const noexcept { return threads_; }
+
+private:
+	struct Slot;
+
+	void Work();
+
+	unsigned threads_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	// Chunk i of a run is rendered into slot i % window_; slots outlive runs with the buffers they grew.
+	std::vector<std::unique_ptr<Slot>> slots_;
+	// The run in progress; render_ is null between runs.
+	const RenderFn* render_ = nullptr;
+	std::size_t itemCount_ = 0;
+	std::size_t chunkSize_ = 0;
+	std::size_t chunkCount_ = 0;
+	std::size_t window_ = 0;
+	std::size_t next_ = 0;
+	std::size_t consumed_ = 0;
+	std::size_t busy_ = 0; // chunks being rendered
+	bool abort_ = false;
+	bool stopping_ = false;
+	std::vector<std::thread> workers_;
+};
@@ -0,0 +1,390 @@
+#include "pch.h"
+#include "PatchCoverage.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+
+namespace {
+	constexpr auto Ambiguous = static_cast<std::size_t>(-1);
+
+	// Next line of text without its line ending.
+	std::string_view NextLine(std::string_view& text) {
+		const auto end = text.find('\n');
+		auto line = text.substr(0, end);
+		text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+		return line;
+	}
+
+	std::uint32_t ParseNumber(std::string_view& text) {
+		std::uint32_t value = 0;
+		const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+		text.remove_prefix(end - text.data());
+		return ec == std::errc{} ? value : 0;
+	}
+
+	// Path of a "+++ " (or "--- ") header: "b/src/a.cpp\t<timestamp>" -> "src/a.cpp". Empty for "/dev/null", the side
+	// of a deleted (or added) file. sidePrefix is git's "b/" (or "a/").
+	std::string HeaderPath(std::string_view header, std::string_view sidePrefix) {
+		std::string path;
+		if (!header.empty() && header.front() == '"') {
+			// Quoted by git when the path has special characters; only \" and \\ are unescaped.
+			for (std::size_t i = 1; i < header.size() && header[i] != '"'; ++i) {
+				if (header[i] == '\\' && i + 1 < header.size())
+					++i;
+				path.push_back(header[i]);
+			}
+		} else {
+			path = header.substr(0, header.find('\t'));
+		}
+		if (path == "/dev/null")
+			return {};
+		std::ranges::replace(path, '\\', '/');
+		if (path.starts_with(sidePrefix))
+			path.erase(0, sidePrefix.size());
+		while (path.starts_with("./"))
+			path.erase(0, 2);
+		return path;
+	}
+
+	// Paths compare case-insensitively on Windows, like the include/exclude rules.
+	std::string MatchKey(std::string_view path) {
+		std::string key{path};
+#if defined(_WIN32)
+		for (auto& c : key) {
+			if (c >= 'A' && c <= 'Z')
+				c = static_cast<char>(c - 'A' + 'a');
+		}
+#endif
+		return key;
+	}
+
+	void Normalize(std::vector<LineInterval>& intervals) {
+		std::ranges::sort(intervals, {}, &LineInterval::first);
+		std::vector<LineInterval> merged;
+		for (const auto& interval : intervals) {
+			if (!merged.empty() && interval.first <= std::uint64_t{merged.back().last} + 1)
+				merged.back().last = std::max(merged.back().last, interval.last);
+			else
+				merged.push_back(interval);
+		}
+		intervals = std::move(merged);
+	}
+}
+
+bool PatchCoverage::LoadDiff(const std::filesystem::path& diffPath, DiffSide side) {
+	std::ifstream ifs(diffPath, std::ios::binary);
+	if (!ifs)
+		return false;
+	std::stringstream buffer;
+	buffer << ifs.rdbuf();
+	ParseDiff(buffer.str(), side);
+	return true;
+}
+
+void PatchCoverage::ParseDiff(std::string_view diff, DiffSide side) {
+	const bool oldSide = side == DiffSide::Old;
+	std::vector<LineInterval>* current = nullptr;
+	auto mark = [&](std::uint32_t line) {
+		if (!current || line == 0)
+			return;
+		if (!current->empty() && current->back().last + 1 == line)
+			current->back().last = line;
+		else if (current->empty() || current->back().last < line)
+			current->push_back({line, line});
+	};
+	std::uint32_t oldLine = 0;
+	std::uint32_t newLine = 0;
+	std::uint32_t oldLeft = 0;
+	std::uint32_t newLeft = 0;
+	char previous = ' ';
+	auto changedFile = [&](const std::string& path) {
+		const auto [it, added] = fullPaths_.try_emplace(MatchKey(path), files_.size());
+		if (added)
+			files_.emplace_back(path, std::vector<LineInterval>{});
+		return &files_[it->second].second;
+	};
+	// On the old side, a file the diff adds has no lines; it is still listed, under its new path.
+	bool addedFile = false;
+	while (!diff.empty()) {
+		const auto line = NextLine(diff);
+		if (oldLeft > 0 || newLeft > 0) {
+			// Inside a hunk: count lines on both sides until the hunk header's counts are used up.
+			const char tag = line.empty() ? ' ' : line.front();
+			if (tag == '+' && newLeft > 0) {
+				if (!oldSide) {
+					mark(newLine);
+				} else if (previous == ' ') {
+					// On the old side, a pure insertion changes the lines on either side of it.
+					mark(oldLine - 1);
+					mark(oldLine);
+				}
+				previous = tag;
+				++newLine;
+				--newLeft;
+				continue;
+			}
+			if (tag == '-' && oldLeft > 0) {
+				if (oldSide)
+					mark(oldLine);
+				previous = tag;
+				++oldLine;
+				--oldLeft;
+				continue;
+			}
+			if (tag == ' ' && oldLeft > 0 && newLeft > 0) {
+				previous = tag;
+				++oldLine;
+				++newLine;
+				--oldLeft;
+				--newLeft;
+				continue;
+			}
+			if (tag == '\\')
+				continue;
+			// Truncated hunk; look for the next header.
+			oldLeft = newLeft = 0;
+		}
+
+		if (line.starts_with(oldSide ? "--- " : "+++ ")) {
+			const auto path = HeaderPath(line.substr(4), oldSide ? "a/" : "b/");
+			current = nullptr;
+			addedFile = oldSide && path.empty();
+			if (!path.empty())
+				current = changedFile(path);
+		} else if (addedFile && line.starts_with("+++ ")) {
+			addedFile = false;
+			if (const auto path = HeaderPath(line.substr(4), "b/"); !path.empty())
+				changedFile(path);
+		} else if (line.starts_with("@@ -")) {
+			// "@@ -<old>[,<count>] +<new>[,<count>] @@"; a missing count means 1.
+			auto rest = line.substr(4);
+			oldLine = ParseNumber(rest);
+			oldLeft = 1;
+			if (rest.starts_with(',')) {
+				rest.remove_prefix(1);
+				oldLeft = ParseNumber(rest);
+			}
+			if (!rest.starts_with(" +")) {
+				oldLeft = 0;
+				continue;
+			}
+			// An empty old side is numbered by the line before it.
+			if (oldLeft == 0)
+				++oldLine;
+			rest.remove_prefix(2);
+			previous = ' ';
+			newLine = ParseNumber(rest);
+			newLeft = 1;
+			if (rest.starts_with(',')) {
+				rest.remove_prefix(1);
+				newLeft = ParseNumber(rest);
+			}
+		}
+	}
+
+	IndexPaths();
+}
+
+void PatchCoverage::AddChange(std::string_view path, LineInterval lines) {
+	std::string normalized{path};
+	std::ranges::replace(normalized, '\\', '/');
+	while (normalized.starts_with("./"))
+		normalized.erase(0, 2);
+	const auto [it, added] = fullPaths_.try_emplace(MatchKey(normalized), files_.size());
+	if (added)
+		files_.emplace_back(normalized, std::vector<LineInterval>{});
+	files_[it->second].second.push_back(lines);
+	IndexPaths();
+}
+
+// Sorts and merges each file's intervals and rebuilds the suffix table.
+void PatchCoverage::IndexPaths() {
+	matchedExactly_.resize(files_.size(), false);
+	suffixes_.clear();
+	for (std::size_t i = 0; i < files_.size(); ++i) {
+		Normalize(files_[i].second);
+		const auto key = MatchKey(files_[i].first);
+		for (auto slash = key.find('/'); slash != std::string::npos; slash = key.find('/', slash + 1)) {
+			const auto [it, added] = suffixes_.try_emplace(key.substr(slash + 1), i);
+			if (!added && it->second != i)
+				it->second = Ambiguous;
+		}
+	}
+}
+
+void PatchCoverage::MapPaths(const ExporterConfig& cfg, const std::filesystem::path& diffRoot) {
+	sfPaths_.clear();
+	RecordBuffer sfPath;
+	for (std::size_t i = 0; i < files_.size(); ++i) {
+		const auto& diffPath = files_[i].first;
+		const std::filesystem::path path{std::u8string(reinterpret_cast<const char8_t*>(diffPath.data()), diffPath.size())};
+		sfPath.Clear();
+		sfPath.AppendPathUtf8(cfg.MakeSFPath((diffRoot / path).lexically_normal()));
+		sfPaths_.try_emplace(MatchKey(sfPath.View()), i);
+	}
+}
+
+PatchCoverage::FileMatch PatchCoverage::Match(std::string_view sfPathUtf8) const {
+	if (files_.empty())
+		return {};
+	const auto key = MatchKey(sfPathUtf8);
+	if (const auto it = sfPaths_.find(key); it != sfPaths_.end())
+		return {it->second, true};
+	if (const auto it = fullPaths_.find(key); it != fullPaths_.end())
+		return {it->second, true};
+	// The SF path ends with the diff path (longest first)...
+	for (auto slash = key.find('/'); slash != std::string::npos; slash = key.find('/', slash + 1)) {
+		if (const auto it = fullPaths_.find(key.substr(slash + 1)); it != fullPaths_.end())
+			return {it->second, false};
+	}
+	// ...or the diff path ends with the SF path.
+	if (const auto it = suffixes_.find(key); it != suffixes_.end() && it->second != Ambiguous)
+		return {it->second, false};
+	return {};
+}
+
+bool PatchCoverage::Measure(std::string_view sfPathUtf8, const std::vector<Plugin::LineCoverage>& lines,
+                            RecordBuffer& lcov, RecordBuffer& json) const {
+	const auto match = Match(sfPathUtf8);
+	if (match.file == NoFile)
+		return false;
+	if (match.exact) {
+		// Even when no changed line is instrumented, so the file's suffix matches are not counted in its place.
+		std::lock_guard lock{heldMutex_};
+		matchedExactly_[match.file] = true;
+	}
+	const auto& changed = files_[match.file].second;
+
+	std::vector<LineHits> changedLines;
+	std::vector<std::uint32_t> uncovered;
+	for (const auto& line : lines) {
+		const auto number = static_cast<std::uint32_t>(line.GetLineNumber());
+		const auto next = std::ranges::upper_bound(changed, number, {}, &LineInterval::first);
+		if (next == changed.begin() || std::prev(next)->last < number)
+			continue;
+		changedLines.push_back({number, line.HasBeenExecuted() ? 1u : 0u});
+		if (!line.HasBeenExecuted())
+			uncovered.push_back(number);
+	}
+	// Changes that touch no instrumented line (comments, declarations) do not count.
+	if (changedLines.empty())
+		return false;
+
+	RecordBuffer heldLcov;
+	RecordBuffer heldJson;
+	auto& lcovOut = match.exact ? lcov : heldLcov;
+	auto& jsonOut = match.exact ? json : heldJson;
+	RenderFileRecord(lcovOut, sfPathUtf8, changedLines);
+	jsonOut.Append("    {\"path\": ");
+	jsonOut.AppendJsonString(sfPathUtf8);
+	jsonOut.Append(", \"found\": ");
+	jsonOut.AppendUInt(changedLines.size());
+	jsonOut.Append(", \"hit\": ");
+	jsonOut.AppendUInt(changedLines.size() - uncovered.size());
+	jsonOut.Append(", \"uncovered\": [");
+	for (std::size_t i = 0; i < uncovered.size(); ++i) {
+		if (i != 0)
+			jsonOut.Append(", ");
+		jsonOut.AppendUInt(uncovered[i]);
+	}
+	jsonOut.Append("]},\n");
+
+	if (match.exact) {
+		Count(changedLines.size(), changedLines.size() - uncovered.size());
+		return true;
+	}
+	std::lock_guard lock{heldMutex_};
+	held_.push_back({match.file, std::string(sfPathUtf8), std::string(heldLcov.View()), std::string(heldJson.View()),
+	                 changedLines.size(), changedLines.size() - uncovered.size()});
+	return false;
+}
+
+void PatchCoverage::ResolveSuffixMatches(RecordBuffer& lcov, RecordBuffer& json, ExporterConfigLog& log) {
+	std::lock_guard lock{heldMutex_};
+	// Held matches of each file, in the order they were measured
+	std::map<std::size_t, std::vector<const HeldMatch*>> byFile;
+	for (const auto& held : held_) {
+		if (!matchedExactly_[held.file])
+			byFile[held.file].push_back(&held);
+	}
+	for (const auto& [file, matches] : byFile) {
+		std::vector<std::string_view> candidates;
+		for (const auto* held : matches) {
+			if (std::ranges::find(candidates, held->sfPath) == candidates.end())
+				candidates.push_back(held->sfPath);
+		}
+		if (candidates.size() == 1) {
+			for (const auto* held : matches) {
+				lcov.Append(held->lcov);
+				json.Append(held->json);
+				Count(held->found, held->hit);
+			}
+			continue;
+		}
+		std::string message = "Patch coverage: " + files_[file].first + " in the diff matches " + std::to_string(candidates.size()) +
+		                      " report files, its changed lines are not counted:";
+		for (const auto candidate : candidates)
+			message.append(" ").append(candidate);
+		log.AddMsg(ExporterConfigLog::MsgLevel::Error, message);
+	}
+	held_.clear();
+}
+
+void PatchCoverage::Count(std::uint64_t found, std::uint64_t hit) const {
+	found_ += found;
+	hit_ += hit;
+	++touched_;
+}
+
+bool PatchCoverage::WriteJson(const std::filesystem::path& jsonPath, const std::filesystem::path& diffPath,
+                              std::string_view fileObjects) const {
+	RecordBuffer diff;
+	diff.AppendUtf8(diffPath.generic_wstring());
+
+	RecordBuffer json;
+	json.Append("{\n  \"version\": 1,\n  \"diff\": ");
+	json.AppendJsonString(diff.View());
+	json.Append(",\n  \"linesFound\": ");
+	json.AppendUInt(found_);
+	json.Append(",\n  \"linesHit\": ");
+	json.AppendUInt(hit_);
+	json.Append(",\n  \"percent\": ");
+	if (found_ == 0) {
+		json.Append("null");
+	} else {
+		char percent[32];
+		std::snprintf(percent, sizeof(percent), "%.2f", 100.0 * static_cast<double>(hit_) / static_cast<double>(found_));
+		json.Append(percent);
+	}
+	json.Append(",\n  \"files\": [\n");
+	// Every object ends with ",\n"; the last one closes the array instead.
+	if (fileObjects.ends_with(",\n")) {
+		fileObjects.remove_suffix(2);
+		json.Append(fileObjects);
+		json.Append('\n');
+	}
+	json.Append("  ]\n}\n");
+
+	std::ofstream ofs(jsonPath, std::ios::binary | std::ios::trunc);
+	ofs.write(json.Data(), static_cast<std::streamsize>(json.Size()));
+	return static_cast<bool>(ofs);
+}
+
+std::filesystem::path PatchCoverage::LcovPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".patch.info";
+	return path;
+}
+
+std::filesystem::path PatchCoverage::JsonPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".patch.json";
+	return path;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+#include "RecordWriter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+// Inclusive range of line numbers.
+struct LineInterval {
+	std::uint32_t first = 0;
+	std::uint32_t last = 0;
+};
+
+// Which version of the files a diff's line numbers are taken from.
+enum class DiffSide {
+	// Lines the diff adds or modifies, numbered in the changed files
+	New,
+	// Lines the diff removes or modifies, and the lines around insertions, numbered in the original files
+	Old
+};
+
+/**
+ * Coverage of the lines changed by a unified diff ("patch coverage"), measured while the report is rendered.
+ *
+ * The diff is reduced to sorted, disjoint intervals of added/modified lines per file (new side of each hunk, unless
+ * DiffSide::Old asks for the original files' lines). Files are matched by their SF path. A diff path matches exactly
+ * when MapPaths turned it into that SF path (ExporterConfig::MakeSFPath) or when it is the SF path itself. Otherwise it
+ * may match on whole path components where one path ends with the other (so "src/a.cpp" in a diff rooted elsewhere
+ * still matches), but only when a single SF path does: such matches are held until ResolveSuffixMatches, which reports
+ * a diff path that several files end with instead of picking one. Measure may be called from several threads once the
+ * diff is loaded.
+ */
+class LCOV_API PatchCoverage {
+public:
+	// Reads and parses a unified diff (git diff, diff -u). Returns false if it cannot be read.
+	bool LoadDiff(const std::filesystem::path& diffPath, DiffSide side = DiffSide::New);
+	void ParseDiff(std::string_view diff, DiffSide side = DiffSide::New);
+	// Adds changed lines of a path, as if a diff had changed them ('\' is read as '/').
+	void AddChange(std::string_view path, LineInterval lines);
+	// Maps the diff paths, relative to diffRoot, to the SF paths cfg writes for them, so they match those exactly.
+	void MapPaths(const ExporterConfig& cfg, const std::filesystem::path& diffRoot);
+
+	[[nodiscard]] std::size_t ChangedFileCount() const noexcept { return files_.size(); }
+	// Paths as written in the diff, each with its changed-line intervals
+	[[nodiscard]] const std::vector<std::pair<std::string, std::vector<LineInterval>>>& ChangedFiles() const noexcept { return files_; }
+	// Index into ChangedFiles() of the file an SF path (UTF-8) matches, and whether it matches exactly.
+	struct FileMatch {
+		std::size_t file = NoFile;
+		bool exact = false;
+	};
+	static constexpr std::size_t NoFile = static_cast<std::size_t>(-1);
+	[[nodiscard]] FileMatch Match(std::string_view sfPathUtf8) const;
+
+	/**
+	 * Measures one report file. When the diff touches it exactly, appends an LCOV record with only its changed,
+	 * instrumented lines to `lcov` and a JSON object followed by ",\n" to `json`, and returns true. A suffix match is
+	 * held for ResolveSuffixMatches instead.
+	 */
+	bool Measure(std::string_view sfPathUtf8, const std::vector<Plugin::LineCoverage>& lines, RecordBuffer& lcov,
+	             RecordBuffer& json) const;
+	/**
+	 * Once every file is measured: appends the held suffix matches of diff paths that no SF path matched exactly and
+	 * exactly one SF path ends with (or is the end of). A diff path several SF paths match is not counted; it is logged
+	 * as an error with its candidates.
+	 */
+	void ResolveSuffixMatches(RecordBuffer& lcov, RecordBuffer& json, ExporterConfigLog& log);
+
+	[[nodiscard]] std::uint64_t LinesFound() const noexcept { return found_; }
+	[[nodiscard]] std::uint64_t LinesHit() const noexcept { return hit_; }
+	[[nodiscard]] std::uint64_t FilesTouched() const noexcept { return touched_; }
+
+	// Writes the JSON report around the file objects collected from Measure.
+	bool WriteJson(const std::filesystem::path& jsonPath, const std::filesystem::path& diffPath,
+	               std::string_view fileObjects) const;
+
+	// Reports written next to the LCOV output: "<output>.patch.info" and "<output>.patch.json"
+	static std::filesystem::path LcovPath(const std::filesystem::path& outputPath);
+	static std::filesystem::path JsonPath(const std::filesystem::path& outputPath);
+
+private:
+	// Record of a suffix match, held until ResolveSuffixMatches
+	struct HeldMatch {
+		std::size_t file;
+		std::string sfPath;
+		std::string lcov;
+		std::string json;
+		std::uint64_t found;
+		std::uint64_t hit;
+	};
+
+	void IndexPaths();
+	void Count(std::uint64_t found, std::uint64_t hit) const;
+
+	// Path as written in the diff, and its changed lines
+	std::vector<std::pair<std::string, std::vector<LineInterval>>> files_;
+	// Match keys (case-folded on Windows) -> index into files_
+	std::unordered_map<std::string, std::size_t> fullPaths_;
+	// Match keys of the SF paths MapPaths gave the diff paths -> index into files_
+	std::unordered_map<std::string, std::size_t> sfPaths_;
+	// Proper component suffixes of the diff paths -> index into files_, or npos when several paths share one
+	std::unordered_map<std::string, std::size_t> suffixes_;
+
+	mutable std::atomic<std::uint64_t> found_{0};
+	mutable std::atomic<std::uint64_t> hit_{0};
+	mutable std::atomic<std::uint64_t> touched_{0};
+
+	mutable std::mutex heldMutex_;
+	// Per file: whether an SF path matched it exactly
+	mutable std::vector<bool> matchedExactly_;
+	mutable std::vector<HeldMatch> held_;
+};
@@ -0,0 +1,336 @@
+#include "pch.h"
+#include "PathFilter.h"
+
+#include "RecordWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+
+namespace {
+	using CharSet = std::bitset<256>;
+
+	std::string ToMatchable(const std::filesystem::path& path) {
+		std::string text;
+		EncodePathUtf8(text, path.native());
+		PathFilter::FoldCase(text.data(), text.size());
+		return text;
+	}
+
+	bool IsAbsolutePattern(std::string_view pattern) {
+		return pattern.starts_with('/') || (pattern.size() >= 2 && pattern[1] == ':');
+	}
+
+	// Index of the ']' closing a character class opened at `open`, or npos when the '[' is a literal.
+	std::size_t ClassEnd(std::string_view glob, std::size_t open) {
+		auto first = open + 1;
+		if (first < glob.size() && (glob[first] == '!' || glob[first] == '^'))
+			++first;
+		return glob.find(']', first + 1);
+	}
+
+	// Calls onComponent for each '/' separated component; empty components (e.g. a trailing '/') are skipped.
+	template <typename Fn>
+	bool ForEachComponent(std::string_view path, Fn&& onComponent) {
+		bool first = true;
+		while (true) {
+			const auto slash = path.find('/');
+			const auto component = path.substr(0, slash);
+			// A leading empty component stands for the root of a POSIX absolute path.
+			if ((!component.empty() || first) && !onComponent(component))
+				return false;
+			first = false;
+			if (slash == std::string_view::npos)
+				return true;
+			path.remove_prefix(slash + 1);
+		}
+	}
+}
+
+class PathFilter::Matcher {
+public:
+	Matcher(const std::vector<std::string>& patterns, const std::string& anchor);
+
+	[[nodiscard]] bool Empty() const noexcept { return !hasPrefixes_ && globStarts_.empty(); }
+	[[nodiscard]] bool Matches(std::string_view path) const;
+
+private:
+	struct TrieNode {
+		bool terminal = false;
+		std::map<std::string, std::unique_ptr<TrieNode>, std::less<>> children;
+	};
+
+	struct NfaNode {
+		std::vector<std::pair<CharSet, int>> edges;
+		std::vector<int> epsilon;
+		bool accept = false;
+	};
+
+	struct DfaState {
+		std::vector<int> nodes; // sorted epsilon-closed set of NFA nodes; empty = dead
+		std::array<std::int32_t, 256> next;
+		bool accept = false;
+	};
+
+	// Lazily built DFA states are dropped and rebuilt once there are this many.
+	static constexpr std::size_t MaxDfaStates = 4096;
+
+	void AddPrefix(std::string_view prefix);
+	void AddGlob(std::string_view glob);
+	int AddNode();
+
+	[[nodiscard]] bool MatchesPrefix(std::string_view path) const;
+	[[nodiscard]] bool MatchesGlob(std::string_view path) const;
+	// Runs the DFA over the path. Returns nullopt when a missing state is needed and build is false.
+	std::optional<bool> Walk(std::string_view path, bool build) const;
+	std::int32_t StateFor(std::vector<int> nodes) const;
+	void Close(std::vector<int>& nodes) const;
+	void ResetDfa() const;
+
+	TrieNode trie_;
+	bool hasPrefixes_ = false;
+	std::vector<NfaNode> nfa_;
+	std::vector<int> globStarts_;
+
+	mutable std::shared_mutex dfaMutex_;
+	mutable std::vector<DfaState> states_;
+	mutable std::map<std::vector<int>, std::int32_t> stateIds_;
+};
+
+PathFilter::Matcher::Matcher(const std::vector<std::string>& patterns, const std::string& anchor) {
+	for (const auto& raw : patterns) {
+		std::string pattern = raw;
+		std::ranges::replace(pattern, '\\', '/');
+		FoldCase(pattern.data(), pattern.size());
+		if (pattern.starts_with("./"))
+			pattern.erase(0, 2);
+		if (pattern.empty())
+			continue;
+		if (!pattern.starts_with("**") && !IsAbsolutePattern(pattern))
+			pattern = anchor + (anchor.ends_with('/') ? "" : "/") + pattern;
+
+		if (pattern.find_first_of("*?[") == std::string::npos)
+			AddPrefix(pattern);
+		else
+			AddGlob(pattern);
+	}
+	if (!globStarts_.empty())
+		ResetDfa();
+}
+
+void PathFilter::Matcher::AddPrefix(std::string_view prefix) {
+	auto* node = &trie_;
+	ForEachComponent(prefix, [&](std::string_view component) {
+		auto it = node->children.find(component);
+		if (it == node->children.end())
+			it = node->children.emplace(std::string(component), std::make_unique<TrieNode>()).first;
+		node = it->second.get();
+		return true;
+	});
+	node->terminal = true;
+	hasPrefixes_ = true;
+}
+
+int PathFilter::Matcher::AddNode() {
+	nfa_.emplace_back();
+	return static_cast<int>(nfa_.size() - 1);
+}
+
+void PathFilter::Matcher::AddGlob(std::string_view glob) {
+	CharSet any;
+	any.set();
+	CharSet notSlash = any;
+	notSlash.reset('/');
+	CharSet slash;
+	slash.set('/');
+
+	int cur = AddNode();
+	globStarts_.push_back(cur);
+	auto step = [&](const CharSet& set) {
+		const int next = AddNode();
+		nfa_[cur].edges.emplace_back(set, next);
+		cur = next;
+	};
+
+	for (std::size_t i = 0; i < glob.size();) {
+		const char c = glob[i];
+		if (c == '*' && glob.substr(i).starts_with("**/")) {
+			// "**/": zero or more whole directories.
+			i += 3;
+			const int inner = AddNode();
+			const int next = AddNode();
+			nfa_[cur].epsilon.push_back(next);
+			nfa_[cur].edges.emplace_back(any, inner);
+			nfa_[inner].edges.emplace_back(any, inner);
+			nfa_[inner].edges.emplace_back(slash, next);
+			cur = next;
+		} else if (c == '*') {
+			// "**" crosses directories, "*" stays within one.
+			const bool crossDirs = glob.substr(i).starts_with("**");
+			i += crossDirs ? 2 : 1;
+			const int next = AddNode();
+			nfa_[cur].edges.emplace_back(crossDirs ? any : notSlash, cur);
+			nfa_[cur].epsilon.push_back(next);
+			cur = next;
+		} else if (c == '?') {
+			++i;
+			step(notSlash);
+		} else if (const auto close = c == '[' ? ClassEnd(glob, i) : std::string_view::npos; close != std::string_view::npos) {
+			// Character class: [abc], [a-z], [!abc] or [^abc]; a ']' right after the bracket is literal.
+			std::size_t j = i + 1;
+			const bool negate = glob[j] == '!' || glob[j] == '^';
+			if (negate)
+				++j;
+			CharSet set;
+			for (; j < close; ++j) {
+				const auto lo = static_cast<unsigned char>(glob[j]);
+				if (j + 2 < close && glob[j + 1] == '-') {
+					const auto hi = static_cast<unsigned char>(glob[j + 2]);
+					for (unsigned v = lo; v <= hi; ++v)
+						set.set(v);
+					j += 2;
+				} else {
+					set.set(lo);
+				}
+			}
+			if (negate)
+				set.flip();
+			set.reset('/');
+			i = close + 1;
+			step(set);
+		} else {
+			++i;
+			CharSet literal;
+			literal.set(static_cast<unsigned char>(c));
+			step(literal);
+		}
+	}
+	nfa_[cur].accept = true;
+}
+
+bool PathFilter::Matcher::Matches(std::string_view path) const {
+	return (hasPrefixes_ && MatchesPrefix(path)) || (!globStarts_.empty() && MatchesGlob(path));
+}
+
+bool PathFilter::Matcher::MatchesPrefix(std::string_view path) const {
+	const auto* node = &trie_;
+	bool matched = false;
+	ForEachComponent(path, [&](std::string_view component) {
+		const auto it = node->children.find(component);
+		if (it == node->children.end())
+			return false;
+		node = it->second.get();
+		matched = node->terminal;
+		return !matched;
+	});
+	return matched;
+}
+
+bool PathFilter::Matcher::MatchesGlob(std::string_view path) const {
+	{
+		std::shared_lock lock{dfaMutex_};
+		if (const auto matched = Walk(path, false))
+			return *matched;
+	}
+	std::unique_lock lock{dfaMutex_};
+	if (states_.size() >= MaxDfaStates)
+		ResetDfa();
+	return *Walk(path, true);
+}
+
+std::optional<bool> PathFilter::Matcher::Walk(std::string_view path, bool build) const {
+	std::int32_t state = 0;
+	for (const char c : path) {
+		if (states_[state].nodes.empty())
+			return false;
+		const auto byte = static_cast<unsigned char>(c);
+		auto next = states_[state].next[byte];
+		if (next < 0) {
+			if (!build)
+				return std::nullopt;
+			std::vector<int> nodes;
+			for (const int node : states_[state].nodes) {
+				for (const auto& [set, target] : nfa_[node].edges) {
+					if (set.test(byte))
+						nodes.push_back(target);
+				}
+			}
+			next = StateFor(std::move(nodes));
+			states_[state].next[byte] = next;
+		}
+		state = next;
+	}
+	return states_[state].accept;
+}
+
+void PathFilter::Matcher::Close(std::vector<int>& nodes) const {
+	for (std::size_t i = 0; i < nodes.size(); ++i) {
+		for (const int next : nfa_[nodes[i]].epsilon) {
+			if (std::ranges::find(nodes, next) == nodes.end())
+				nodes.push_back(next);
+		}
+	}
+	std::ranges::sort(nodes);
+	nodes.erase(std::ranges::unique(nodes).begin(), nodes.end());
+}
+
+std::int32_t PathFilter::Matcher::StateFor(std::vector<int> nodes) const {
+	Close(nodes);
+	if (const auto it = stateIds_.find(nodes); it != stateIds_.end())
+		return it->second;
+
+	DfaState state;
+	state.next.fill(-1);
+	state.accept = std::ranges::any_of(nodes, [&](int node) { return nfa_[node].accept; });
+	state.nodes = nodes;
+	const auto id = static_cast<std::int32_t>(states_.size());
+	states_.push_back(std::move(state));
+	stateIds_.emplace(std::move(nodes), id);
+	return id;
+}
+
+void PathFilter::Matcher::ResetDfa() const {
+	states_.clear();
+	stateIds_.clear();
+	StateFor(globStarts_);
+}
+
+PathFilter::PathFilter(const std::vector<std::string>& include, const std::vector<std::string>& exclude,
+                       const std::filesystem::path& anchorDir) {
+	const auto anchor = ToMatchable(anchorDir);
+	if (auto matcher = std::make_shared<Matcher>(include, anchor); !matcher->Empty())
+		include_ = std::move(matcher);
+	if (auto matcher = std::make_shared<Matcher>(exclude, anchor); !matcher->Empty())
+		exclude_ = std::move(matcher);
+}
+
+bool PathFilter::Matches(const std::filesystem::path& canonicalPath) const {
+	if (Empty())
+		return true;
+	return MatchesFolded(ToMatchable(canonicalPath));
+}
+
+bool PathFilter::MatchesFolded(std::string_view path) const {
+	if (include_ && !include_->Matches(path))
+		return false;
+	return !exclude_ || !exclude_->Matches(path);
+}
+
+// Windows paths compare case-insensitively; patterns and paths are folded the same way before matching.
+void PathFilter::FoldCase(char* text, std::size_t size) noexcept {
+#if defined(_WIN32)
+	for (std::size_t i = 0; i < size; ++i) {
+		if (text[i] >= 'A' && text[i] <= 'Z')
+			text[i] = static_cast<char>(text[i] - 'A' + 'a');
+	}
+#else
+	(void)text;
+	(void)size;
+#endif
+}
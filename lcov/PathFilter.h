@@ -0,0 +1,44 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The .covlcov "include"/"exclude" rules, compiled once when the configuration is loaded.
+ *
+ * Patterns without wildcards are path prefixes and go into a trie of path components. Glob patterns ("*", "?", "[...]"
+ * and "**") from a list are compiled together into one automaton whose DFA states are built lazily and cached, so a
+ * path is tested against every glob in a single pass over its characters. Either way the cost per file depends on the
+ * path length, not on the number of rules.
+ *
+ * Relative patterns are anchored to a directory (the resolved baseDir); patterns starting with "**" match anywhere.
+ * Matches is safe to call from several threads at once.
+ */
+class LCOV_API PathFilter {
+public:
+	PathFilter() = default;
+	PathFilter(const std::vector<std::string>& include, const std::vector<std::string>& exclude,
+	           const std::filesystem::path& anchorDir);
+
+	// True when there are no rules, i.e. every path is kept.
+	[[nodiscard]] bool Empty() const noexcept { return !include_ && !exclude_; }
+	// Whether a path passes the rules: it matches an include rule (or there are none) and no exclude rule.
+	// The path should be absolute and canonical.
+	[[nodiscard]] bool Matches(const std::filesystem::path& canonicalPath) const;
+	// Same, for a canonical path already in generic UTF-8 and passed through FoldCase.
+	[[nodiscard]] bool MatchesFolded(std::string_view path) const;
+
+	// Case folding applied to paths and patterns before matching: ASCII lowercase on Windows, nothing elsewhere.
+	static void FoldCase(char* text, std::size_t size) noexcept;
+
+private:
+	class Matcher;
+
+	std::shared_ptr<Matcher> include_;
+	std::shared_ptr<Matcher> exclude_;
+};
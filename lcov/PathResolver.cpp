@@ -0,0 +1,188 @@
+#include "pch.h"
+#include "PathResolver.h"
+
+#include "ExporterConfig.h"
+#include "RecordWriter.h"
+
+#include <mutex>
+
+namespace {
+	using NativeView = std::basic_string_view<std::filesystem::path::value_type>;
+
+	constexpr std::filesystem::path::value_type Dot[] = {'.', 0};
+	constexpr std::filesystem::path::value_type DotDot[] = {'.', '.', 0};
+
+	// Splits a native path after its last separator: the directory part (with the separator, "" for a bare file name)
+	// and the file name.
+	std::pair<NativeView, NativeView> SplitFileName(NativeView native) {
+#if defined(_WIN32)
+		const auto separator = native.find_last_of(L"\\/:");
+#else
+		const auto separator = native.find_last_of('/');
+#endif
+		const auto split = separator == NativeView::npos ? 0 : separator + 1;
+		return {native.substr(0, split), native.substr(split)};
+	}
+
+	// Whether joining a file name to a generic directory needs a '/' in between, as path::operator/ decides: not after
+	// an empty path, a root directory or a bare drive ("C:").
+	bool NeedsSeparator(std::string_view dir) {
+		return !dir.empty() && dir.back() != '/' && dir.back() != ':';
+	}
+}
+
+PathResolver::PathResolver(const ExporterConfig& cfg) : filter_(cfg.Filter()) {
+	if (!cfg.IncludeByBaseDir())
+		return;
+
+	const auto baseDir = cfg.GetResolvedBaseDir();
+	if (baseDir.empty())
+		return;
+
+	filterByBaseDir_ = true;
+	// MakeSFPath leaves paths untouched when the .covlcov could not be parsed.
+	rewriteSFPath_ = cfg.IsYamlValid();
+
+	std::error_code ec;
+	++canonicalizations_;
+	canonicalBase_ = std::filesystem::weakly_canonical(baseDir, ec);
+	if (ec)
+		canonicalBase_ = baseDir;
+}
+
+/**
+ * Classifies a path provided by OpenCppCoverage: whether it belongs in the report and what its SF path is.
+ *
+ * Gives the same answers as ExporterConfig::ShouldIncludeInReportByPath and ExporterConfig::MakeSFPath.
+ *
+ * @param path An absolute or relative path
+ * @return Inclusion and the SF path
+ */
+PathClassification PathResolver::Classify(const std::filesystem::path& path) {
+	if (!filterByBaseDir_ && filter_.Empty())
+		return {true, path};
+
+	const auto canonical = Canonicalize(path);
+	if (!filter_.Matches(canonical))
+		return {false, path};
+	if (!filterByBaseDir_)
+		return {true, path};
+
+	// If not under baseDir, the relative path will start with ".." (or be empty).
+	auto rel = canonical.lexically_relative(canonicalBase_);
+	if (rel.empty() || *rel.begin() == L"..")
+		return {false, path};
+
+	if (!rewriteSFPath_)
+		return {true, path};
+	return {true, std::move(rel)};
+}
+
+/**
+ * Classifies like Classify(path), writing the SF path as generic UTF-8. Reuses the directory's canonical form and its
+ * path relative to the base directory, so only the file name is joined per file.
+ */
+bool PathResolver::Classify(const std::filesystem::path& path, std::pmr::string& sfPathUtf8) {
+	if (!filterByBaseDir_ && filter_.Empty()) {
+		EncodePathUtf8(sfPathUtf8, path.native());
+		return true;
+	}
+
+	const auto [key, fileName] = SplitFileName(path.native());
+	if (fileName.empty() || fileName == Dot || fileName == DotDot) {
+		const auto [included, sfPath] = Classify(path);
+		if (included)
+			EncodePathUtf8(sfPathUtf8, sfPath.native());
+		return included;
+	}
+
+	if (IsSymlink(path)) {
+		const auto [included, sfPath] = Classify(path);
+		if (included)
+			EncodePathUtf8(sfPathUtf8, sfPath.native());
+		return included;
+	}
+
+	const auto& dir = DirectoryOf(path, key);
+	const auto begin = sfPathUtf8.size();
+	if (!filter_.Empty()) {
+		// The canonical path is put together in sfPathUtf8 for the rules, then replaced by the SF path.
+		sfPathUtf8.append(dir.matchable);
+		if (NeedsSeparator(dir.matchable))
+			sfPathUtf8.push_back('/');
+		const auto nameBegin = sfPathUtf8.size();
+		EncodePathUtf8(sfPathUtf8, fileName);
+		PathFilter::FoldCase(sfPathUtf8.data() + nameBegin, sfPathUtf8.size() - nameBegin);
+		const bool matches = filter_.MatchesFolded(std::string_view{sfPathUtf8}.substr(begin));
+		sfPathUtf8.resize(begin);
+		if (!matches)
+			return false;
+	}
+	if (filterByBaseDir_ && !dir.relative)
+		return false;
+
+	if (!filterByBaseDir_ || !rewriteSFPath_) {
+		EncodePathUtf8(sfPathUtf8, path.native());
+		return true;
+	}
+	sfPathUtf8.append(*dir.relative);
+	if (!dir.relative->empty())
+		sfPathUtf8.push_back('/');
+	EncodePathUtf8(sfPathUtf8, fileName);
+	return true;
+}
+
+/**
+ * weakly_canonical with the parent directory memoized. The file name is appended to the canonical directory, except
+ * for a source file that is itself a symlink, which is resolved in full like weakly_canonical does.
+ */
+std::filesystem::path PathResolver::Canonicalize(const std::filesystem::path& path) {
+	const auto [key, fileName] = SplitFileName(path.native());
+	if (fileName.empty() || fileName == Dot || fileName == DotDot || IsSymlink(path)) {
+		std::error_code ec;
+		canonicalizations_.fetch_add(1, std::memory_order_relaxed);
+		auto abs = std::filesystem::weakly_canonical(path, ec);
+		return ec ? path : abs;
+	}
+	return DirectoryOf(path, key).canonical / path.filename();
+}
+
+// Whether the file itself is a symlink; one symlink_status per file, and false when it cannot be read.
+bool PathResolver::IsSymlink(const std::filesystem::path& path) {
+	std::error_code ec;
+	return std::filesystem::is_symlink(path, ec);
+}
+
+// Cached Directory for the parent of path; key is its native string up to the file name.
+const PathResolver::Directory& PathResolver::DirectoryOf(const std::filesystem::path& path, NativeView key) {
+	{
+		std::shared_lock lock{cacheMutex_};
+		if (const auto it = canonicalDirs_.find(key); it != canonicalDirs_.end())
+			return it->second;
+	}
+
+	// Canonicalize outside the lock; two threads racing on the same directory compute the same answer.
+	const auto parent = path.parent_path();
+	std::error_code ec;
+	canonicalizations_.fetch_add(1, std::memory_order_relaxed);
+	Directory dir;
+	dir.canonical = std::filesystem::weakly_canonical(parent.empty() ? std::filesystem::path(L".") : parent, ec);
+	if (ec)
+		dir.canonical = parent;
+	if (!filter_.Empty()) {
+		EncodePathUtf8(dir.matchable, dir.canonical.native());
+		PathFilter::FoldCase(dir.matchable.data(), dir.matchable.size());
+	}
+	if (filterByBaseDir_) {
+		// If not under baseDir, the relative path will start with ".." (or be empty).
+		const auto rel = dir.canonical.lexically_relative(canonicalBase_);
+		if (!rel.empty() && *rel.begin() != L"..") {
+			dir.relative.emplace();
+			if (rel != L".")
+				EncodePathUtf8(*dir.relative, rel.native());
+		}
+	}
+
+	std::unique_lock lock{cacheMutex_};
+	return canonicalDirs_.try_emplace(std::filesystem::path::string_type{key}, std::move(dir)).first->second;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "LcovApi.h"
+#include "PathFilter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory_resource>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class ExporterConfig;
+
+// Result of classifying one source file against the configuration.
+struct PathClassification {
+	bool included = true;
+	// Path to write to the LCOV "SF:" line. Same as ExporterConfig::MakeSFPath.
+	std::filesystem::path sfPath;
+};
+
+/**
+ * Per-export resolver that answers ExporterConfig::ShouldIncludeInReportByPath and ExporterConfig::MakeSFPath in a
+ * single call.
+ *
+ * The base directory is canonicalized once on construction and canonical parent directories are memoized, so files
+ * sharing a directory cost one weakly_canonical call between them instead of four each; each file is still checked for
+ * being a symlink itself, which is resolved in full, so the answers match weakly_canonical on the whole path. The
+ * compiled include/exclude rules are applied to the same canonical path. Classify is safe to call from several threads
+ * at once.
+ */
+class LCOV_API PathResolver {
+public:
+	explicit PathResolver(const ExporterConfig& cfg);
+
+	PathClassification Classify(const std::filesystem::path& path);
+	/**
+	 * Same answer, with the SF path appended to sfPathUtf8 as generic UTF-8 (the bytes RenderFileRecord writes)
+	 * instead of returned as a path. Nothing but sfPathUtf8 is allocated once the file's directory has been seen, so
+	 * with an arena-backed string (ExportSession::Scratch) a file costs no heap allocation. Returns whether the file is
+	 * included; sfPathUtf8 is only written when it is.
+	 */
+	bool Classify(const std::filesystem::path& path, std::pmr::string& sfPathUtf8);
+
+	// Canonical base directory (empty when files are not filtered by baseDir)
+	[[nodiscard]] const std::filesystem::path& CanonicalBaseDir() const noexcept { return canonicalBase_; }
+	// Number of weakly_canonical calls made so far (cache misses and the base directory)
+	[[nodiscard]] std::uint64_t CanonicalizationCount() const noexcept { return canonicalizations_.load(std::memory_order_relaxed); }
+
+private:
+	using NativeView = std::basic_string_view<std::filesystem::path::value_type>;
+
+	// A parent directory of source files, resolved once.
+	struct Directory {
+		std::filesystem::path canonical;
+		// Canonical path in generic UTF-8, case-folded for the include/exclude rules (only with rules)
+		std::string matchable;
+		// Canonical path relative to the base directory in generic UTF-8, "" for the base itself; empty optional when
+		// the directory is outside it (only when filtering by baseDir)
+		std::optional<std::string> relative;
+	};
+	struct NativeHash {
+		using is_transparent = void;
+		std::size_t operator()(NativeView text) const noexcept { return std::hash<NativeView>{}(text); }
+	};
+
+	std::filesystem::path Canonicalize(const std::filesystem::path& path);
+	static bool IsSymlink(const std::filesystem::path& path);
+	const Directory& DirectoryOf(const std::filesystem::path& path, NativeView key);
+
+	PathFilter filter_;
+	bool filterByBaseDir_ = false;
+	bool rewriteSFPath_ = false;
+	std::filesystem::path canonicalBase_;
+	std::shared_mutex cacheMutex_;
+	// Keyed by the path up to and including its last separator, so lookups need no parent_path() copy
+	std::unordered_map<std::filesystem::path::string_type, Directory, NativeHash, std::equal_to<>> canonicalDirs_;
+	std::atomic<std::uint64_t> canonicalizations_{0};
+};
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "RecordCache.h"
+
+#include <cstring>
+#include <fstream>
+
+// Layout (host byte order; the cache never leaves the machine that wrote it):
+//   header: "covlcovC" | u32 version | u64 config fingerprint
+//   entry:  u32 path size | path (UTF-8) | u64 lines hash | u8 included | u32 record size | record
+namespace {
+	constexpr std::string_view Magic = "covlcovC";
+	constexpr std::uint32_t Version = 1;
+
+	template <typename T>
+	void AppendRaw(RecordBuffer& out, T value) {
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		out.Append(std::string_view(bytes, sizeof(T)));
+	}
+
+	template <typename T>
+	bool ReadRaw(std::string_view& in, T& value) {
+		if (in.size() < sizeof(T))
+			return false;
+		std::memcpy(&value, in.data(), sizeof(T));
+		in.remove_prefix(sizeof(T));
+		return true;
+	}
+
+	bool ReadBytes(std::string_view& in, std::uint32_t size, std::string_view& bytes) {
+		if (in.size() < size)
+			return false;
+		bytes = in.substr(0, size);
+		in.remove_prefix(size);
+		return true;
+	}
+}
+
+std::filesystem::path RecordCache::SidecarPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".cache";
+	return path;
+}
+
+std::uint64_t RecordCache::HashLines(const std::vector<Plugin::LineCoverage>& lines) {
+	// One multiply-xorshift round per line; the final rounds spread the last lines over all bits.
+	std::uint64_t hash = 0x9E3779B97F4A7C15ull ^ lines.size();
+	for (const auto& line : lines) {
+		hash ^= (std::uint64_t{line.GetLineNumber()} << 1) | (line.HasBeenExecuted() ? 1u : 0u);
+		hash *= 0xBF58476D1CE4E5B9ull;
+		hash ^= hash >> 31;
+	}
+	hash ^= hash >> 30;
+	hash *= 0x94D049BB133111EBull;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+void RecordCache::AppendHeader(RecordBuffer& out, std::uint64_t fingerprint) {
+	out.Append(Magic);
+	AppendRaw(out, Version);
+	AppendRaw(out, fingerprint);
+}
+
+void RecordCache::AppendEntry(RecordBuffer& out, std::string_view pathUtf8, std::uint64_t linesHash, bool included,
+                              std::string_view record) {
+	AppendRaw(out, static_cast<std::uint32_t>(pathUtf8.size()));
+	out.Append(pathUtf8);
+	AppendRaw(out, linesHash);
+	AppendRaw(out, static_cast<std::uint8_t>(included));
+	AppendRaw(out, static_cast<std::uint32_t>(record.size()));
+	out.Append(record);
+}
+
+bool RecordCache::Load(const std::filesystem::path& cachePath, std::uint64_t fingerprint) {
+	entries_.clear();
+	bytes_.clear();
+
+	std::error_code ec;
+	const auto size = std::filesystem::file_size(cachePath, ec);
+	if (ec)
+		return false;
+	std::ifstream ifs(cachePath, std::ios::binary);
+	bytes_.resize(static_cast<std::size_t>(size));
+	if (!ifs.read(bytes_.data(), static_cast<std::streamsize>(bytes_.size()))) {
+		bytes_.clear();
+		return false;
+	}
+
+	std::string_view in = bytes_;
+	std::uint32_t version = 0;
+	std::uint64_t cachedFingerprint = 0;
+	if (!in.starts_with(Magic)) {
+		bytes_.clear();
+		return false;
+	}
+	in.remove_prefix(Magic.size());
+	if (!ReadRaw(in, version) || version != Version || !ReadRaw(in, cachedFingerprint) || cachedFingerprint != fingerprint) {
+		bytes_.clear();
+		return false;
+	}
+
+	while (!in.empty()) {
+		std::uint32_t pathSize = 0;
+		std::uint32_t recordSize = 0;
+		std::uint8_t included = 0;
+		std::string_view path;
+		Entry entry;
+		if (!ReadRaw(in, pathSize) || !ReadBytes(in, pathSize, path) || !ReadRaw(in, entry.linesHash) ||
+			!ReadRaw(in, included) || !ReadRaw(in, recordSize) || !ReadBytes(in, recordSize, entry.record)) {
+			// Truncated cache (e.g. an interrupted export): trust none of it.
+			entries_.clear();
+			bytes_.clear();
+			return false;
+		}
+		entry.included = included != 0;
+		entries_.insert_or_assign(path, entry);
+	}
+	return true;
+}
+
+const RecordCache::Entry* RecordCache::Find(std::string_view pathUtf8, std::uint64_t linesHash) const {
+	const auto it = entries_.find(pathUtf8);
+	if (it == entries_.end() || it->second.linesHash != linesHash)
+		return nullptr;
+	return &it->second;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "LcovApi.h"
+#include "RecordWriter.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+/**
+ * Sidecar cache of rendered records, used by incremental export.
+ *
+ * Entries are keyed by the source path reported by OpenCppCoverage and hold a hash of the file's line/executed vector,
+ * whether the file was included in the report, and its rendered record bytes. The whole cache is tagged with the
+ * configuration fingerprint; a cache written under another .covlcov is ignored. Find is safe to call from several
+ * threads once Load has returned.
+ */
+class LCOV_API RecordCache {
+public:
+	struct Entry {
+		std::uint64_t linesHash = 0;
+		bool included = true;
+		std::string_view record; // empty for excluded files
+	};
+
+	RecordCache() = default;
+	RecordCache(const RecordCache&) = delete;
+	RecordCache& operator=(const RecordCache&) = delete;
+
+	// Loads the cache. Leaves it empty and returns false if the file is missing, malformed or has another fingerprint.
+	bool Load(const std::filesystem::path& cachePath, std::uint64_t fingerprint);
+	// Returns the entry for a source path if its lines still hash to linesHash.
+	[[nodiscard]] const Entry* Find(std::string_view pathUtf8, std::uint64_t linesHash) const;
+	[[nodiscard]] std::size_t Size() const noexcept { return entries_.size(); }
+
+	// Sidecar written next to the report: "<output>.cache".
+	static std::filesystem::path SidecarPath(const std::filesystem::path& outputPath);
+	static std::uint64_t HashLines(const std::vector<Plugin::LineCoverage>& lines);
+
+	static void AppendHeader(RecordBuffer& out, std::uint64_t fingerprint);
+	static void AppendEntry(RecordBuffer& out, std::string_view pathUtf8, std::uint64_t linesHash, bool included,
+	                        std::string_view record);
+
+private:
+	std::string bytes_;
+	std::unordered_map<std::string_view, Entry> entries_;
+};
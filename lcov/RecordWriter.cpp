@@ -0,0 +1,204 @@
+#include "pch.h"
+#include "RecordWriter.h"
+
+#include "AsyncWriter.h"
+#include "GzipWriter.h"
+
+#include <algorithm>
+#include <charconv>
+
+void RecordBuffer::AppendUInt(std::uint64_t value) {
+	char digits[20];
+	auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+	bytes_.append(digits, end);
+}
+
+void RecordBuffer::AppendJsonString(std::string_view utf8) {
+	static constexpr char hex[] = "0123456789abcdef";
+	bytes_.push_back('"');
+	for (const char c : utf8) {
+		const auto byte = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\') {
+			bytes_.push_back('\\');
+			bytes_.push_back(c);
+		} else if (byte < 0x20) {
+			bytes_.append("\\u00");
+			bytes_.push_back(hex[byte >> 4]);
+			bytes_.push_back(hex[byte & 0xF]);
+		} else {
+			bytes_.push_back(c);
+		}
+	}
+	bytes_.push_back('"');
+}
+
+namespace {
+	// Whether profile writes a record for a file with these lines.
+	bool HasRecord(OutputProfile profile, const std::vector<Plugin::LineCoverage>& lines) {
+		return profile == OutputProfile::Full || !lines.empty();
+	}
+
+	// DA, LF and LH lines and the end of a record; the TN and SF lines are already written.
+	void RenderFileLines(RecordBuffer& out, const std::vector<Plugin::LineCoverage>& lines, OutputProfile profile) {
+		// DA entries: one per line, hit count is 1 (executed) or 0 (not); hits-only leaves out the zeros.
+		const bool zeroHits = profile != OutputProfile::HitsOnly;
+		std::size_t coveredCount = 0;
+		for (const auto& line : lines) {
+			if (line.HasBeenExecuted()) {
+				out.Append("DA:");
+				out.AppendUInt(line.GetLineNumber());
+				out.Append(",1\n");
+				++coveredCount;
+			} else if (zeroHits) {
+				out.Append("DA:");
+				out.AppendUInt(line.GetLineNumber());
+				out.Append(",0\n");
+			}
+		}
+
+		// LF: lines found, LH: lines hit
+		out.Append("LF:");
+		out.AppendUInt(lines.size());
+		out.Append("\nLH:");
+		out.AppendUInt(coveredCount);
+		out.Append("\nend_of_record\n");
+	}
+
+	// "TN:" is always empty; readers do not need it, so only the full profile writes it.
+	std::string_view RecordHeader(OutputProfile profile) {
+		return profile == OutputProfile::Full ? "TN:\nSF:" : "SF:";
+	}
+}
+
+void RenderFileRecord(RecordBuffer& out, const std::filesystem::path& sfPath,
+                      const std::vector<Plugin::LineCoverage>& lines, OutputProfile profile) {
+	if (!HasRecord(profile, lines))
+		return;
+	// "DA:<line>,<hit>\n" rarely exceeds 16 bytes; reserving up front avoids regrowth mid-record.
+	out.Reserve(out.Size() + 64 + sfPath.native().size() + lines.size() * 16);
+
+	// Test name and source file path
+	out.Append(RecordHeader(profile));
+	out.AppendPathUtf8(sfPath);
+	out.Append('\n');
+	RenderFileLines(out, lines, profile);
+}
+
+void RenderFileRecord(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<Plugin::LineCoverage>& lines,
+                      OutputProfile profile) {
+	if (!HasRecord(profile, lines))
+		return;
+	out.Reserve(out.Size() + 64 + sfPathUtf8.size() + lines.size() * 16);
+
+	out.Append(RecordHeader(profile));
+	out.Append(sfPathUtf8);
+	out.Append('\n');
+	RenderFileLines(out, lines, profile);
+}
+
+namespace {
+	std::size_t DigitCount(std::uint64_t value) {
+		std::size_t digits = 1;
+		for (; value >= 10; value /= 10)
+			++digits;
+		return digits;
+	}
+}
+
+std::size_t FileRecordSize(std::size_t sfPathBytes, const std::vector<Plugin::LineCoverage>& lines, OutputProfile profile) {
+	if (!HasRecord(profile, lines))
+		return 0;
+	constexpr std::string_view footer = "\nend_of_record\n";
+	const bool zeroHits = profile != OutputProfile::HitsOnly;
+	// "DA:" <line> ",0\n" or ",1\n"
+	std::size_t size = RecordHeader(profile).size() + sfPathBytes + 1;
+	std::size_t coveredCount = 0;
+	for (const auto& line : lines) {
+		if (line.HasBeenExecuted() || zeroHits)
+			size += 3 + DigitCount(line.GetLineNumber()) + 3;
+		coveredCount += line.HasBeenExecuted();
+	}
+	// "LF:" <n> "\nLH:" <n>
+	size += 3 + DigitCount(lines.size()) + 4 + DigitCount(coveredCount);
+	return size + footer.size();
+}
+
+void RenderFileRecord(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<LineHits>& lines) {
+	out.Reserve(out.Size() + 64 + sfPathUtf8.size() + lines.size() * 16);
+
+	out.Append("TN:\nSF:");
+	out.Append(sfPathUtf8);
+	out.Append('\n');
+
+	std::size_t coveredCount = 0;
+	for (const auto& [line, hits] : lines) {
+		out.Append("DA:");
+		out.AppendUInt(line);
+		out.Append(',');
+		out.AppendUInt(hits);
+		out.Append('\n');
+		coveredCount += hits != 0;
+	}
+
+	out.Append("LF:");
+	out.AppendUInt(lines.size());
+	out.Append("\nLH:");
+	out.AppendUInt(coveredCount);
+	out.Append("\nend_of_record\n");
+}
+
+RecordWriter::RecordWriter(const std::filesystem::path& outputPath, const OutputOptions& options) {
+	// Blocks are already large; let them go straight to the OS instead of through the filebuf.
+	ofs_.rdbuf()->pubsetbuf(nullptr, 0);
+	ofs_.open(outputPath, std::ios::binary | std::ios::trunc);
+	if (ofs_.is_open() && options.gzip) {
+		gzip_ = std::make_unique<GzipWriter>(ofs_, options.level, options.threads);
+	} else if (ofs_.is_open() && options.async) {
+		// Double buffering: one block is filled while the other is written.
+		async_ = std::make_unique<AsyncWriter>(ofs_, 2, FlushThreshold + FlushThreshold / 4);
+	}
+	buffer_.Reserve(FlushThreshold + FlushThreshold / 4);
+}
+
+// Stops the writer threads before the stream they write to is closed.
+RecordWriter::~RecordWriter() {
+	gzip_.reset();
+	async_.reset();
+}
+
+void RecordWriter::FlushIfFull() {
+	if (buffer_.Size() >= FlushThreshold)
+		Flush();
+}
+
+bool RecordWriter::Flush() {
+	if (!buffer_.Empty() && !failed_) {
+		if (gzip_) {
+			// The block is compressed on a worker thread; start the next one in a fresh buffer.
+			failed_ = !gzip_->Write(buffer_.Release());
+			buffer_.Reserve(FlushThreshold + FlushThreshold / 4);
+		} else if (async_) {
+			// Written on the writer thread; continue in the pool's free buffer.
+			auto block = buffer_.Release();
+			failed_ = !async_->Write(block);
+			buffer_.Adopt(std::move(block));
+		} else {
+			ofs_.write(buffer_.Data(), static_cast<std::streamsize>(buffer_.Size()));
+			failed_ = !ofs_;
+		}
+	}
+	buffer_.Clear();
+	return !failed_;
+}
+
+bool RecordWriter::Finish() {
+	if (!ofs_.is_open())
+		return false;
+	Flush();
+	if (gzip_ && !gzip_->Finish())
+		failed_ = true;
+	if (async_ && !async_->Finish())
+		failed_ = true;
+	ofs_.close();
+	return !failed_ && !ofs_.fail();
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <string_view>
+#include <vector>
+
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+// Appends a UTF-16 (Windows) or UTF-32 (elsewhere) string to a narrow string (std::string, std::pmr::string) as UTF-8.
+template <typename String>
+void EncodeUtf8(String& out, std::wstring_view text) {
+	out.reserve(out.size() + text.size());
+	for (std::size_t i = 0; i < text.size(); ++i) {
+		auto cp = static_cast<std::uint32_t>(text[i]);
+		if (cp < 0x80) {
+			out.push_back(static_cast<char>(cp));
+			continue;
+		}
+
+		// Combine UTF-16 surrogate pairs. Lone surrogates become U+FFFD.
+		if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < text.size()) {
+			const auto low = static_cast<std::uint32_t>(text[i + 1]);
+			if (low >= 0xDC00 && low <= 0xDFFF) {
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				++i;
+			}
+		}
+		if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+			cp = 0xFFFD;
+
+		if (cp < 0x800) {
+			out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		} else if (cp < 0x10000) {
+			out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		} else {
+			out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+	}
+}
+
+/**
+ * Appends the native string of a path as UTF-8, the same bytes as EncodeUtf8(path.wstring()) (or generic_wstring()
+ * with generic) but without the wide temporary. Native POSIX paths are already narrow and are copied as they are.
+ */
+template <typename String>
+void EncodePathUtf8(String& out, std::basic_string_view<std::filesystem::path::value_type> native, bool generic = true) {
+#if defined(_WIN32)
+	const auto begin = out.size();
+	EncodeUtf8(out, native);
+	if (generic)
+		std::replace(out.begin() + begin, out.end(), '\\', '/');
+#else
+	(void)generic;
+	out.append(native);
+#endif
+}
+
+// Reusable narrow byte buffer that LCOV records are rendered into. All text is UTF-8.
+class LCOV_API RecordBuffer {
+public:
+	void Append(std::string_view text) { bytes_.append(text); }
+	void Append(char c) { bytes_.push_back(c); }
+	void AppendUInt(std::uint64_t value);
+	// Appends a UTF-16 (Windows) or UTF-32 (elsewhere) string encoded as UTF-8.
+	void AppendUtf8(std::wstring_view text) { EncodeUtf8(bytes_, text); }
+	// Appends a path as UTF-8, in generic form unless generic is false (see EncodePathUtf8).
+	void AppendPathUtf8(const std::filesystem::path& path, bool generic = true) { EncodePathUtf8(bytes_, path.native(), generic); }
+	// Appends UTF-8 text as a quoted JSON string.
+	void AppendJsonString(std::string_view utf8);
+
+	void Reserve(std::size_t bytes) { bytes_.reserve(bytes); }
+	void Clear() noexcept { bytes_.clear(); }
+	// Hands the bytes over, leaving the buffer empty without capacity.
+	std::string Release() noexcept { return std::exchange(bytes_, {}); }
+	// Continues in storage handed back by a consumer of Release, keeping its capacity but not its contents.
+	void Adopt(std::string storage) noexcept {
+		bytes_ = std::move(storage);
+		bytes_.clear();
+	}
+
+	[[nodiscard]] const char* Data() const noexcept { return bytes_.data(); }
+	[[nodiscard]] std::size_t Size() const noexcept { return bytes_.size(); }
+	[[nodiscard]] bool Empty() const noexcept { return bytes_.empty(); }
+	[[nodiscard]] std::string_view View() const noexcept { return bytes_; }
+
+private:
+	std::string bytes_;
+};
+
+// Line number and hit count of one "DA:" entry.
+struct LineHits {
+	std::uint32_t line = 0;
+	std::uint64_t hits = 0;
+};
+
+// Which lines of a record are written ("profile" in .covlcov). LF and LH always count every line.
+enum class OutputProfile {
+	// "TN:" line, and a DA entry for every line, executed or not
+	Full,
+	// No "TN:" line, and no record at all for a file without lines
+	Compact,
+	// As Compact, with DA entries for executed lines only
+	HitsOnly
+};
+
+// Renders one "TN: ... end_of_record" block for a source file, laid out as profile says.
+LCOV_API void RenderFileRecord(RecordBuffer& out, const std::filesystem::path& sfPath,
+                               const std::vector<Plugin::LineCoverage>& lines, OutputProfile profile = OutputProfile::Full);
+// Same, for an SF path already encoded as generic UTF-8 (see PathResolver::Classify).
+LCOV_API void RenderFileRecord(RecordBuffer& out, std::string_view sfPathUtf8,
+                               const std::vector<Plugin::LineCoverage>& lines, OutputProfile profile = OutputProfile::Full);
+// Exact number of bytes RenderFileRecord writes for a file whose SF path is sfPathBytes long in UTF-8.
+LCOV_API std::size_t FileRecordSize(std::size_t sfPathBytes, const std::vector<Plugin::LineCoverage>& lines,
+                                    OutputProfile profile = OutputProfile::Full);
+// Same layout, for an already UTF-8 encoded SF path and explicit hit counts (used when merging tracefiles).
+LCOV_API void RenderFileRecord(RecordBuffer& out, std::string_view sfPathUtf8, const std::vector<LineHits>& lines);
+
+class AsyncWriter;
+class GzipWriter;
+
+// How a RecordWriter writes. With gzip, each flushed block becomes one gzip member (see GzipWriter); with async, plain
+// blocks are written on a background thread (see AsyncWriter).
+struct OutputOptions {
+	bool gzip = false;
+	int level = 6;
+	unsigned threads = 1;
+	bool async = false;
+};
+
+// Writes rendered records to disk in large blocks, bypassing the stream's own buffering.
+// Without async, write errors show up in Flush; with it, only by Finish.
+class LCOV_API RecordWriter {
+public:
+	static constexpr std::size_t FlushThreshold = 4 * 1024 * 1024;
+
+	explicit RecordWriter(const std::filesystem::path& outputPath, const OutputOptions& options = {});
+	~RecordWriter();
+
+	[[nodiscard]] bool IsOpen() const noexcept { return ofs_.is_open(); }
+	RecordBuffer& Buffer() noexcept { return buffer_; }
+
+	// Writes the buffer out once it has grown past FlushThreshold.
+	void FlushIfFull();
+	bool Flush();
+	// Flushes and closes the file. Returns false if any write failed.
+	bool Finish();
+
+private:
+	std::ofstream ofs_;
+	std::unique_ptr<GzipWriter> gzip_;
+	std::unique_ptr<AsyncWriter> async_;
+	RecordBuffer buffer_;
+	bool failed_ = false;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "RecordWriter.h"
+#include "ReportSummary.h"
+#include "TestIndex.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+// Output of rendering one contiguous range of files: the records and any log messages, in file order.
+struct RenderedChunk {
+	RecordBuffer records;
+	// Number of records in records
+	std::uint64_t recordCount = 0;
+	ExporterConfigLog log;
+	// Incremental export only: RecordCache entries for the chunk's files.
+	RecordBuffer cacheEntries;
+	// Snapshot export only: SnapshotWriter::EncodeFile output for the chunk's included files.
+	RecordBuffer snapshotFiles;
+	// Patch coverage only: PatchCoverage::Measure output for the chunk's files changed by the diff.
+	RecordBuffer patchRecords;
+	RecordBuffer patchFiles;
+	// Summary only: totals and chunk-relative byte range of each record.
+	std::vector<FileSummary> summaries;
+	// Test index only: executed lines of the chunk's included files.
+	std::vector<TestedFile> testedFiles;
+	// Excluded files per directory, one entry per run of consecutive files in the same directory.
+	std::vector<std::pair<std::filesystem::path::string_type, std::uint64_t>> excludedDirs;
+
+	// Empties every field for the next range, keeping the buffers' capacity. A new field must be reset here.
+	void Clear() {
+		records.Clear();
+		recordCount = 0;
+		log.messages.clear();
+		cacheEntries.Clear();
+		snapshotFiles.Clear();
+		patchRecords.Clear();
+		patchFiles.Clear();
+		summaries.clear();
+		testedFiles.clear();
+		excludedDirs.clear();
+	}
+};
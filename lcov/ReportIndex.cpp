@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "ReportIndex.h"
+
+#include "TracefileMerger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+	constexpr std::string_view Magic = "covlcovI";
+	constexpr std::uint32_t Version = 1;
+	constexpr std::size_t HeaderSize = 8 + 4 + 4 + 8;
+	constexpr std::size_t EntrySize = 8 + 8 + 4 + 4 + 4 + 4;
+
+	template <typename T>
+	void AppendRaw(RecordBuffer& out, T value) {
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		out.Append(std::string_view(bytes, sizeof(T)));
+	}
+
+	template <typename T>
+	T ReadRaw(const char* at) {
+		T value;
+		std::memcpy(&value, at, sizeof(T));
+		return value;
+	}
+
+	std::uint32_t Clamp32(std::uint64_t value) {
+		return static_cast<std::uint32_t>(std::min<std::uint64_t>(value, UINT32_MAX));
+	}
+}
+
+bool ReportIndex::Write(const std::filesystem::path& indexPath, std::span<const FileSummary> records, std::uint64_t reportSize) {
+	// Sorted by path, then by position, so a file's records are adjacent and in report order.
+	std::vector<const FileSummary*> sorted;
+	sorted.reserve(records.size());
+	for (const auto& record : records)
+		sorted.push_back(&record);
+	std::ranges::sort(sorted, [](const FileSummary* a, const FileSummary* b) {
+		const auto order = a->sfPath.compare(b->sfPath);
+		return order != 0 ? order < 0 : a->offset < b->offset;
+	});
+
+	RecordBuffer out;
+	out.Reserve(HeaderSize + sorted.size() * EntrySize);
+	out.Append(Magic);
+	AppendRaw(out, Version);
+	AppendRaw(out, static_cast<std::uint32_t>(sorted.size()));
+	AppendRaw(out, reportSize);
+	std::uint64_t pathOffset = 0;
+	for (const auto* record : sorted) {
+		AppendRaw(out, record->offset);
+		AppendRaw(out, record->bytes);
+		AppendRaw(out, static_cast<std::uint32_t>(pathOffset));
+		AppendRaw(out, static_cast<std::uint32_t>(record->sfPath.size()));
+		AppendRaw(out, Clamp32(record->linesFound));
+		AppendRaw(out, Clamp32(record->linesHit));
+		pathOffset += record->sfPath.size();
+	}
+	if (pathOffset > UINT32_MAX)
+		return false;
+	for (const auto* record : sorted)
+		out.Append(record->sfPath);
+
+	std::ofstream ofs(indexPath, std::ios::binary | std::ios::trunc);
+	ofs.write(out.Data(), static_cast<std::streamsize>(out.Size()));
+	return static_cast<bool>(ofs);
+}
+
+std::filesystem::path ReportIndex::IndexPath(const std::filesystem::path& reportPath) {
+	auto path = reportPath;
+	path += L".idx";
+	return path;
+}
+
+bool ReportIndex::Open(const std::filesystem::path& reportPath) {
+	Close();
+	if (!report_.Open(reportPath) || !index_.Open(IndexPath(reportPath))) {
+		Close();
+		return false;
+	}
+
+	const auto index = index_.View();
+	if (index.size() < HeaderSize || !index.starts_with(Magic) || ReadRaw<std::uint32_t>(index.data() + 8) != Version ||
+	    ReadRaw<std::uint64_t>(index.data() + 16) != report_.View().size()) {
+		Close();
+		return false;
+	}
+	const std::size_t count = ReadRaw<std::uint32_t>(index.data() + 12);
+	if ((index.size() - HeaderSize) / EntrySize < count) {
+		Close();
+		return false;
+	}
+	entries_ = index.substr(HeaderSize, count * EntrySize);
+	paths_ = index.substr(HeaderSize + count * EntrySize);
+	count_ = count;
+	return true;
+}
+
+void ReportIndex::Close() noexcept {
+	report_.Close();
+	index_.Close();
+	entries_ = {};
+	paths_ = {};
+	count_ = 0;
+}
+
+ReportIndex::Entry ReportIndex::At(std::size_t i) const {
+	const char* at = entries_.data() + i * EntrySize;
+	Entry entry;
+	entry.offset = ReadRaw<std::uint64_t>(at);
+	entry.bytes = ReadRaw<std::uint64_t>(at + 8);
+	const auto pathOffset = ReadRaw<std::uint32_t>(at + 16);
+	const auto pathSize = ReadRaw<std::uint32_t>(at + 20);
+	// A damaged table yields empty paths rather than reads past the mapping.
+	if (pathOffset <= paths_.size() && pathSize <= paths_.size() - pathOffset)
+		entry.sfPath = paths_.substr(pathOffset, pathSize);
+	entry.linesFound = ReadRaw<std::uint32_t>(at + 24);
+	entry.linesHit = ReadRaw<std::uint32_t>(at + 28);
+	return entry;
+}
+
+std::pair<std::size_t, std::size_t> ReportIndex::Find(std::string_view sfPathUtf8) const {
+	// Binary search for the first entry not below the path, then walk its (usually single) duplicates.
+	std::size_t first = 0;
+	std::size_t count = count_;
+	while (count > 0) {
+		const auto half = count / 2;
+		if (At(first + half).sfPath < sfPathUtf8) {
+			first += half + 1;
+			count -= half + 1;
+		} else {
+			count = half;
+		}
+	}
+	auto last = first;
+	while (last < count_ && At(last).sfPath == sfPathUtf8)
+		++last;
+	return {first, last};
+}
+
+std::string_view ReportIndex::Record(const Entry& entry) const {
+	const auto report = report_.View();
+	if (entry.offset > report.size() || entry.bytes > report.size() - entry.offset)
+		return {};
+	const auto record = report.substr(entry.offset, entry.bytes);
+	// "TN:\nSF:<path>\n", or "SF:<path>\n" with the compact profiles; anything else means the index is stale.
+	const std::string_view header = record.starts_with("TN:\n") ? "TN:\nSF:" : "SF:";
+	if (!record.starts_with(header) || record.substr(header.size(), entry.sfPath.size()) != entry.sfPath ||
+	    record.substr(header.size() + entry.sfPath.size(), 1) != "\n")
+		return {};
+	return record;
+}
+
+bool ReportIndex::Lines(std::string_view sfPathUtf8, std::vector<LineHits>& lines) const {
+	lines.clear();
+	const auto [first, last] = Find(sfPathUtf8);
+	bool found = false;
+	for (auto i = first; i < last; ++i) {
+		const auto record = Record(At(i));
+		if (record.empty())
+			continue;
+		found = true;
+		TracefileMerger::Parse(record, [&](TracefileRecord&& parsed) {
+			TracefileMerger::MergeLines(lines, std::move(parsed.lines));
+		});
+	}
+	return found;
+}
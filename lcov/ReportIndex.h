@@ -0,0 +1,67 @@
+#pragma once
+
+#include "LcovApi.h"
+#include "MappedFile.h"
+#include "RecordWriter.h"
+#include "ReportSummary.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Seekable index of an LCOV report ("index: true" in .covlcov): its SF paths, sorted, each with the byte range of
+ * its record.
+ *
+ * The exporter writes "<report>.idx" from the record offsets it already tracks for the summary, so building it costs
+ * one sort of the path table. Readers map the report and the index and find a file by binary search, touching only
+ * the pages of the entries compared and of the record itself, however large the report.
+ *
+ * Layout (little-endian):
+ *   header: "covlcovI" | u32 version | u32 entry count | u64 report size
+ *   entry:  u64 record offset | u64 record size | u32 path offset | u32 path size | u32 LF | u32 LH
+ *   paths:  UTF-8 SF paths, referenced by offset from the start of this table
+ */
+class LCOV_API ReportIndex {
+public:
+	struct Entry {
+		std::string_view sfPath;
+		std::uint64_t offset = 0;
+		std::uint64_t bytes = 0;
+		std::uint32_t linesFound = 0;
+		std::uint32_t linesHit = 0;
+	};
+
+	// Writes the index of one report file (or shard) of reportSize bytes holding the given records.
+	static bool Write(const std::filesystem::path& indexPath, std::span<const FileSummary> records, std::uint64_t reportSize);
+	// Index written next to a report: "<report>.idx"
+	static std::filesystem::path IndexPath(const std::filesystem::path& reportPath);
+
+	// Maps a report and its index. Returns false when either cannot be read or the index does not fit the report.
+	bool Open(const std::filesystem::path& reportPath);
+	void Close() noexcept;
+
+	[[nodiscard]] std::size_t Size() const noexcept { return count_; }
+	[[nodiscard]] Entry At(std::size_t i) const;
+	// Entries [first, last) for an SF path (UTF-8, '/' separators); several when the file has a record per module.
+	[[nodiscard]] std::pair<std::size_t, std::size_t> Find(std::string_view sfPathUtf8) const;
+	// Record text of an entry; empty when it is not the entry's record (the report changed after indexing).
+	[[nodiscard]] std::string_view Record(const Entry& entry) const;
+
+	/**
+	 * DA lines of an SF path in line order, with the hits of all its records summed. Returns false when the report
+	 * has no record for it.
+	 */
+	bool Lines(std::string_view sfPathUtf8, std::vector<LineHits>& lines) const;
+
+private:
+	MappedFile report_;
+	MappedFile index_;
+	std::string_view entries_;
+	std::string_view paths_;
+	std::size_t count_ = 0;
+};
@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "ReportSummary.h"
+
+#include "RecordWriter.h"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string_view>
+
+namespace {
+	struct Node {
+		std::map<std::string, std::unique_ptr<Node>> children;
+		DirectorySummary totals;
+	};
+
+	// Sums every node's children into it, then lists the nodes parents first.
+	void Reduce(Node& node, std::vector<DirectorySummary>& out) {
+		const auto index = out.size();
+		out.push_back({});
+		for (auto& [name, child] : node.children) {
+			Reduce(*child, out);
+			node.totals.linesFound += child->totals.linesFound;
+			node.totals.linesHit += child->totals.linesHit;
+			node.totals.files += child->totals.files;
+		}
+		out[index] = node.totals;
+	}
+
+	void AppendCounts(RecordBuffer& json, std::uint64_t found, std::uint64_t hit) {
+		json.Append(", \"lf\": ");
+		json.AppendUInt(found);
+		json.Append(", \"lh\": ");
+		json.AppendUInt(hit);
+	}
+}
+
+std::vector<DirectorySummary> ReportSummary::Directories() const {
+	Node root;
+	for (const auto& file : files_) {
+		Node* node = &root;
+		const std::string_view path = file.sfPath;
+		// Each '/' ends one directory; the node keeps the path up to it ("src", "src/core", ...).
+		std::size_t start = 0;
+		for (auto slash = path.find('/'); slash != std::string_view::npos; start = slash + 1, slash = path.find('/', start)) {
+			// Leading "/" of an absolute path
+			if (slash == start)
+				continue;
+			auto& child = node->children[std::string(path.substr(start, slash - start))];
+			if (!child) {
+				child = std::make_unique<Node>();
+				child->totals.path = path.substr(0, slash);
+			}
+			node = child.get();
+		}
+		node->totals.linesFound += file.linesFound;
+		node->totals.linesHit += file.linesHit;
+		++node->totals.files;
+	}
+
+	std::vector<DirectorySummary> directories;
+	Reduce(root, directories);
+	// The root holds the report totals; it is written separately.
+	directories.erase(directories.begin());
+	return directories;
+}
+
+bool ReportSummary::WriteJson(const std::filesystem::path& jsonPath, const std::filesystem::path& outputPath, bool sharded) const {
+	std::uint64_t found = 0;
+	std::uint64_t hit = 0;
+	for (const auto& file : files_) {
+		found += file.linesFound;
+		hit += file.linesHit;
+	}
+
+	RecordBuffer report;
+	report.AppendUtf8(outputPath.filename().wstring());
+	RecordBuffer json;
+	json.Append("{\n  \"version\": 1,\n  \"report\": ");
+	json.AppendJsonString(report.View());
+	json.Append(",\n  \"files\": ");
+	json.AppendUInt(files_.size());
+	AppendCounts(json, found, hit);
+	json.Append(",\n  \"directories\": [\n");
+	const auto directories = Directories();
+	for (std::size_t i = 0; i < directories.size(); ++i) {
+		json.Append("    {\"path\": ");
+		json.AppendJsonString(directories[i].path);
+		json.Append(", \"files\": ");
+		json.AppendUInt(directories[i].files);
+		AppendCounts(json, directories[i].linesFound, directories[i].linesHit);
+		json.Append(i + 1 < directories.size() ? "},\n" : "}\n");
+	}
+	json.Append("  ],\n  \"sourceFiles\": [\n");
+	for (std::size_t i = 0; i < files_.size(); ++i) {
+		json.Append("    {\"path\": ");
+		json.AppendJsonString(files_[i].sfPath);
+		AppendCounts(json, files_[i].linesFound, files_[i].linesHit);
+		if (sharded) {
+			json.Append(", \"shard\": ");
+			json.AppendUInt(files_[i].shard);
+		}
+		json.Append(", \"offset\": ");
+		json.AppendUInt(files_[i].offset);
+		json.Append(", \"bytes\": ");
+		json.AppendUInt(files_[i].bytes);
+		json.Append(i + 1 < files_.size() ? "},\n" : "}\n");
+	}
+	json.Append("  ]\n}\n");
+
+	std::ofstream ofs(jsonPath, std::ios::binary | std::ios::trunc);
+	ofs.write(json.Data(), static_cast<std::streamsize>(json.Size()));
+	return static_cast<bool>(ofs);
+}
+
+std::filesystem::path ReportSummary::SidecarPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".summary.json";
+	return path;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "LcovApi.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Totals and location of one file's record in the report.
+struct FileSummary {
+	std::string sfPath; // UTF-8, as written to "SF:"
+	std::uint64_t linesFound = 0;
+	std::uint64_t linesHit = 0;
+	// Byte range of the record in the (uncompressed) report, or in its shard
+	std::uint64_t offset = 0;
+	std::uint64_t bytes = 0;
+	std::uint32_t shard = 0;
+};
+
+// Rolled-up totals of every file under a directory of SF paths.
+struct DirectorySummary {
+	std::string path;
+	std::uint64_t linesFound = 0;
+	std::uint64_t linesHit = 0;
+	std::uint64_t files = 0;
+};
+
+/**
+ * LF/LH per file and per directory, collected while the report is written ("summary: true" in .covlcov), so
+ * dashboards can read totals and seek to single records without parsing the report.
+ *
+ * Directory totals come from a tree reduction: files are attached to their directory in a trie of SF path components,
+ * then each directory's totals are summed from its children, bottom up.
+ */
+class LCOV_API ReportSummary {
+public:
+	void Add(FileSummary file) { files_.push_back(std::move(file)); }
+
+	[[nodiscard]] const std::vector<FileSummary>& Files() const noexcept { return files_; }
+	// Every directory holding a file, parents before children, siblings sorted by name.
+	[[nodiscard]] std::vector<DirectorySummary> Directories() const;
+
+	bool WriteJson(const std::filesystem::path& jsonPath, const std::filesystem::path& outputPath, bool sharded) const;
+	// Sidecar written next to the report: "<output>.summary.json"
+	static std::filesystem::path SidecarPath(const std::filesystem::path& outputPath);
+
+private:
+	std::vector<FileSummary> files_;
+};
@@ -0,0 +1,131 @@
+#include "pch.h"
+#include "ShardPlan.h"
+
+#include "RecordWriter.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
+namespace {
+	const char* ShardByName(ShardBy by) {
+		switch (by) {
+		case ShardBy::Module: return "module";
+		case ShardBy::Directory: return "directory";
+		default: return "hash";
+		}
+	}
+
+	// Top-level directory under baseDir; files outside baseDir share one group.
+	std::filesystem::path::string_type TopLevelDir(const std::filesystem::path& path, const std::filesystem::path& baseDir) {
+		const auto rel = path.lexically_relative(baseDir);
+		if (rel.empty() || *rel.begin() == L"..")
+			return {};
+		const auto first = rel.begin();
+		// Files directly in baseDir form one group
+		if (std::next(first) == rel.end())
+			return std::filesystem::path(L".").native();
+		return first->native();
+	}
+}
+
+std::filesystem::path ShardPath(const std::filesystem::path& outputPath, std::size_t index) {
+	// The index goes before the last extension, and before ".info" in "coverage.info.gz"; a name without an
+	// extension gets it appended.
+	auto name = outputPath.filename();
+	std::filesystem::path compression;
+	if (name.extension() == L".gz") {
+		compression = name.extension();
+		name = name.stem();
+	}
+	const auto extension = name.extension();
+	auto shardName = name.stem();
+	shardName += L"." + std::to_wstring(index);
+	shardName += extension;
+	shardName += compression;
+	return outputPath.parent_path() / shardName;
+}
+
+std::filesystem::path ShardManifestPath(const std::filesystem::path& outputPath) {
+	auto path = outputPath;
+	path += L".shards.json";
+	return path;
+}
+
+std::vector<std::uint32_t> AssignShards(const std::vector<const Plugin::FileCoverage*>& files,
+                                        const std::vector<std::size_t>& moduleOf, ShardBy by,
+                                        std::size_t shardCount, const std::filesystem::path& baseDir) {
+	std::vector<std::uint32_t> shardOf(files.size(), 0);
+	if (shardCount <= 1)
+		return shardOf;
+
+	if (by == ShardBy::Hash) {
+		RecordBuffer utf8;
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			// FNV-1a of the UTF-8 generic path, so a file lands in the same shard on every platform.
+			utf8.Clear();
+			utf8.AppendUtf8(files[i]->GetPath().generic_wstring());
+			std::uint64_t hash = 0xCBF29CE484222325ull;
+			for (const unsigned char c : utf8.View()) {
+				hash ^= c;
+				hash *= 0x100000001B3ull;
+			}
+			shardOf[i] = static_cast<std::uint32_t>(hash % shardCount);
+		}
+		return shardOf;
+	}
+
+	// Group key per file, then the lines per group in first-seen order.
+	std::unordered_map<std::filesystem::path::string_type, std::size_t> dirGroups;
+	std::vector<std::size_t> groupOf(files.size());
+	std::vector<std::uint64_t> groupLines;
+	for (std::size_t i = 0; i < files.size(); ++i) {
+		std::size_t group = 0;
+		if (by == ShardBy::Module) {
+			group = moduleOf[i];
+		} else {
+			group = dirGroups.try_emplace(TopLevelDir(files[i]->GetPath(), baseDir), dirGroups.size()).first->second;
+		}
+		if (group >= groupLines.size())
+			groupLines.resize(group + 1, 0);
+		groupLines[group] += files[i]->GetLines().size();
+		groupOf[i] = group;
+	}
+
+	std::vector<std::uint64_t> shardLines(shardCount, 0);
+	std::vector<std::uint32_t> shardOfGroup(groupLines.size(), 0);
+	for (std::size_t group = 0; group < groupLines.size(); ++group) {
+		const auto lightest = std::ranges::min_element(shardLines) - shardLines.begin();
+		shardOfGroup[group] = static_cast<std::uint32_t>(lightest);
+		shardLines[lightest] += groupLines[group];
+	}
+	for (std::size_t i = 0; i < files.size(); ++i)
+		shardOf[i] = shardOfGroup[groupOf[i]];
+	return shardOf;
+}
+
+bool WriteShardManifest(const std::filesystem::path& manifestPath, ShardBy by, const std::vector<ShardSummary>& shards) {
+	RecordBuffer json;
+	json.Append("{\n  \"version\": 1,\n  \"shardBy\": \"");
+	json.Append(ShardByName(by));
+	json.Append("\",\n  \"shards\": [\n");
+	for (std::size_t i = 0; i < shards.size(); ++i) {
+		RecordBuffer name;
+		name.AppendUtf8(shards[i].path.filename().wstring());
+		json.Append("    {\"path\": ");
+		json.AppendJsonString(name.View());
+		json.Append(", \"files\": ");
+		json.AppendUInt(shards[i].files);
+		json.Append(", \"bytes\": ");
+		json.AppendUInt(shards[i].bytes);
+		json.Append(shards[i].written ? ", \"written\": true}" : ", \"written\": false}");
+		json.Append(i + 1 < shards.size() ? ",\n" : "\n");
+	}
+	json.Append("  ]\n}\n");
+
+	std::ofstream ofs(manifestPath, std::ios::binary | std::ios::trunc);
+	ofs.write(json.Data(), static_cast<std::streamsize>(json.Size()));
+	return static_cast<bool>(ofs);
+}
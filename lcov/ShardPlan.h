@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "Plugin/Exporter/FileCoverage.hpp"
+
+// One written shard, as listed in the manifest.
+struct ShardSummary {
+	std::filesystem::path path;
+	// Records written to the shard (excluded files are not counted)
+	std::uint64_t files = 0;
+	std::uint64_t bytes = 0;
+	bool written = false;
+};
+
+// Output of shard `index`: "coverage.info" -> "coverage.3.info", "coverage.info.gz" -> "coverage.3.info.gz",
+// "cov.v2.info" -> "cov.v2.3.info", "coverage" -> "coverage.3".
+LCOV_API std::filesystem::path ShardPath(const std::filesystem::path& outputPath, std::size_t index);
+// Manifest written next to the shards: "<output>.shards.json".
+LCOV_API std::filesystem::path ShardManifestPath(const std::filesystem::path& outputPath);
+
+/**
+ * Assigns each file to one of shardCount shards; returns the shard of every file.
+ *
+ * Module and Directory keep a module (or a top-level directory under baseDir) together and hand the groups, in the
+ * order they are first seen, to the shard with the fewest lines so far. Hash spreads files by a hash of their path,
+ * which keeps a file in the same shard from one export to the next.
+ *
+ * @param moduleOf Index of each file's module
+ */
+LCOV_API std::vector<std::uint32_t> AssignShards(const std::vector<const Plugin::FileCoverage*>& files,
+                                                 const std::vector<std::size_t>& moduleOf, ShardBy by,
+                                                 std::size_t shardCount, const std::filesystem::path& baseDir);
+
+// Writes the manifest: shard file names (relative to the manifest), file counts and sizes.
+LCOV_API bool WriteShardManifest(const std::filesystem::path& manifestPath, ShardBy by,
+                                 const std::vector<ShardSummary>& shards);
@@ -0,0 +1,479 @@
+#include "pch.h"
+#include "TestIndex.h"
+
+#include "RecordWriter.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <thread>
+
+#if !defined(_WIN32)
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <sys/file.h>
+#  include <unistd.h>
+#endif
+
+namespace {
+	constexpr std::string_view Magic = "covlcovT";
+	constexpr std::uint32_t Version = 1;
+
+	void AppendVarint(RecordBuffer& out, std::uint64_t value) {
+		while (value >= 0x80) {
+			out.Append(static_cast<char>(value | 0x80));
+			value >>= 7;
+		}
+		out.Append(static_cast<char>(value));
+	}
+
+	bool ReadVarint(std::string_view& in, std::uint64_t& value) {
+		value = 0;
+		for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7) {
+			const auto byte = static_cast<unsigned char>(in.front());
+			in.remove_prefix(1);
+			value |= std::uint64_t{byte & 0x7Fu} << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	// Reads a varint that must not exceed limit.
+	bool ReadCount(std::string_view& in, std::uint64_t& value, std::uint64_t limit) {
+		return ReadVarint(in, value) && value <= limit;
+	}
+
+	bool ReadBytes(std::string_view& in, std::string_view& bytes) {
+		std::uint64_t size = 0;
+		if (!ReadCount(in, size, in.size()))
+			return false;
+		bytes = in.substr(0, size);
+		in.remove_prefix(size);
+		return true;
+	}
+
+	std::uint64_t HashWords(const std::vector<std::uint64_t>& words) {
+		std::uint64_t hash = 0x9E3779B97F4A7C15ull ^ words.size();
+		for (const auto word : words) {
+			hash ^= word;
+			hash *= 0xBF58476D1CE4E5B9ull;
+			hash ^= hash >> 31;
+		}
+		return hash;
+	}
+
+	void Trim(std::vector<std::uint64_t>& words) {
+		while (!words.empty() && words.back() == 0)
+			words.pop_back();
+	}
+}
+
+bool TestIndex::Load(const std::filesystem::path& indexPath) {
+	Clear();
+
+	std::error_code ec;
+	const auto size = std::filesystem::file_size(indexPath, ec);
+	if (ec)
+		return false;
+	std::string bytes(static_cast<std::size_t>(size), '\0');
+	std::ifstream ifs(indexPath, std::ios::binary);
+	if (!ifs.read(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+		return false;
+
+	std::string_view in = bytes;
+	std::uint32_t version = 0;
+	if (!in.starts_with(Magic) || in.size() < Magic.size() + sizeof(version))
+		return false;
+	std::memcpy(&version, in.data() + Magic.size(), sizeof(version));
+	if (version != Version)
+		return false;
+	in.remove_prefix(Magic.size() + sizeof(version));
+
+	// Every count is bounded by the bytes left, so a corrupt count cannot make a huge allocation.
+	auto parse = [&] {
+		std::uint64_t count = 0;
+		if (!ReadCount(in, count, in.size()))
+			return false;
+		for (std::uint64_t i = 0; i < count; ++i) {
+			std::string_view name;
+			if (!ReadBytes(in, name))
+				return false;
+			testIds_.try_emplace(std::string(name), static_cast<std::uint32_t>(tests_.size()));
+			tests_.emplace_back(name);
+		}
+
+		// A set holds at most one bit per test, so all the runs of one set together fill at most this many words.
+		const std::uint64_t maxWords = (tests_.size() + 63) / 64;
+		if (!ReadCount(in, count, in.size()))
+			return false;
+		for (std::uint64_t i = 0; i < count; ++i) {
+			Words words;
+			std::uint64_t runs = 0;
+			if (!ReadCount(in, runs, in.size()))
+				return false;
+			for (std::uint64_t run = 0; run < runs; ++run) {
+				std::uint64_t zeros = 0;
+				std::uint64_t literals = 0;
+				if (!ReadCount(in, zeros, maxWords - words.size()) ||
+				    !ReadCount(in, literals, std::min<std::uint64_t>(in.size() / sizeof(std::uint64_t), maxWords - words.size() - zeros)))
+					return false;
+				words.resize(words.size() + zeros, 0);
+				for (std::uint64_t w = 0; w < literals; ++w) {
+					std::uint64_t word = 0;
+					std::memcpy(&word, in.data(), sizeof(word));
+					in.remove_prefix(sizeof(word));
+					words.push_back(word);
+				}
+			}
+			Trim(words);
+			if (words.size() * 64 > tests_.size() + 63)
+				return false;
+			setsByHash_.emplace(HashWords(words), static_cast<std::uint32_t>(sets_.size()));
+			sets_.push_back(std::move(words));
+		}
+
+		if (!ReadCount(in, count, in.size()))
+			return false;
+		for (std::uint64_t i = 0; i < count; ++i) {
+			std::string_view path;
+			std::uint64_t lineCount = 0;
+			if (!ReadBytes(in, path) || !ReadCount(in, lineCount, in.size()))
+				return false;
+			auto& lines = files_[std::string(path)];
+			lines.reserve(lines.size() + lineCount);
+			std::uint64_t line = 0;
+			for (std::uint64_t l = 0; l < lineCount; ++l) {
+				std::uint64_t delta = 0;
+				std::uint64_t set = 0;
+				if (!ReadVarint(in, delta) || !ReadVarint(in, set) || set >= sets_.size() || (l != 0 && delta == 0))
+					return false;
+				line += delta;
+				if (line > UINT32_MAX)
+					return false;
+				lines.push_back({static_cast<std::uint32_t>(line), static_cast<std::uint32_t>(set)});
+			}
+		}
+		return in.empty();
+	};
+	if (!parse()) {
+		Clear();
+		return false;
+	}
+	return true;
+}
+
+bool TestIndex::Write(const std::filesystem::path& indexPath) const {
+	// Sets no line refers to any more (left behind by Record) are dropped; the rest are numbered by first use.
+	constexpr auto Unused = static_cast<std::uint32_t>(-1);
+	std::vector<std::uint32_t> renumbered(sets_.size(), Unused);
+	std::vector<std::uint32_t> used;
+	for (const auto& [path, lines] : files_) {
+		for (const auto& line : lines) {
+			if (renumbered[line.set] == Unused) {
+				renumbered[line.set] = static_cast<std::uint32_t>(used.size());
+				used.push_back(line.set);
+			}
+		}
+	}
+
+	RecordBuffer out;
+	out.Append(Magic);
+	char version[sizeof(Version)];
+	std::memcpy(version, &Version, sizeof(Version));
+	out.Append(std::string_view(version, sizeof(version)));
+
+	AppendVarint(out, tests_.size());
+	for (const auto& name : tests_) {
+		AppendVarint(out, name.size());
+		out.Append(name);
+	}
+
+	AppendVarint(out, used.size());
+	std::vector<std::pair<std::size_t, std::size_t>> runs;
+	for (const auto set : used) {
+		const auto& words = sets_[set];
+		// Runs of zero words followed by the nonzero words after them.
+		runs.clear();
+		for (std::size_t w = 0; w < words.size();) {
+			const auto zerosBegin = w;
+			while (w < words.size() && words[w] == 0)
+				++w;
+			const auto literalsBegin = w;
+			while (w < words.size() && words[w] != 0)
+				++w;
+			runs.emplace_back(literalsBegin - zerosBegin, w - literalsBegin);
+		}
+		AppendVarint(out, runs.size());
+		std::size_t w = 0;
+		for (const auto& [zeros, literals] : runs) {
+			AppendVarint(out, zeros);
+			AppendVarint(out, literals);
+			w += zeros;
+			for (std::size_t i = 0; i < literals; ++i, ++w) {
+				char word[sizeof(std::uint64_t)];
+				std::memcpy(word, &words[w], sizeof(word));
+				out.Append(std::string_view(word, sizeof(word)));
+			}
+		}
+	}
+
+	AppendVarint(out, files_.size());
+	for (const auto& [path, lines] : files_) {
+		AppendVarint(out, path.size());
+		out.Append(path);
+		AppendVarint(out, lines.size());
+		std::uint32_t previous = 0;
+		for (const auto& line : lines) {
+			AppendVarint(out, line.line - previous);
+			AppendVarint(out, renumbered[line.set]);
+			previous = line.line;
+		}
+	}
+
+	// A name of its own, so a writer that does not hold the lock cannot truncate another one's temporary file.
+#if defined(_WIN32)
+	const auto processId = static_cast<std::uint64_t>(GetCurrentProcessId());
+#else
+	const auto processId = static_cast<std::uint64_t>(getpid());
+#endif
+	auto tempPath = indexPath;
+	tempPath += L"." + std::to_wstring(processId) + L"." +
+	            std::to_wstring(std::hash<std::thread::id>{}(std::this_thread::get_id())) + L".tmp";
+	{
+		std::ofstream ofs(tempPath, std::ios::binary | std::ios::trunc);
+		ofs.write(out.Data(), static_cast<std::streamsize>(out.Size()));
+		if (!ofs) {
+			ofs.close();
+			std::error_code ec;
+			std::filesystem::remove(tempPath, ec);
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tempPath, indexPath, ec);
+	if (ec) {
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
+
+void TestIndex::Record(std::string_view testName, std::vector<TestedFile> files) {
+	const auto [known, added] = testIds_.try_emplace(std::string(testName), static_cast<std::uint32_t>(tests_.size()));
+	const auto test = known->second;
+	const auto word = test / 64;
+	const auto bit = std::uint64_t{1} << (test % 64);
+	if (added) {
+		tests_.emplace_back(testName);
+	} else {
+		// A rerun replaces what the test executed before.
+		RemapSets([&](const Words& words) {
+			auto without = words;
+			if (word < without.size())
+				without[word] &= ~bit;
+			Trim(without);
+			return without;
+		});
+	}
+
+	// One record per path, with the union of its lines.
+	std::ranges::sort(files, {}, &TestedFile::sfPath);
+	for (std::size_t i = 0, next = 0; i < files.size(); i = next) {
+		auto& file = files[i];
+		for (next = i + 1; next < files.size() && files[next].sfPath == file.sfPath; ++next)
+			file.lines.insert(file.lines.end(), files[next].lines.begin(), files[next].lines.end());
+		std::ranges::sort(file.lines);
+		const auto [unique, end] = std::ranges::unique(file.lines);
+		file.lines.erase(unique, end);
+	}
+
+	Words single(word + 1, 0);
+	single[word] = bit;
+	const auto singleSet = Intern(std::move(single));
+	std::unordered_map<std::uint32_t, std::uint32_t> withTest;
+	std::vector<LineTests> merged;
+	for (std::size_t i = 0; i < files.size(); ++i) {
+		if (files[i].lines.empty() || (i != 0 && files[i].sfPath == files[i - 1].sfPath))
+			continue;
+		auto& lines = files_[files[i].sfPath];
+		merged.clear();
+		merged.reserve(lines.size() + files[i].lines.size());
+		auto known = lines.begin();
+		for (const auto line : files[i].lines) {
+			for (; known != lines.end() && known->line < line; ++known)
+				merged.push_back(*known);
+			if (known == lines.end() || known->line != line) {
+				merged.push_back({line, singleSet});
+				continue;
+			}
+			auto [it, first] = withTest.try_emplace(known->set, 0);
+			if (first) {
+				auto words = sets_[known->set];
+				words.resize(std::max(words.size(), std::size_t{word} + 1), 0);
+				words[word] |= bit;
+				it->second = Intern(std::move(words));
+			}
+			merged.push_back({line, it->second});
+			++known;
+		}
+		merged.insert(merged.end(), known, lines.end());
+		lines.swap(merged);
+	}
+}
+
+TestIndex::Impact TestIndex::Affected(const PatchCoverage& changes) const {
+	Impact impact;
+	const auto& changed = changes.ChangedFiles();
+	// Indexed files each changed file matches, exactly or by a path suffix
+	std::vector<std::vector<const std::vector<LineTests>*>> exact(changed.size());
+	std::vector<std::vector<const std::vector<LineTests>*>> suffix(changed.size());
+	for (const auto& [path, lines] : files_) {
+		const auto match = changes.Match(path);
+		if (match.file != PatchCoverage::NoFile)
+			(match.exact ? exact : suffix)[match.file].push_back(&lines);
+	}
+
+	Words tests;
+	for (std::size_t i = 0; i < changed.size(); ++i) {
+		const auto& matches = exact[i].empty() ? suffix[i] : exact[i];
+		if (matches.empty()) {
+			impact.unknownFiles.push_back(changed[i].first);
+			continue;
+		}
+		// Over-selecting is safe: the tests of every file a suffix matches are run.
+		if (exact[i].empty() && matches.size() > 1)
+			impact.ambiguousFiles.push_back(changed[i].first);
+		for (const auto* lines : matches) {
+			auto line = lines->begin();
+			for (const auto& interval : changed[i].second) {
+				line = std::lower_bound(line, lines->end(), interval.first, [](const LineTests& l, std::uint32_t n) { return l.line < n; });
+				for (; line != lines->end() && line->line <= interval.last; ++line) {
+					const auto& words = sets_[line->set];
+					if (tests.size() < words.size())
+						tests.resize(words.size(), 0);
+					for (std::size_t w = 0; w < words.size(); ++w)
+						tests[w] |= words[w];
+				}
+			}
+		}
+	}
+
+	for (std::size_t w = 0; w < tests.size(); ++w) {
+		for (auto bits = tests[w]; bits != 0; bits &= bits - 1)
+			impact.tests.push_back(static_cast<std::uint32_t>(w * 64 + std::countr_zero(bits)));
+	}
+	return impact;
+}
+
+std::vector<std::uint64_t> TestIndex::LinesPerTest() const {
+	// Lines per set first, so each set's bits are walked once.
+	std::vector<std::uint64_t> linesPerSet(sets_.size(), 0);
+	for (const auto& [path, lines] : files_) {
+		for (const auto& line : lines)
+			++linesPerSet[line.set];
+	}
+	std::vector<std::uint64_t> counts(tests_.size(), 0);
+	for (std::size_t set = 0; set < sets_.size(); ++set) {
+		if (linesPerSet[set] == 0)
+			continue;
+		const auto& words = sets_[set];
+		for (std::size_t w = 0; w < words.size(); ++w) {
+			for (auto bits = words[w]; bits != 0; bits &= bits - 1)
+				counts[w * 64 + std::countr_zero(bits)] += linesPerSet[set];
+		}
+	}
+	return counts;
+}
+
+std::uint32_t TestIndex::Intern(Words words) {
+	const auto hash = HashWords(words);
+	const auto [first, last] = setsByHash_.equal_range(hash);
+	for (auto it = first; it != last; ++it) {
+		if (sets_[it->second] == words)
+			return it->second;
+	}
+	const auto id = static_cast<std::uint32_t>(sets_.size());
+	sets_.push_back(std::move(words));
+	setsByHash_.emplace(hash, id);
+	return id;
+}
+
+void TestIndex::RemapSets(const std::function<Words(const Words&)>& change) {
+	constexpr auto Unmapped = static_cast<std::uint32_t>(-1);
+	constexpr auto Empty = static_cast<std::uint32_t>(-2);
+	std::vector<std::uint32_t> mapped(sets_.size(), Unmapped);
+	for (auto file = files_.begin(); file != files_.end();) {
+		auto& lines = file->second;
+		for (auto& line : lines) {
+			if (mapped[line.set] == Unmapped) {
+				auto words = change(sets_[line.set]);
+				mapped[line.set] = words.empty() ? Empty : Intern(std::move(words));
+			}
+			line.set = mapped[line.set];
+		}
+		std::erase_if(lines, [](const LineTests& line) { return line.set == Empty; });
+		file = lines.empty() ? files_.erase(file) : std::next(file);
+	}
+}
+
+void TestIndex::Clear() {
+	tests_.clear();
+	testIds_.clear();
+	sets_.clear();
+	setsByHash_.clear();
+	files_.clear();
+}
+
+#if defined(_WIN32)
+
+TestIndexLock::TestIndexLock(const std::filesystem::path& indexPath) {
+	auto lockPath = indexPath;
+	lockPath += L".lock";
+	const HANDLE file = CreateFileW(lockPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+	                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS,
+	                                FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	file_ = file;
+	OVERLAPPED whole{};
+	locked_ = LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &whole) != 0;
+}
+
+TestIndexLock::~TestIndexLock() {
+	if (file_ == nullptr)
+		return;
+	if (locked_) {
+		OVERLAPPED whole{};
+		UnlockFileEx(file_, 0, MAXDWORD, MAXDWORD, &whole);
+	}
+	CloseHandle(file_);
+}
+
+#else
+
+TestIndexLock::TestIndexLock(const std::filesystem::path& indexPath) {
+	auto lockPath = indexPath;
+	lockPath += ".lock";
+	fd_ = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd_ < 0)
+		return;
+	// flock locks belong to the open file, so threads with their own TestIndexLock exclude each other too.
+	int result;
+	while ((result = flock(fd_, LOCK_EX)) != 0 && errno == EINTR) {
+	}
+	locked_ = result == 0;
+}
+
+TestIndexLock::~TestIndexLock() {
+	if (fd_ < 0)
+		return;
+	if (locked_)
+		flock(fd_, LOCK_UN);
+	close(fd_);
+}
+
+#endif
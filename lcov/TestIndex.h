@@ -0,0 +1,113 @@
+#pragma once
+
+#include "LcovApi.h"
+#include "PatchCoverage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Executed lines of one report file in a test run, ascending.
+struct TestedFile {
+	std::string sfPath;
+	std::vector<std::uint32_t> lines;
+};
+
+/**
+ * Persistent map from source lines to the tests that executed them ("testIndex" in .covlcov), for test impact
+ * analysis: each export adds its run's executed lines under the run's test name, and lcovImpact picks the tests that
+ * executed any line a change touches.
+ *
+ * Every (SF path, line) maps to a set of test ids, held as a bitmap. Lines run by the same tests share one interned
+ * bitmap, so the index grows with the number of distinct test sets rather than lines x tests. Bitmaps are written
+ * with runs of zero words as counts, so a set of a few tests out of thousands takes a few bytes.
+ *
+ * Layout (varints are LEB128; words are little-endian u64):
+ *   header: "covlcovT" | u32 version
+ *   tests:  varint count | per test: varint size | name (UTF-8)
+ *   sets:   varint count | per set: varint run count | per run: varint zero words | varint literal words | words
+ *   files:  varint count | per file: varint size | SF path | varint line count | per line: varint line delta | varint set
+ */
+class LCOV_API TestIndex {
+public:
+	// Tests that executed a changed line, and the changed files the index knows nothing of.
+	struct Impact {
+		// Ids of the tests, ascending
+		std::vector<std::uint32_t> tests;
+		// Changed files no test executed a line of (new files, or files no indexed test reaches)
+		std::vector<std::string_view> unknownFiles;
+		// Changed files that only match several indexed files by a path suffix; the tests of all of them are picked
+		std::vector<std::string_view> ambiguousFiles;
+	};
+
+	// Loads an index. Leaves it empty and returns false when the file is missing or malformed.
+	bool Load(const std::filesystem::path& indexPath);
+	// Writes the index through a temporary file (named per process and thread), so an interrupted write leaves the
+	// previous index in place. Concurrent writers must hold a TestIndexLock.
+	bool Write(const std::filesystem::path& indexPath) const;
+
+	/**
+	 * Records a test run: testName's lines from an earlier run are replaced by these. A path listed more than once
+	 * (a file compiled into several modules) counts the union of its lines.
+	 */
+	void Record(std::string_view testName, std::vector<TestedFile> files);
+
+	// Tests to run for a change, with its files matched to SF paths by PatchCoverage::Match (see DiffSide::Old).
+	[[nodiscard]] Impact Affected(const PatchCoverage& changes) const;
+
+	[[nodiscard]] std::size_t TestCount() const noexcept { return tests_.size(); }
+	[[nodiscard]] std::string_view TestName(std::uint32_t test) const { return tests_[test]; }
+	// Number of lines each test executed, over all files, by test id
+	[[nodiscard]] std::vector<std::uint64_t> LinesPerTest() const;
+	[[nodiscard]] std::size_t FileCount() const noexcept { return files_.size(); }
+	[[nodiscard]] std::size_t SetCount() const noexcept { return sets_.size(); }
+
+private:
+	using Words = std::vector<std::uint64_t>;
+	struct LineTests {
+		std::uint32_t line = 0;
+		std::uint32_t set = 0;
+	};
+
+	// Id of the set with these words (no trailing zero words), adding it when new.
+	std::uint32_t Intern(Words words);
+	// Maps every line's set through change (memoized per set), dropping lines whose set becomes empty.
+	void RemapSets(const std::function<Words(const Words&)>& change);
+	void Clear();
+
+	std::vector<std::string> tests_;
+	std::unordered_map<std::string, std::uint32_t> testIds_;
+	std::vector<Words> sets_;
+	// Hash of a set's words -> ids of the sets with that hash
+	std::unordered_multimap<std::uint64_t, std::uint32_t> setsByHash_;
+	// SF path -> lines ascending, each with its set
+	std::map<std::string, std::vector<LineTests>, std::less<>> files_;
+};
+
+// Exclusive lock on "<index>.lock", held across TestIndex::Load, Record and Write so exports running in parallel
+// processes (or threads) update one index in turn instead of dropping each other's tests. The lock file is left in
+// place; deleting it would let a waiting writer lock a file the next one no longer sees.
+class LCOV_API TestIndexLock {
+public:
+	// Waits until the lock is taken; IsLocked() is false when the lock file cannot be opened or locked.
+	explicit TestIndexLock(const std::filesystem::path& indexPath);
+	~TestIndexLock();
+	TestIndexLock(const TestIndexLock&) = delete;
+	TestIndexLock& operator=(const TestIndexLock&) = delete;
+
+	[[nodiscard]] bool IsLocked() const noexcept { return locked_; }
+
+private:
+	bool locked_ = false;
+#if defined(_WIN32)
+	void* file_ = nullptr;
+#else
+	int fd_ = -1;
+#endif
+};
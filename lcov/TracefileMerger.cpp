@@ -0,0 +1,281 @@
+#include "pch.h"
+#include "TracefileMerger.h"
+
+#include "CoverageSnapshot.h"
+#include "GzipWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+struct TracefileMerger::Partition {
+	std::mutex mutex;
+	std::unordered_map<std::string, std::vector<LineHits>> files;
+};
+
+namespace {
+	bool ReadWholeFile(const std::filesystem::path& path, std::string& text) {
+		std::ifstream ifs(path, std::ios::binary);
+		if (!ifs)
+			return false;
+		std::error_code ec;
+		const auto size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return false;
+		text.resize(static_cast<std::size_t>(size));
+		ifs.read(text.data(), static_cast<std::streamsize>(text.size()));
+		return static_cast<std::size_t>(ifs.gcount()) == text.size();
+	}
+
+	template <typename T>
+	bool ParseNumber(std::string_view& text, T& value) {
+		const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+		if (ec != std::errc{})
+			return false;
+		text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+		return true;
+	}
+
+	// Sorts by line number and folds duplicate lines together.
+	void Normalize(std::vector<LineHits>& lines) {
+		std::ranges::stable_sort(lines, {}, &LineHits::line);
+		std::size_t out = 0;
+		for (std::size_t i = 0; i < lines.size(); ++i) {
+			if (out != 0 && lines[out - 1].line == lines[i].line)
+				lines[out - 1].hits += lines[i].hits;
+			else
+				lines[out++] = lines[i];
+		}
+		lines.resize(out);
+	}
+}
+
+TracefileMerger::TracefileMerger(unsigned threads)
+	: threads_(threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u)) {
+	const auto partitionCount = std::max(threads_ * 4, 16u);
+	partitions_.reserve(partitionCount);
+	for (unsigned i = 0; i < partitionCount; ++i)
+		partitions_.push_back(std::make_unique<Partition>());
+}
+
+TracefileMerger::~TracefileMerger() = default;
+
+void TracefileMerger::Parse(std::string_view text, const std::function<void(TracefileRecord&&)>& onRecord) {
+	TracefileRecord record;
+	bool inRecord = false;
+	bool sorted = true;
+
+	while (!text.empty()) {
+		const auto eol = text.find('\n');
+		auto line = text.substr(0, eol);
+		text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+
+		if (line.starts_with("DA:")) {
+			// DA:<line>,<hits>[,<checksum>]
+			line.remove_prefix(3);
+			LineHits entry;
+			if (!ParseNumber(line, entry.line) || line.empty() || line.front() != ',')
+				continue;
+			line.remove_prefix(1);
+			if (!ParseNumber(line, entry.hits))
+				continue;
+			if (!record.lines.empty() && record.lines.back().line >= entry.line)
+				sorted = false;
+			record.lines.push_back(entry);
+		} else if (line.starts_with("SF:")) {
+			record.sourceFile.assign(line.substr(3));
+			record.lines.clear();
+			inRecord = true;
+			sorted = true;
+		} else if (line == "end_of_record") {
+			if (inRecord) {
+				if (!sorted)
+					Normalize(record.lines);
+				onRecord(std::move(record));
+				record = {};
+			}
+			inRecord = false;
+		}
+	}
+}
+
+void TracefileMerger::MergeLines(std::vector<LineHits>& into, std::vector<LineHits>&& from) {
+	if (into.empty()) {
+		into = std::move(from);
+		return;
+	}
+
+	// Shards of the same build usually report the same lines for a file; add in place when they do.
+	if (into.size() == from.size() && std::ranges::equal(into, from, {}, &LineHits::line, &LineHits::line)) {
+		for (std::size_t i = 0; i < into.size(); ++i)
+			into[i].hits += from[i].hits;
+		return;
+	}
+
+	std::vector<LineHits> merged;
+	merged.reserve(into.size() + from.size());
+	auto a = into.begin();
+	auto b = from.begin();
+	while (a != into.end() && b != from.end()) {
+		if (a->line < b->line) {
+			merged.push_back(*a++);
+		} else if (b->line < a->line) {
+			merged.push_back(*b++);
+		} else {
+			merged.push_back({a->line, a->hits + b->hits});
+			++a;
+			++b;
+		}
+	}
+	merged.insert(merged.end(), a, into.end());
+	merged.insert(merged.end(), b, from.end());
+	into = std::move(merged);
+}
+
+std::size_t TracefileMerger::AddText(std::string_view text) {
+	std::vector<std::vector<TracefileRecord>> buckets(partitions_.size());
+	const std::hash<std::string_view> hash;
+	std::size_t records = 0;
+	Parse(text, [&](TracefileRecord&& record) {
+		buckets[hash(record.sourceFile) % buckets.size()].push_back(std::move(record));
+		++records;
+	});
+	AddRecords(buckets);
+	return records;
+}
+
+void TracefileMerger::AddSnapshot(const SnapshotReader& snapshot) {
+	std::vector<std::vector<TracefileRecord>> buckets(partitions_.size());
+	const std::hash<std::string_view> hash;
+	for (std::size_t i = 0; i < snapshot.FileCount(); ++i) {
+		TracefileRecord record{std::string(snapshot.SourceFile(i)), {}};
+		snapshot.ReadLines(i, record.lines);
+		if (!std::ranges::is_sorted(record.lines, {}, &LineHits::line))
+			Normalize(record.lines);
+		buckets[hash(record.sourceFile) % buckets.size()].push_back(std::move(record));
+	}
+	AddRecords(buckets);
+}
+
+void TracefileMerger::AddRecords(std::vector<std::vector<TracefileRecord>>& buckets) {
+	// Start at a per-thread offset so threads finishing together do not queue on the same partition.
+	const auto start = std::hash<std::thread::id>{}(std::this_thread::get_id()) % buckets.size();
+	for (std::size_t n = 0; n < buckets.size(); ++n) {
+		const auto p = (start + n) % buckets.size();
+		if (buckets[p].empty())
+			continue;
+
+		auto& partition = *partitions_[p];
+		std::lock_guard lock{partition.mutex};
+		for (auto& record : buckets[p]) {
+			auto [it, inserted] = partition.files.try_emplace(std::move(record.sourceFile));
+			MergeLines(it->second, std::move(record.lines));
+		}
+		buckets[p].clear();
+	}
+}
+
+bool TracefileMerger::AddFiles(const std::vector<std::filesystem::path>& inputs) {
+	std::atomic<std::size_t> next{0};
+	std::mutex logMutex;
+	bool ok = true;
+
+	auto worker = [&] {
+		std::string text;
+		std::string compressed;
+		for (std::size_t i; (i = next++) < inputs.size();) {
+			if (inputs[i].extension() == L".snap") {
+				SnapshotReader snapshot;
+				if (snapshot.Open(inputs[i])) {
+					AddSnapshot(snapshot);
+				} else {
+					std::lock_guard lock{logMutex};
+					Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot read coverage snapshot: " + inputs[i].string());
+					ok = false;
+				}
+				continue;
+			}
+			const bool read = IsGzipPath(inputs[i]) ? ReadWholeFile(inputs[i], compressed) && Gunzip(compressed, text)
+				: ReadWholeFile(inputs[i], text);
+			if (!read) {
+				std::lock_guard lock{logMutex};
+				Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot read tracefile: " + inputs[i].string());
+				ok = false;
+				continue;
+			}
+			// Anything that is not a tracefile parses to nothing; say so instead of merging it silently.
+			if (AddText(text) == 0) {
+				std::lock_guard lock{logMutex};
+				Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "No SF records in tracefile: " + inputs[i].string());
+				ok = false;
+			}
+		}
+	};
+
+	const auto threadCount = static_cast<unsigned>(std::min<std::size_t>(threads_, inputs.size()));
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threadCount; ++i)
+		workers.emplace_back(worker);
+	worker();
+	for (auto& thread : workers)
+		thread.join();
+
+	return ok;
+}
+
+std::size_t TracefileMerger::SourceFileCount() const {
+	std::size_t count = 0;
+	for (const auto& partition : partitions_)
+		count += partition->files.size();
+	return count;
+}
+
+std::vector<const TracefileMerger::Entry*> TracefileMerger::SortedEntries() const {
+	std::vector<const Entry*> entries;
+	entries.reserve(SourceFileCount());
+	for (const auto& partition : partitions_) {
+		for (const auto& entry : partition->files)
+			entries.push_back(&entry);
+	}
+	std::ranges::sort(entries, {}, [](const auto* entry) -> const std::string& { return entry->first; });
+	return entries;
+}
+
+bool TracefileMerger::Write(const std::filesystem::path& outputPath) {
+	const auto entries = SortedEntries();
+	if (outputPath.extension() == L".snap") {
+		SnapshotWriter snapshot;
+		RecordBuffer encoded;
+		for (const auto* entry : entries) {
+			encoded.Clear();
+			SnapshotWriter::EncodeFile(encoded, entry->first, entry->second);
+			snapshot.AddEncoded(encoded.View());
+		}
+		if (!snapshot.Write(outputPath)) {
+			Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot write coverage snapshot: " + outputPath.string());
+			return false;
+		}
+		return true;
+	}
+
+	RecordWriter writer{outputPath, OutputOptions{IsGzipPath(outputPath), 6, threads_, true}};
+	if (!writer.IsOpen()) {
+		Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Cannot create the merged tracefile: " + outputPath.string());
+		return false;
+	}
+	for (const auto* entry : entries) {
+		RenderFileRecord(writer.Buffer(), entry->first, entry->second);
+		writer.FlushIfFull();
+	}
+	if (!writer.Finish()) {
+		Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "Failed writing the merged tracefile: " + outputPath.string());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+#include "RecordWriter.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class SnapshotReader;
+
+// One "SF: ... end_of_record" block read from a tracefile. Lines are sorted by line number and unique.
+struct TracefileRecord {
+	std::string sourceFile; // UTF-8, exactly as written after "SF:"
+	std::vector<LineHits> lines;
+};
+
+/**
+ * Merges LCOV tracefiles written by LCOVExporter::Export (e.g. one per sharded test run) into one report.
+ *
+ * Inputs are parsed in parallel. Each parsed record is routed to a partition by a hash of its SF path, and partitions
+ * are reduced independently under their own lock, so threads only contend when they touch the same partition. DA hit
+ * counts are summed per line (as "lcov -a" does) and LF/LH are recomputed on output.
+ */
+class LCOV_API TracefileMerger {
+public:
+	// threads: number of parser threads; 0 uses one per hardware thread.
+	explicit TracefileMerger(unsigned threads = 0);
+	~TracefileMerger();
+	TracefileMerger(const TracefileMerger&) = delete;
+	TracefileMerger& operator=(const TracefileMerger&) = delete;
+
+	// Parses and merges the given tracefiles (*.snap inputs are read as coverage snapshots, *.gz inputs are inflated).
+	// Returns false if any input could not be read or holds no records; details go to Log.
+	bool AddFiles(const std::vector<std::filesystem::path>& inputs);
+	// Merges records from tracefile text already in memory. Returns the number of records merged.
+	std::size_t AddText(std::string_view text);
+	// Merges every file of a coverage snapshot; an executed line counts as one hit.
+	void AddSnapshot(const SnapshotReader& snapshot);
+
+	// Writes the merged report, ordered by SF path; as a coverage snapshot when the output ends in .snap.
+	bool Write(const std::filesystem::path& outputPath);
+
+	[[nodiscard]] std::size_t SourceFileCount() const;
+
+	// Calls onRecord for each complete record in the text. Unknown lines (FN:, BRDA:, ...) are ignored.
+	static void Parse(std::string_view text, const std::function<void(TracefileRecord&&)>& onRecord);
+	// Sums hit counts of `from` into `into`; both must be sorted by line number.
+	static void MergeLines(std::vector<LineHits>& into, std::vector<LineHits>&& from);
+
+	ExporterConfigLog Log;
+
+private:
+	struct Partition;
+	using Entry = std::pair<const std::string, std::vector<LineHits>>;
+
+	void AddRecords(std::vector<std::vector<TracefileRecord>>& buckets);
+	[[nodiscard]] std::vector<const Entry*> SortedEntries() const;
+
+	unsigned threads_;
+	std::vector<std::unique_ptr<Partition>> partitions_;
+};
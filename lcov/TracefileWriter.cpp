@@ -0,0 +1,809 @@
+#include "pch.h"
+#include "TracefileWriter.h"
+
+#include "Plugin/Exporter/CoverageData.hpp"
+#include "Plugin/Exporter/ModuleCoverage.hpp"
+#include "Plugin/Exporter/FileCoverage.hpp"
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory_resource>
+#include <numeric>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ConfigTree.h"
+#include "CoverageGate.h"
+#include "CoverageSnapshot.h"
+#include "ExportSession.h"
+#include "ExportStats.h"
+#include "GzipWriter.h"
+#include "LineBitmap.h"
+#include "MappedFile.h"
+#include "ParallelRenderer.h"
+#include "PatchCoverage.h"
+#include "RecordCache.h"
+#include "RecordWriter.h"
+#include "RenderedChunk.h"
+#include "ReportIndex.h"
+#include "ReportSummary.h"
+#include "ShardPlan.h"
+#include "TestIndex.h"
+
+namespace {
+	// SF path of a record rendered by RenderFileRecord ("TN:\nSF:<path>\n...", or "SF:<path>\n..." without "TN:").
+	std::string_view RecordSFPath(std::string_view record) {
+		if (record.starts_with("TN:\n"))
+			record.remove_prefix(std::string_view("TN:\n").size());
+		record.remove_prefix(std::string_view("SF:").size());
+		return record.substr(0, record.find('\n'));
+	}
+
+	// Counts an excluded file against its directory. Consecutive files in one directory share an entry, so the
+	// directory string is only copied when it changes.
+	void CountExclusion(RenderedChunk& chunk, const std::filesystem::path& path) {
+		using View = std::basic_string_view<std::filesystem::path::value_type>;
+		const View native = path.native();
+#if defined(_WIN32)
+		const auto separator = native.find_last_of(L"\\/");
+#else
+		const auto separator = native.find_last_of('/');
+#endif
+		const auto dir = native.substr(0, separator == View::npos ? 0 : separator);
+		if (chunk.excludedDirs.empty() || chunk.excludedDirs.back().first != dir)
+			chunk.excludedDirs.emplace_back(dir, 0);
+		++chunk.excludedDirs.back().second;
+	}
+
+	// Shown at info level; every directory is listed at debug level.
+	constexpr std::size_t SummarizedDirs = 10;
+}
+
+// The report being written. Everything past the output file is set up by Start, once the first module arrives.
+struct TracefileWriter::Report {
+	Report(ExporterConfig& config, const std::filesystem::path& path, const std::optional<std::filesystem::path>& diff, Input in);
+
+	void Start();
+	void AddFile(const Plugin::FileCoverage& file);
+	void EndModule();
+	std::optional<std::filesystem::path> Finish();
+
+	const std::vector<Plugin::LineCoverage>& LinesOf(const Plugin::FileCoverage* file, std::vector<Plugin::LineCoverage>& scratch) const;
+	void RenderChunk(std::size_t begin, std::size_t end, RenderedChunk& chunk);
+	std::vector<std::uint64_t> LayoutRecords(std::size_t begin, std::size_t end);
+	void WriteChunk(RenderedChunk& chunk);
+	void MergeDuplicates();
+	std::vector<std::size_t> PlanShards();
+	void WriteShards(const std::vector<std::size_t>& shardEnds);
+	void CloseReportFile(const std::filesystem::path& path, std::size_t firstRecord);
+
+	ExporterConfig& cfg;
+	const std::chrono::steady_clock::time_point exportStart = std::chrono::steady_clock::now();
+	const std::filesystem::path outputPath;
+	const std::optional<std::filesystem::path> argumentDiff;
+	const Input input;
+	// A ".gz" output is compressed block by block on cfg.Threads() workers, off the rendering thread; a plain one is
+	// written by a background thread with asyncWrite.
+	const OutputOptions output;
+	const bool sharded;
+	const bool preallocate;
+	// Renders every module, layout and shard of the report on one set of workers
+	ParallelRenderer renderer;
+	// Whether records are only rendered at Finish, once every file is known
+	bool deferred = false;
+	bool started = false;
+	// Set once the report is finished, or when it could not be started
+	std::optional<std::optional<std::filesystem::path>> result;
+	// Set by Finish when a coverage threshold was not met
+	bool gateFailed = false;
+	// With shards, each shard file is opened when its turn comes; a single report is opened up front so it exists even
+	// when there is nothing to export.
+	std::optional<RecordWriter> writer;
+
+	// Phase timers and counters; everything below skips them when stats is null.
+	ExportStats exportStats;
+	ExportStats* stats = nullptr;
+	// Per-file temporaries are carved out of the session's arenas and all freed with the report.
+	std::optional<ExportSession> session;
+	// Classifies each file by the root .covlcov, or by the nearest one above it with nestedConfigs.
+	std::optional<ConfigTree> resolver;
+	OutputProfile profile = OutputProfile::Full;
+
+	// Files not written yet: the current module's, or every module's when deferred
+	std::vector<const Plugin::FileCoverage*> files;
+	std::vector<std::size_t> moduleOf;
+	std::size_t moduleIndex = 0;
+	std::size_t fileCount = 0;
+	// Copies of streamed files kept for Finish when deferred
+	std::optional<Plugin::CoverageData> copies;
+	Plugin::ModuleCoverage* copyModule = nullptr;
+	// Between BeginModule and EndModule; files added outside a module are skipped.
+	bool moduleOpen = false;
+	std::size_t filesOutsideModule = 0;
+	// With mergeDuplicates, the union of the lines of every copy of a shared file, keyed on its first copy.
+	std::unordered_map<const Plugin::FileCoverage*, LineBitmap> mergedLines;
+
+	// Incremental export: files whose line/executed vector is unchanged since the last export reuse their cached record.
+	bool incremental = false;
+	std::filesystem::path cachePath;
+	std::filesystem::path cacheTempPath;
+	RecordCache cache;
+	std::optional<RecordWriter> cacheWriter;
+	std::atomic<std::size_t> reused{0};
+
+	bool snapshot = false;
+	SnapshotWriter snapshotWriter;
+
+	std::optional<std::filesystem::path> patchDiff;
+	std::optional<PatchCoverage> patch;
+	std::optional<RecordWriter> patchWriter;
+	RecordBuffer patchFiles;
+
+	// Summary sidecar: LF/LH and the byte range of every record, collected as the records are written. The seekable
+	// index of each report file is built from the same ranges.
+	bool index = false;
+	std::optional<ReportSummary> summary;
+	// Coverage thresholds are checked on the same per-file totals, in report order, as chunks reach the sink.
+	std::optional<CoverageGate> gate;
+	bool summarizing = false;
+
+	// Test index: the executed lines of every included file, added to the index under testName at Finish.
+	std::optional<std::filesystem::path> testIndexPath;
+	std::string testName;
+	std::vector<TestedFile> testedFiles;
+
+	std::map<std::filesystem::path::string_type, std::uint64_t> excludedByDir;
+	std::uint32_t currentShard = 0;
+	std::uint64_t reportOffset = 0;
+	// Preallocated output: the file is sized exactly and mapped, and workers copy each chunk to its own offset.
+	std::optional<MappedOutputFile> mapped;
+	std::vector<std::uint64_t> recordOffsets;
+	// Set when a chunk's size differs from its layout; reset for each mapped shard so one bad shard fails only itself.
+	std::atomic<bool> sizeMismatch{false};
+	bool written = true;
+	std::vector<ShardSummary> shardSummaries;
+};
+
+TracefileWriter::Report::Report(ExporterConfig& config, const std::filesystem::path& path,
+                                const std::optional<std::filesystem::path>& diff, Input in)
+	: cfg(config), outputPath(path), argumentDiff(diff), input(in),
+	  output{IsGzipPath(path), config.CompressionLevel(), config.Threads(), config.AsyncWrite()},
+	  sharded(config.Shards() > 1), preallocate(config.Preallocate() && !output.gzip), renderer(config.Threads()) {
+	if (!sharded)
+		writer.emplace(outputPath, output);
+	if (writer && !writer->IsOpen()) {
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error,
+		               "LCOV Exporter: Cannot create the output file for LCOV export: " +
+		               outputPath.string());
+		cfg.Log.LogMessages();
+		result.emplace(std::nullopt);
+		return;
+	}
+
+	if (cfg.Log.HasErrors()) {
+		cfg.Log.LogMessages();
+		writer.reset();
+		result.emplace(outputPath);
+	}
+}
+
+void TracefileWriter::Report::Start() {
+	started = true;
+	if (cfg.GetResolvedBaseDir() != std::filesystem::path{}) {
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Base directory resolved to: " + cfg.GetResolvedBaseDir().string());
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Only files within base directory will be included in report");
+	}
+
+	if (cfg.Stats()) {
+		stats = &exportStats;
+		stats->threads = cfg.Threads();
+		stats->AddTime(ExportStats::Phase::ConfigDiscovery, cfg.DiscoveryTime());
+		stats->AddTime(ExportStats::Phase::ConfigParse, cfg.ParseTime());
+	}
+
+	session.emplace();
+	{
+		ScopedPhaseTimer timer{stats, ExportStats::Phase::BaseDirResolve};
+		resolver.emplace(cfg);
+	}
+
+	// Shards, preallocation and merged duplicates place records by looking at every file first.
+	deferred = input == Input::Retained || sharded || preallocate || cfg.MergeDuplicates();
+	if (deferred && input == Input::Streamed) {
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "shards, preallocate and mergeDuplicates need every file before the first record; "
+		               "modules are kept in memory until the report is finished");
+		copies.emplace(L"", 0);
+	}
+
+	incremental = cfg.Incremental();
+	cachePath = RecordCache::SidecarPath(outputPath);
+	cacheTempPath = cachePath;
+	cacheTempPath += L".tmp";
+	if (incremental) {
+		cache.Load(cachePath, cfg.Fingerprint());
+		cacheWriter.emplace(cacheTempPath, OutputOptions{.async = cfg.AsyncWrite()});
+		if (cacheWriter->IsOpen())
+			RecordCache::AppendHeader(cacheWriter->Buffer(), cfg.Fingerprint());
+	}
+
+	profile = cfg.Profile();
+	snapshot = cfg.Snapshot();
+
+	// Patch coverage: the argument's diff overrides .covlcov's patchDiff.
+	patchDiff = argumentDiff ? argumentDiff : cfg.PatchDiff();
+	if (patchDiff) {
+		patch.emplace();
+		if (!patch->LoadDiff(*patchDiff)) {
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Cannot read the diff for patch coverage: " + patchDiff->string());
+			patch.reset();
+		} else {
+			// Diff paths are relative to the project root, taken to be where .covlcov is.
+			const auto configPath = cfg.ConfigPath();
+			patch->MapPaths(cfg, configPath && configPath->has_parent_path() ? configPath->parent_path() : std::filesystem::current_path());
+			patchWriter.emplace(PatchCoverage::LcovPath(outputPath));
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Patch coverage: " + std::to_string(patch->ChangedFileCount()) + " files changed in " + patchDiff->string());
+		}
+	}
+
+	index = cfg.Index() && !output.gzip;
+	if (cfg.Index() && output.gzip)
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "No index is written for a compressed report: " + outputPath.string());
+	if (cfg.Summary() || index)
+		summary.emplace();
+	if (!cfg.Thresholds().Empty())
+		gate.emplace(cfg.Thresholds());
+	summarizing = summary || gate;
+	testIndexPath = cfg.TestIndexPath();
+}
+
+void TracefileWriter::Report::AddFile(const Plugin::FileCoverage& file) {
+	if (!moduleOpen) {
+		++filesOutsideModule;
+		return;
+	}
+	if (copies) {
+		auto& copy = copyModule->AddFile(file.GetPath());
+		for (const auto& line : file.GetLines())
+			copy.AddLine(line.GetLineNumber(), line.HasBeenExecuted());
+		files.push_back(&copy);
+	} else {
+		files.push_back(&file);
+	}
+	moduleOf.push_back(moduleIndex);
+}
+
+// Streamed files are written now, so nothing of the module is needed afterwards.
+void TracefileWriter::Report::EndModule() {
+	if (!moduleOpen)
+		return;
+	moduleOpen = false;
+	copyModule = nullptr;
+	++moduleIndex;
+	if (deferred)
+		return;
+	// Chunks may be rendered on worker threads, but they are written back in module/file order.
+	renderer.Run(files.size(), [&](std::size_t chunkBegin, std::size_t chunkEnd, RenderedChunk& chunk) {
+		RenderChunk(chunkBegin, chunkEnd, chunk);
+	}, [&](RenderedChunk& chunk) { WriteChunk(chunk); });
+	fileCount += files.size();
+	files.clear();
+	moduleOf.clear();
+}
+
+// Lines of a file, or the union of all its copies with mergeDuplicates (materialized into scratch).
+const std::vector<Plugin::LineCoverage>& TracefileWriter::Report::LinesOf(const Plugin::FileCoverage* file,
+                                                                         std::vector<Plugin::LineCoverage>& scratch) const {
+	if (mergedLines.empty())
+		return file->GetLines();
+	const auto merged = mergedLines.find(file);
+	if (merged == mergedLines.end())
+		return file->GetLines();
+	scratch = merged->second.Lines();
+	return scratch;
+}
+
+void TracefileWriter::Report::RenderChunk(std::size_t begin, std::size_t end, RenderedChunk& chunk) {
+	RecordBuffer key;
+	std::vector<Plugin::LineCoverage> unionLines;
+	const auto scratch = session->Borrow();
+	chunk.log.BufferFor(cfg.Log);
+	// Offsets are relative to the chunk until the sink places it in the report.
+	auto summarize = [&](std::size_t recordBegin, const std::vector<Plugin::LineCoverage>& lines) {
+		const auto record = chunk.records.View().substr(recordBegin);
+		const auto hit = std::ranges::count_if(lines, [](const auto& line) { return line.HasBeenExecuted(); });
+		chunk.summaries.push_back({std::string(RecordSFPath(record)), lines.size(), static_cast<std::uint64_t>(hit), recordBegin, record.size()});
+	};
+	auto collectTested = [&](std::string_view sfPathUtf8, const std::vector<Plugin::LineCoverage>& lines) {
+		TestedFile tested{std::string(sfPathUtf8), {}};
+		for (const auto& line : lines) {
+			if (line.HasBeenExecuted())
+				tested.lines.push_back(static_cast<std::uint32_t>(line.GetLineNumber()));
+		}
+		if (!tested.lines.empty())
+			chunk.testedFiles.push_back(std::move(tested));
+	};
+	std::uint64_t includedCount = 0;
+	std::uint64_t reusedCount = 0;
+	std::uint64_t lineCount = 0;
+	for (auto i = begin; i < end; ++i) {
+		// The previous file's temporaries are gone; start the arena over.
+		scratch->Rewind();
+		std::pmr::string sfPath{scratch->Resource()};
+		const auto& path = files[i]->GetPath();
+		const auto& lines = LinesOf(files[i], unionLines);
+
+		std::uint64_t linesHash = 0;
+		if (incremental) {
+			key.Clear();
+			key.AppendPathUtf8(path, false);
+			linesHash = RecordCache::HashLines(lines);
+			// A nested .covlcov is not part of cfg.Fingerprint(); tie the entry to the one governing this file.
+			if (resolver->Nested())
+				linesHash ^= resolver->FingerprintFor(path) * 0x9E3779B97F4A7C15ull;
+			if (const auto* cached = cache.Find(key.View(), linesHash)) {
+				if (cached->included) {
+					++includedCount;
+					lineCount += lines.size();
+					// The compact profiles cache an empty record for a file without lines.
+					if (!cached->record.empty()) {
+						const auto recordBegin = chunk.records.Size();
+						chunk.records.Append(cached->record);
+						++chunk.recordCount;
+						if (summarizing)
+							summarize(recordBegin, lines);
+						if (snapshot)
+							SnapshotWriter::EncodeFile(chunk.snapshotFiles, RecordSFPath(cached->record), lines);
+						if (patch)
+							patch->Measure(RecordSFPath(cached->record), lines, chunk.patchRecords, chunk.patchFiles);
+						if (testIndexPath)
+							collectTested(RecordSFPath(cached->record), lines);
+					}
+				} else {
+					CountExclusion(chunk, path);
+					chunk.log.AddMsg(ExporterConfigLog::MsgLevel::Debug, [&] { return "Excluding file from report. Not within configured include path: " + path.string(); });
+				}
+				RecordCache::AppendEntry(chunk.cacheEntries, key.View(), linesHash, cached->included, cached->record);
+				++reused;
+				++reusedCount;
+				continue;
+			}
+		}
+
+		const bool included = TimePhase(stats, ExportStats::Phase::Classify, [&] { return resolver->Classify(path, sfPath); });
+		const auto recordBegin = chunk.records.Size();
+		if (included) {
+			ScopedPhaseTimer timer{stats, ExportStats::Phase::Render};
+			++includedCount;
+			lineCount += lines.size();
+			RenderFileRecord(chunk.records, std::string_view{sfPath}, lines, profile);
+			// The compact profiles write nothing for a file without lines.
+			if (chunk.records.Size() != recordBegin) {
+				++chunk.recordCount;
+				if (snapshot)
+					SnapshotWriter::EncodeFile(chunk.snapshotFiles, RecordSFPath(chunk.records.View().substr(recordBegin)), lines);
+				if (patch)
+					patch->Measure(RecordSFPath(chunk.records.View().substr(recordBegin)), lines, chunk.patchRecords, chunk.patchFiles);
+				if (summarizing)
+					summarize(recordBegin, lines);
+				if (testIndexPath)
+					collectTested(std::string_view{sfPath}, lines);
+			}
+		} else {
+			CountExclusion(chunk, path);
+			chunk.log.AddMsg(ExporterConfigLog::MsgLevel::Debug, [&] { return "Excluding file from report. Not within configured include path: " + path.string(); });
+		}
+		if (incremental)
+			RecordCache::AppendEntry(chunk.cacheEntries, key.View(), linesHash, included, chunk.records.View().substr(recordBegin));
+	}
+	if (stats) {
+		stats->filesSeen += end - begin;
+		stats->filesIncluded += includedCount;
+		stats->filesExcluded += (end - begin) - includedCount;
+		stats->recordsReused += reusedCount;
+		stats->linesWritten += lineCount;
+	}
+}
+
+// Offsets of each file's record in [begin, end) relative to the first, plus the total at the end; excluded files
+// take no space. Sizes are exact (FileRecordSize), so every record's place is known before any is rendered.
+std::vector<std::uint64_t> TracefileWriter::Report::LayoutRecords(std::size_t begin, std::size_t end) {
+	std::vector<std::uint64_t> offsets(end - begin + 1, 0);
+	renderer.Run(end - begin, [&](std::size_t chunkBegin, std::size_t chunkEnd, RenderedChunk&) {
+		std::vector<Plugin::LineCoverage> unionLines;
+		const auto scratch = session->Borrow();
+		for (auto i = chunkBegin; i < chunkEnd; ++i) {
+			scratch->Rewind();
+			std::pmr::string sfPath{scratch->Resource()};
+			if (resolver->Classify(files[begin + i]->GetPath(), sfPath))
+				offsets[i + 1] = FileRecordSize(sfPath.size(), LinesOf(files[begin + i], unionLines), profile);
+		}
+	}, [](RenderedChunk&) {});
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	return offsets;
+}
+
+void TracefileWriter::Report::WriteChunk(RenderedChunk& chunk) {
+	if (sharded)
+		shardSummaries.back().files += chunk.recordCount;
+	if (writer) {
+		ScopedPhaseTimer timer{stats, ExportStats::Phase::Flush};
+		if (stats)
+			stats->recordBytes += chunk.records.Size();
+		writer->Buffer().Append(chunk.records.View());
+		writer->FlushIfFull();
+	}
+	if (cacheWriter) {
+		cacheWriter->Buffer().Append(chunk.cacheEntries.View());
+		cacheWriter->FlushIfFull();
+	}
+	if (snapshot)
+		snapshotWriter.AddEncoded(chunk.snapshotFiles.View());
+	if (testIndexPath)
+		std::ranges::move(chunk.testedFiles, std::back_inserter(testedFiles));
+	if (gate) {
+		for (const auto& file : chunk.summaries)
+			gate->Add(file.sfPath, file.linesFound, file.linesHit);
+	}
+	if (summary) {
+		// Every byte of the chunk belongs to one of its records, so the next chunk starts after the last of them.
+		const auto chunkOffset = reportOffset;
+		for (auto& file : chunk.summaries) {
+			file.offset += chunkOffset;
+			file.shard = currentShard;
+			reportOffset += file.bytes;
+			summary->Add(std::move(file));
+		}
+	}
+	if (patchWriter) {
+		patchWriter->Buffer().Append(chunk.patchRecords.View());
+		patchWriter->FlushIfFull();
+		patchFiles.Append(chunk.patchFiles.View());
+	}
+	for (auto& [dir, count] : chunk.excludedDirs)
+		excludedByDir[std::move(dir)] += count;
+	cfg.Log.Append(std::move(chunk.log));
+}
+
+// A file compiled into several modules is listed under each of them. With mergeDuplicates only its first copy is
+// kept, and it is rendered from the union of all copies' lines, keyed on the SF path.
+void TracefileWriter::Report::MergeDuplicates() {
+	const auto listedFiles = files.size();
+	ScopedPhaseTimer timer{stats, ExportStats::Phase::Classify};
+	// Keys are views of SF paths kept in the session arena.
+	std::pmr::unordered_map<std::string_view, std::size_t> firstCopy{session->Resource()};
+	const auto scratch = session->Borrow();
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < files.size(); ++i) {
+		scratch->Rewind();
+		std::pmr::string sfPath{scratch->Resource()};
+		// Excluded files are kept as they are; rendering skips them.
+		if (resolver->Classify(files[i]->GetPath(), sfPath)) {
+			if (const auto copy = firstCopy.find(sfPath); copy != firstCopy.end()) {
+				const auto* first = files[copy->second];
+				const auto [merged, created] = mergedLines.try_emplace(first);
+				if (created)
+					merged->second.Add(first->GetLines());
+				merged->second.Add(files[i]->GetLines());
+				continue;
+			}
+			firstCopy.emplace(session->Keep(sfPath), kept);
+		}
+		files[kept] = files[i];
+		moduleOf[kept++] = moduleOf[i];
+	}
+	files.resize(kept);
+	moduleOf.resize(kept);
+	if (kept != listedFiles)
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Merged " + std::to_string(listedFiles - kept) + " duplicate records into " +
+		               std::to_string(mergedLines.size()) + " files shared between modules");
+}
+
+// Shard s covers files [shardEnds[s - 1], shardEnds[s]); without shards there is one range for the whole report.
+std::vector<std::size_t> TracefileWriter::Report::PlanShards() {
+	std::vector<std::size_t> shardEnds{files.size()};
+	if (!sharded)
+		return shardEnds;
+	const auto baseDir = cfg.GetResolvedBaseDir().empty() ? std::filesystem::current_path() : cfg.GetResolvedBaseDir();
+	const auto shardOf = AssignShards(files, moduleOf, cfg.ShardAssignment(), cfg.Shards(), baseDir);
+	// Counting sort by shard; files keep their module/file order within a shard.
+	shardEnds.assign(cfg.Shards(), 0);
+	for (const auto shard : shardOf)
+		++shardEnds[shard];
+	std::vector<std::size_t> next(cfg.Shards(), 0);
+	for (std::size_t shard = 1; shard < next.size(); ++shard)
+		next[shard] = next[shard - 1] + shardEnds[shard - 1];
+	std::vector<const Plugin::FileCoverage*> grouped(files.size());
+	for (std::size_t i = 0; i < files.size(); ++i)
+		grouped[next[shardOf[i]]++] = files[i];
+	files = std::move(grouped);
+	return next;
+}
+
+void TracefileWriter::Report::WriteShards(const std::vector<std::size_t>& shardEnds) {
+	for (std::size_t shard = 0; shard < shardEnds.size(); ++shard) {
+		const std::size_t begin = shard == 0 ? 0 : shardEnds[shard - 1];
+		const std::size_t end = shardEnds[shard];
+		currentShard = static_cast<std::uint32_t>(shard);
+		reportOffset = 0;
+		const auto shardFirstRecord = summary ? summary->Files().size() : 0;
+		auto shardPath = outputPath;
+		if (sharded) {
+			shardPath = ShardPath(outputPath, shard);
+			writer.emplace(shardPath, output);
+			shardSummaries.push_back({shardPath, 0, 0, false});
+			if (!writer->IsOpen()) {
+				cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Cannot create the output file for LCOV export: " + shardPath.string());
+				written = false;
+				continue;
+			}
+		}
+		if (preallocate) {
+			recordOffsets = TimePhase(stats, ExportStats::Phase::Classify, [&] { return LayoutRecords(begin, end); });
+			writer.reset();
+			mapped.emplace();
+			sizeMismatch = false;
+			if (!mapped->Create(shardPath, recordOffsets.back())) {
+				cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Cannot preallocate and map " + shardPath.string() + ", writing it as a stream");
+				mapped.reset();
+				writer.emplace(shardPath, output);
+				if (!writer->IsOpen()) {
+					cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Cannot create the output file for LCOV export: " + shardPath.string());
+					written = false;
+					continue;
+				}
+			}
+		}
+
+		// Chunks may be rendered on worker threads, but they are written back in module/file order.
+		renderer.Run(end - begin, [&](std::size_t chunkBegin, std::size_t chunkEnd, RenderedChunk& chunk) {
+			RenderChunk(begin + chunkBegin, begin + chunkEnd, chunk);
+			if (mapped) {
+				// Each chunk owns its slice of the mapping, so workers copy into it without coordination.
+				const auto offset = recordOffsets[chunkBegin];
+				if (chunk.records.Size() != recordOffsets[chunkEnd] - offset)
+					sizeMismatch = true;
+				else if (!chunk.records.Empty())
+					std::memcpy(mapped->Data() + offset, chunk.records.Data(), chunk.records.Size());
+				if (stats)
+					stats->recordBytes += chunk.records.Size();
+				chunk.records.Clear();
+			}
+		}, [&](RenderedChunk& chunk) { WriteChunk(chunk); });
+
+		CloseReportFile(shardPath, shardFirstRecord);
+	}
+}
+
+// Finishes the report (or shard) file being written and indexes the records it got, from firstRecord on.
+void TracefileWriter::Report::CloseReportFile(const std::filesystem::path& path, std::size_t firstRecord) {
+	const bool wasMapped = mapped.has_value();
+	const bool fileWritten = TimePhase(stats, ExportStats::Phase::Flush, [&] {
+		if (!mapped)
+			return writer->Finish();
+		const bool closed = mapped->Close();
+		mapped.reset();
+		return closed && !sizeMismatch;
+	});
+	std::error_code ec;
+	if (!fileWritten) {
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing LCOV output to: " + path.string());
+		// A mapped report has its final size from the start; a partial one would look complete to readers.
+		if (wasMapped)
+			std::filesystem::remove(path, ec);
+	}
+	const auto fileSize = std::filesystem::file_size(path, ec);
+	if (stats && fileWritten && !ec)
+		stats->bytesWritten += fileSize;
+	if (index && fileWritten && !ec) {
+		const auto indexPath = ReportIndex::IndexPath(path);
+		const auto records = std::span{summary->Files()}.subspan(firstRecord);
+		if (!ReportIndex::Write(indexPath, records, fileSize))
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing report index: " + indexPath.string());
+		else
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Indexed " + std::to_string(records.size()) + " records in " + indexPath.string());
+	}
+	if (sharded) {
+		shardSummaries.back().bytes = ec ? 0 : fileSize;
+		shardSummaries.back().written = fileWritten;
+	}
+	written = written && fileWritten;
+}
+
+std::optional<std::filesystem::path> TracefileWriter::Report::Finish() {
+	if (!started && !sharded && filesOutsideModule == 0) {
+		writer.reset();
+		return outputPath;
+	}
+	if (!started)
+		Start();
+	if (filesOutsideModule > 0)
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: " + std::to_string(filesOutsideModule) +
+		               " files were added outside BeginModule/EndModule and are not in the report");
+
+	if (deferred) {
+		if (cfg.MergeDuplicates())
+			MergeDuplicates();
+		fileCount = files.size();
+		WriteShards(PlanShards());
+	} else {
+		CloseReportFile(outputPath, 0);
+	}
+
+	if (sharded) {
+		// Written last, so a manifest is only there once every shard it lists has been attempted.
+		const auto manifestPath = ShardManifestPath(outputPath);
+		if (!WriteShardManifest(manifestPath, cfg.ShardAssignment(), shardSummaries))
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing shard manifest: " + manifestPath.string());
+		else
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Wrote " + std::to_string(shardSummaries.size()) + " shards, listed in " + manifestPath.string());
+	}
+
+	if (!excludedByDir.empty()) {
+		// One line per directory instead of one per file; the largest directories first.
+		std::vector<std::pair<std::uint64_t, const std::filesystem::path::string_type*>> byCount;
+		std::uint64_t excludedCount = 0;
+		for (const auto& [dir, count] : excludedByDir) {
+			byCount.emplace_back(count, &dir);
+			excludedCount += count;
+		}
+		std::ranges::stable_sort(byCount, std::greater{}, [](const auto& entry) { return entry.first; });
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Excluded " + std::to_string(excludedCount) + " of " + std::to_string(fileCount) +
+		               " files from the report, in " + std::to_string(excludedByDir.size()) + " directories");
+		for (std::size_t i = 0; i < byCount.size(); ++i) {
+			const auto level = i < SummarizedDirs ? ExporterConfigLog::MsgLevel::Info : ExporterConfigLog::MsgLevel::Debug;
+			cfg.Log.AddMsg(level, [&] { return "  " + std::to_string(byCount[i].first) + " excluded under " + std::filesystem::path(*byCount[i].second).string(); });
+		}
+	}
+
+	if (resolver->Nested()) {
+		cfg.Log.Append(resolver->TakeLog());
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Nested .covlcov files: " + std::to_string(resolver->NestedConfigCount()) + " (" + std::to_string(resolver->ProbeCount()) + " directories probed)");
+	}
+
+	if (patch) {
+		const auto jsonPath = PatchCoverage::JsonPath(outputPath);
+		patch->ResolveSuffixMatches(patchWriter->Buffer(), patchFiles, cfg.Log);
+		if (!patchWriter->Finish() || !patch->WriteJson(jsonPath, *patchDiff, patchFiles.View())) {
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing patch coverage: " + jsonPath.string());
+		} else {
+			const auto found = patch->LinesFound();
+			const auto percent = found == 0 ? std::string("n/a") : std::to_string(patch->LinesHit() * 100 / found) + "%";
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Patch coverage: " + std::to_string(patch->LinesHit()) + " of " + std::to_string(found) +
+			               " changed lines hit (" + percent + ") in " + std::to_string(patch->FilesTouched()) + " files, written to " + jsonPath.string());
+		}
+	}
+
+	if (cfg.Summary()) {
+		const auto summaryPath = ReportSummary::SidecarPath(outputPath);
+		if (!summary->WriteJson(summaryPath, outputPath, sharded))
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing report summary: " + summaryPath.string());
+	}
+
+	if (snapshot) {
+		const auto snapshotPath = SnapshotSidecarPath(outputPath);
+		if (!snapshotWriter.Write(snapshotPath))
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing coverage snapshot: " + snapshotPath.string());
+	}
+
+	// The run is not in the test index unless it is updated; that fails the export like an incomplete report.
+	bool testIndexUpdated = true;
+	if (testIndexPath) {
+		testIndexUpdated = false;
+		if (testName.empty()) {
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: testIndex is set but the run has no test name; add ;test=<name> to the export argument");
+		} else {
+			// A missing index starts empty; one that cannot be read is left alone rather than replaced by this run alone.
+			// Writers take turns through the index's lock file, in this process (lcovConvert -j) or in parallel ones.
+			const TestIndexLock lock{*testIndexPath};
+			TestIndex testIndex;
+			std::error_code ec;
+			if (!lock.IsLocked()) {
+				cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Cannot lock test index " + testIndexPath->string() + ".lock");
+			} else if (!testIndex.Load(*testIndexPath) && std::filesystem::exists(*testIndexPath, ec)) {
+				cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Cannot read test index " + testIndexPath->string() + "; delete it to start a new one");
+			} else {
+				const auto testedCount = testedFiles.size();
+				std::uint64_t testedLines = 0;
+				for (const auto& file : testedFiles)
+					testedLines += file.lines.size();
+				testIndex.Record(testName, std::move(testedFiles));
+				if (!testIndex.Write(*testIndexPath)) {
+					cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing test index: " + testIndexPath->string());
+				} else {
+					testIndexUpdated = true;
+					cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Test index: " + testName + " executed " + std::to_string(testedLines) + " lines in " +
+					               std::to_string(testedCount) + " files; " + std::to_string(testIndex.TestCount()) + " tests in " + testIndexPath->string());
+				}
+			}
+		}
+	}
+
+	if (cacheWriter) {
+		// Only replace the cache once both the report and the new cache are complete.
+		std::error_code ec;
+		const bool cacheWritten = cacheWriter->Finish() && written;
+		if (cacheWritten)
+			std::filesystem::rename(cacheTempPath, cachePath, ec);
+		if (!cacheWritten || ec) {
+			std::filesystem::remove(cacheTempPath, ec);
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing incremental cache: " + cachePath.string());
+		} else {
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, "Incremental export reused " + std::to_string(reused.load()) + " of " + std::to_string(fileCount) + " records");
+		}
+	}
+
+	if (stats) {
+		stats->canonicalizations = resolver->CanonicalizationCount();
+		stats->peakRssBytes = ExportStats::PeakMemoryBytes();
+		stats->AddTime(ExportStats::Phase::Total, std::chrono::steady_clock::now() - exportStart);
+		const auto statsPath = ExportStats::SidecarPath(outputPath);
+		if (!stats->WriteJson(statsPath, outputPath))
+			cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: Failed writing export stats: " + statsPath.string());
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Info, stats->Summary());
+	}
+
+	// The verdict comes last in the log. Every output is written either way; a failed gate then fails the export.
+	const bool gatePassed = !gate || gate->Evaluate(cfg.Log);
+	gateFailed = !gatePassed;
+	if (!gatePassed)
+		cfg.Log.AddMsg(ExporterConfigLog::MsgLevel::Error, "LCOV Exporter: " + std::to_string(gate->FailedCount()) + " of " +
+		               std::to_string(gate->ThresholdCount()) + " coverage thresholds not met");
+	cfg.Log.LogMessages();
+	// No report path when it (or a shard) could not be written completely, when the test index was not updated or when
+	// the gate failed; the errors are in the log.
+	if (!written || !testIndexUpdated || !gatePassed)
+		return std::nullopt;
+	return sharded ? ShardManifestPath(outputPath) : outputPath;
+}
+
+TracefileWriter::TracefileWriter(ExporterConfig& cfg, const std::filesystem::path& outputPath,
+                                 const std::optional<std::filesystem::path>& diff, Input input)
+	: report_(std::make_unique<Report>(cfg, outputPath, diff, input)) {}
+
+TracefileWriter::~TracefileWriter() = default;
+
+void TracefileWriter::SetTestName(std::string testNameUtf8) {
+	report_->testName = std::move(testNameUtf8);
+}
+
+void TracefileWriter::BeginModule(const std::filesystem::path& modulePath) {
+	if (report_->result)
+		return;
+	if (!report_->started)
+		report_->Start();
+	if (report_->copies)
+		report_->copyModule = &report_->copies->AddModule(modulePath);
+	report_->moduleOpen = true;
+}
+
+void TracefileWriter::AddFile(const Plugin::FileCoverage& file) {
+	if (!report_->result)
+		report_->AddFile(file);
+}
+
+void TracefileWriter::EndModule() {
+	if (!report_->result)
+		report_->EndModule();
+}
+
+std::optional<std::filesystem::path> TracefileWriter::Finish() {
+	if (report_->result)
+		return *report_->result;
+	// Marked finished first, so a writer whose Finish threw (e.g. out of memory) does not try to write again.
+	report_->result.emplace(std::nullopt);
+	*report_->result = report_->Finish();
+	return *report_->result;
+}
+
+bool TracefileWriter::GateFailed() const noexcept {
+	return report_->gateFailed;
+}
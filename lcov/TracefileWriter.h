@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ExporterConfig.h"
+#include "LcovApi.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace Plugin {
+	class FileCoverage;
+}
+
+/**
+ * Writes an LCOV report from coverage handed over one module at a time, with everything the exporter does around it
+ * (.covlcov filtering, incremental cache, sidecars, shards, thresholds). LCOVExporter::Export is a thin adapter over it.
+ *
+ * Call BeginModule, AddFile for each of the module's files and EndModule, for every module in order, then Finish (a
+ * file added outside a module is left out, with an error in the log). With
+ * Input::Streamed, EndModule renders and writes the module's records and never reads its files again, so the caller
+ * can free each module as soon as EndModule returns: memory is bounded by the largest module, not by the whole run.
+ * Options that need every file before the first record is placed (shards, preallocate, mergeDuplicates) make the
+ * writer copy the files and write them all at Finish instead. With Input::Retained, the files stay alive until Finish
+ * and are all rendered then, in one pass across modules, without copies.
+ *
+ * Either way the report is byte for byte what Export writes for the same modules. Not thread-safe; rendering itself
+ * runs on the configured threads.
+ */
+class LCOV_API TracefileWriter {
+public:
+	enum class Input {
+		// Files given to AddFile are read until EndModule returns
+		Streamed,
+		// Files given to AddFile stay alive until Finish returns
+		Retained
+	};
+
+	// diff: unified diff to measure patch coverage against, instead of .covlcov's patchDiff
+	TracefileWriter(ExporterConfig& cfg, const std::filesystem::path& outputPath,
+	                const std::optional<std::filesystem::path>& diff = std::nullopt, Input input = Input::Streamed);
+	~TracefileWriter();
+
+	TracefileWriter(const TracefileWriter&) = delete;
+	TracefileWriter& operator=(const TracefileWriter&) = delete;
+
+	// Names the test run whose executed lines are added to .covlcov's testIndex (see TestIndex). Call before Finish.
+	void SetTestName(std::string testNameUtf8);
+
+	void BeginModule(const std::filesystem::path& modulePath);
+	void AddFile(const Plugin::FileCoverage& file);
+	void EndModule();
+	/**
+	 * Completes the report and its sidecars, then logs the exporter's messages. Returns the report path (the shard
+	 * manifest with shards), or nothing when it could not be written completely, when .covlcov's testIndex could not be
+	 * updated or, once everything is written, when a coverage threshold is not met.
+	 */
+	std::optional<std::filesystem::path> Finish();
+	// True once Finish has written everything and a coverage threshold was not met.
+	[[nodiscard]] bool GateFailed() const noexcept;
+
+private:
+	struct Report;
+
+	std::unique_ptr<Report> report_;
+};
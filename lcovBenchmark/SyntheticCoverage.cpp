@@ -0,0 +1,90 @@
+#include "SyntheticCoverage.h"
+
+#include "Plugin/Exporter/ModuleCoverage.hpp"
+#include "Plugin/Exporter/FileCoverage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <string>
+
+namespace {
+	// xorshift64*: tiny, fast and identical everywhere, unlike the std:: distributions.
+	class Random {
+	public:
+		explicit Random(std::uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+		std::uint64_t Next() {
+			state_ ^= state_ >> 12;
+			state_ ^= state_ << 25;
+			state_ ^= state_ >> 27;
+			return state_ * 0x2545F4914F6CDD1Dull;
+		}
+		// Uniform in [0, bound)
+		std::uint32_t Below(std::uint32_t bound) { return static_cast<std::uint32_t>((Next() >> 32) % bound); }
+		// Uniform in [0, 1)
+		double Unit() { return static_cast<double>(Next() >> 11) / 9007199254740992.0; }
+
+	private:
+		std::uint64_t state_;
+	};
+
+	// Generates the files in order; addModule starts each module and returns where its files go.
+	SyntheticStats Generate(const SyntheticOptions& options, const std::filesystem::path& projectRoot, const std::filesystem::path& externalRoot,
+	                        const std::function<Plugin::ModuleCoverage&(const std::filesystem::path& name)>& addModule) {
+		Random random{options.seed};
+		SyntheticStats stats;
+		const int minLines = std::max(options.minLines, 1);
+		const int maxLines = std::max(options.maxLines, minLines);
+		const double logMin = std::log(static_cast<double>(minLines));
+		const double logMax = std::log(static_cast<double>(maxLines) + 1.0);
+
+		Plugin::ModuleCoverage* module = nullptr;
+		for (int f = 0; f < options.files; ++f) {
+			if (f % std::max(options.filesPerModule, 1) == 0)
+				module = &addModule(L"Module" + std::to_wstring(f / std::max(options.filesPerModule, 1)) + L".dll");
+
+			const bool outside = static_cast<int>(random.Below(100)) < options.outsidePercent;
+			auto path = outside ? externalRoot : projectRoot;
+			for (int d = 0; d < options.depth; ++d)
+				path /= L"dir" + std::to_wstring(d) + L"_" + std::to_wstring(random.Below(8));
+			path /= L"file" + std::to_wstring(f) + (random.Below(4) == 0 ? L".h" : L".cpp");
+			auto& file = module->AddFile(path);
+
+			const auto lineCount = std::clamp(static_cast<int>(std::exp(logMin + (logMax - logMin) * random.Unit())), minLines, maxLines);
+			unsigned lineNumber = 0;
+			bool executed = random.Below(3) != 0;
+			for (int l = 0; l < lineCount; ++l) {
+				lineNumber += 1 + random.Below(3);
+				// Switch between executed and unexecuted runs now and then.
+				if (random.Below(8) == 0)
+					executed = random.Below(10) < 7;
+				file.AddLine(lineNumber, executed);
+			}
+
+			++stats.files;
+			stats.lines += static_cast<std::uint64_t>(lineCount);
+			stats.outsideFiles += outside ? 1 : 0;
+		}
+		return stats;
+	}
+}
+
+SyntheticStats GenerateCoverage(Plugin::CoverageData& data, const SyntheticOptions& options,
+                                const std::filesystem::path& projectRoot, const std::filesystem::path& externalRoot) {
+	return Generate(options, projectRoot, externalRoot, [&](const std::filesystem::path& name) -> Plugin::ModuleCoverage& { return data.AddModule(name); });
+}
+
+SyntheticStats GenerateModules(const SyntheticOptions& options, const std::filesystem::path& projectRoot,
+                               const std::filesystem::path& externalRoot,
+                               const std::function<void(const Plugin::ModuleCoverage& module)>& onModule) {
+	std::optional<Plugin::ModuleCoverage> module;
+	const auto stats = Generate(options, projectRoot, externalRoot, [&](const std::filesystem::path& name) -> Plugin::ModuleCoverage& {
+		if (module)
+			onModule(*module);
+		return module.emplace(name);
+	});
+	if (module)
+		onModule(*module);
+	return stats;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+
+#include "Plugin/Exporter/CoverageData.hpp"
+
+// Shape of the generated coverage. The same options and seed always produce the same data on every platform.
+struct SyntheticOptions {
+	int files = 20000;
+	int minLines = 10;
+	int maxLines = 2000;
+	// Directory levels between the project root and each source file
+	int depth = 6;
+	// Share of files placed outside the project root (and so outside baseDir)
+	int outsidePercent = 10;
+	int filesPerModule = 2000;
+	std::uint32_t seed = 12345;
+};
+
+struct SyntheticStats {
+	std::uint64_t files = 0;
+	std::uint64_t lines = 0;
+	std::uint64_t outsideFiles = 0;
+};
+
+/**
+ * Fills `data` with modules of synthetic source files.
+ *
+ * Files sit in a deep directory tree under projectRoot (or externalRoot for the "outside" share) with a fan-out of
+ * eight per level, so directories are shared between files the way they are in a real source tree. Line counts are
+ * log-uniform between minLines and maxLines, line numbers have small gaps, and executed lines come in runs.
+ */
+SyntheticStats GenerateCoverage(Plugin::CoverageData& data, const SyntheticOptions& options,
+                                const std::filesystem::path& projectRoot, const std::filesystem::path& externalRoot);
+/**
+ * Generates the same modules one at a time instead: each is passed to onModule and freed when it returns, so only one
+ * module of coverage is in memory at once.
+ */
+SyntheticStats GenerateModules(const SyntheticOptions& options, const std::filesystem::path& projectRoot,
+                               const std::filesystem::path& externalRoot,
+                               const std::function<void(const Plugin::ModuleCoverage& module)>& onModule);
@@ -0,0 +1,357 @@
+// Benchmark suite for the LCOV exporter.
+//
+// Generates synthetic coverage (see SyntheticCoverage.h) and measures LCOVExporter::Export under a few .covlcov
+// configurations (including the report size of each output profile), the same export streamed module by module through
+// TracefileWriter, the ExporterConfig path functions, PathResolver, and the original std::wofstream writer against
+// RecordWriter. Prints files/s, lines/s, bytes/s, heap allocations per run and peak memory per case, and optionally
+// writes them as JSON.
+//
+// Usage: lcovBenchmark [--files N] [--min-lines N] [--max-lines N] [--depth N] [--outside PERCENT]
+//                      [--repetitions N] [--seed N] [--json results.json]
+
+#include "ExportSession.h"
+#include "ExportStats.h"
+#include "ExporterConfig.h"
+#include "LCOVExporter.h"
+#include "PathResolver.h"
+#include "RecordWriter.h"
+#include "SyntheticCoverage.h"
+#include "TracefileWriter.h"
+
+#include "Plugin/Exporter/CoverageData.hpp"
+#include "Plugin/Exporter/ModuleCoverage.hpp"
+#include "Plugin/Exporter/FileCoverage.hpp"
+#include "Plugin/Exporter/LineCoverage.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+	// Every operator new in the process, counted by the replacements below. Both builds compile the lcov sources into
+	// the benchmark; allocations inside a separately linked lcov.dll would go to the CRT's operator new uncounted.
+	std::atomic<std::uint64_t> allocationCount{0};
+}
+
+void* operator new(std::size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size == 0 ? 1 : size))
+		return p;
+	throw std::bad_alloc{};
+}
+
+// GCC warns about free() on memory from operator new, not knowing that this is the matching replacement.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+	struct CaseResult {
+		std::string name;
+		double seconds = 0;
+		std::uint64_t files = 0;
+		std::uint64_t lines = 0;
+		std::uint64_t bytes = 0;
+		std::uint64_t allocations = 0;
+		std::uint64_t peakMemoryBytes = 0;
+	};
+
+	struct Timing {
+		double seconds = 0;
+		// Heap allocations made by one run (the fewest of all runs)
+		std::uint64_t allocations = 0;
+	};
+
+	Timing BestOf(int repetitions, const std::function<void()>& run) {
+		Timing best;
+		for (int i = 0; i < repetitions; ++i) {
+			const auto allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+			const auto start = std::chrono::steady_clock::now();
+			run();
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			const auto allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+			if (i == 0 || elapsed.count() < best.seconds)
+				best.seconds = elapsed.count();
+			if (i == 0 || allocations < best.allocations)
+				best.allocations = allocations;
+		}
+		return best;
+	}
+
+	// The exporter's output loop before RecordWriter, kept verbatim as the baseline.
+	void ExportWithWofstream(const Plugin::CoverageData& data, const fs::path& outputPath) {
+		std::wofstream ofs{outputPath, std::ios::binary};
+		for (const auto& mod : data.GetModules()) {
+			for (const auto& file : mod->GetFiles()) {
+				ofs << "TN:" << '\n';
+				ofs << "SF:" << file->GetPath().generic_wstring() << '\n';
+				const auto& lines = file->GetLines();
+				for (const auto& line : lines) {
+					if (line.HasBeenExecuted()) {
+						ofs << "DA:" << line.GetLineNumber() << ",1" << '\n';
+					} else {
+						ofs << "DA:" << line.GetLineNumber() << ",0" << '\n';
+					}
+				}
+				auto coveredCount = std::ranges::count_if(lines, [](const auto& line) {
+					return line.HasBeenExecuted();
+				});
+				ofs << "LF:" << lines.size() << '\n';
+				ofs << "LH:" << coveredCount << '\n';
+				ofs << "end_of_record\n";
+			}
+		}
+	}
+
+	void ExportWithRecordWriter(const Plugin::CoverageData& data, const fs::path& outputPath) {
+		RecordWriter writer{outputPath};
+		for (const auto& mod : data.GetModules()) {
+			for (const auto& file : mod->GetFiles()) {
+				RenderFileRecord(writer.Buffer(), file->GetPath(), file->GetLines());
+				writer.FlushIfFull();
+			}
+		}
+		writer.Finish();
+	}
+
+	bool SameBytes(const fs::path& a, const fs::path& b) {
+		std::ifstream fa(a, std::ios::binary);
+		std::ifstream fb(b, std::ios::binary);
+		return std::equal(std::istreambuf_iterator<char>(fa), std::istreambuf_iterator<char>(),
+		                  std::istreambuf_iterator<char>(fb), std::istreambuf_iterator<char>());
+	}
+
+	// Loads an ExporterConfig the way the plugin does: from a .covlcov found in configDir.
+	ExporterConfig MakeConfig(const fs::path& configDir, const std::string& yaml) {
+		std::ofstream(configDir / L".covlcov", std::ios::binary | std::ios::trunc) << yaml;
+		return ExporterConfig{configDir};
+	}
+
+	// Size of a report against the full profile's, e.g. "12.3 MiB (-20.5%)".
+	std::string SizeAgainst(std::uint64_t bytes, std::uint64_t fullBytes) {
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / (1024.0 * 1024.0) << " MiB";
+		if (bytes != fullBytes && fullBytes != 0)
+			text << " (-" << 100.0 * static_cast<double>(fullBytes - bytes) / static_cast<double>(fullBytes) << "%)";
+		return text.str();
+	}
+
+	void PrintResult(const CaseResult& result) {
+		std::cout << std::left << std::setw(28) << result.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << result.seconds * 1000.0 << " ms"
+			<< std::setw(12) << static_cast<double>(result.files) / result.seconds << " files/s"
+			<< std::setw(14) << static_cast<double>(result.lines) / result.seconds << " lines/s";
+		if (result.bytes != 0)
+			std::cout << std::setw(10) << static_cast<double>(result.bytes) / (1024.0 * 1024.0) / result.seconds << " MiB/s";
+		std::cout << std::setw(12) << result.allocations << " allocs";
+		std::cout << "  peak " << static_cast<double>(result.peakMemoryBytes) / (1024.0 * 1024.0) << " MiB\n";
+	}
+
+	bool WriteJson(const fs::path& path, const SyntheticOptions& options, const SyntheticStats& stats,
+	               const std::vector<CaseResult>& results) {
+		std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+		ofs << std::setprecision(6) << "{\n"
+			<< "  \"version\": 1,\n"
+			<< "  \"options\": {\"files\": " << options.files << ", \"minLines\": " << options.minLines
+			<< ", \"maxLines\": " << options.maxLines << ", \"depth\": " << options.depth
+			<< ", \"outsidePercent\": " << options.outsidePercent << ", \"seed\": " << options.seed << "},\n"
+			<< "  \"dataset\": {\"files\": " << stats.files << ", \"lines\": " << stats.lines
+			<< ", \"outsideFiles\": " << stats.outsideFiles << "},\n"
+			<< "  \"results\": [\n";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const auto& r = results[i];
+			ofs << "    {\"name\": \"" << r.name << "\", \"seconds\": " << r.seconds
+				<< ", \"filesPerSecond\": " << static_cast<double>(r.files) / r.seconds
+				<< ", \"linesPerSecond\": " << static_cast<double>(r.lines) / r.seconds
+				<< ", \"bytes\": " << r.bytes
+				<< ", \"bytesPerSecond\": " << static_cast<double>(r.bytes) / r.seconds
+				<< ", \"allocations\": " << r.allocations
+				<< ", \"peakMemoryBytes\": " << r.peakMemoryBytes << '}' << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		ofs << "  ]\n}\n";
+		return static_cast<bool>(ofs);
+	}
+
+	int Usage() {
+		std::cerr << "Usage: lcovBenchmark [--files N] [--min-lines N] [--max-lines N] [--depth N] [--outside PERCENT]\n"
+			"                     [--repetitions N] [--seed N] [--json results.json]\n";
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	SyntheticOptions options;
+	int repetitions = 3;
+	fs::path jsonPath;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (i + 1 >= argc)
+			return Usage();
+		const char* value = argv[++i];
+		if (arg == "--files") options.files = std::atoi(value);
+		else if (arg == "--min-lines") options.minLines = std::atoi(value);
+		else if (arg == "--max-lines") options.maxLines = std::atoi(value);
+		else if (arg == "--depth") options.depth = std::atoi(value);
+		else if (arg == "--outside") options.outsidePercent = std::atoi(value);
+		else if (arg == "--repetitions") repetitions = std::max(std::atoi(value), 1);
+		else if (arg == "--seed") options.seed = static_cast<std::uint32_t>(std::strtoul(value, nullptr, 10));
+		else if (arg == "--json") jsonPath = value;
+		else return Usage();
+	}
+
+	const fs::path benchDir = fs::temp_directory_path() / L"covlcov_bench";
+	const fs::path projectRoot = benchDir / L"project";
+	const fs::path externalRoot = benchDir / L"external";
+	fs::remove_all(benchDir);
+	fs::create_directories(projectRoot);
+
+	// Streamed first, while nothing else is in memory: modules are generated and written one at a time, so the peak
+	// reflects one module rather than the whole run. Its time includes generating the coverage.
+	const fs::path streamPath = benchDir / L"bench_stream.info";
+	auto streamConfig = MakeConfig(benchDir, "threads: 1\n");
+	std::ostringstream streamLog;
+	const auto streamed = BestOf(repetitions, [&] {
+		auto cfg = streamConfig;
+		auto* previous = std::cout.rdbuf(streamLog.rdbuf());
+		TracefileWriter writer{cfg, streamPath};
+		GenerateModules(options, projectRoot, externalRoot, [&](const Plugin::ModuleCoverage& module) {
+			writer.BeginModule(module.GetPath());
+			for (const auto& file : module.GetFiles())
+				writer.AddFile(*file);
+			writer.EndModule();
+		});
+		writer.Finish();
+		std::cout.rdbuf(previous);
+		streamLog.str({});
+	});
+	const auto streamPeak = ExportStats::PeakMemoryBytes();
+
+	std::cout << "Generating " << options.files << " files x " << options.minLines << ".." << options.maxLines
+		<< " lines, depth " << options.depth << ", " << options.outsidePercent << "% outside baseDir\n";
+	Plugin::CoverageData data{L"Benchmark", 0};
+	const auto stats = GenerateCoverage(data, options, projectRoot, externalRoot);
+	std::cout << stats.files << " files, " << stats.lines << " lines\n\n";
+
+	std::vector<const Plugin::FileCoverage*> files;
+	for (const auto& mod : data.GetModules()) {
+		for (const auto& file : mod->GetFiles())
+			files.push_back(file.get());
+	}
+
+	std::vector<CaseResult> results;
+	auto record = [&](const std::string& name, const Timing& timing, std::uint64_t bytes) {
+		results.push_back({name, timing.seconds, stats.files, stats.lines, bytes, timing.allocations, ExportStats::PeakMemoryBytes()});
+		PrintResult(results.back());
+	};
+	results.push_back({"stream/plain", streamed.seconds, stats.files, stats.lines, fs::file_size(streamPath), streamed.allocations, streamPeak});
+	PrintResult(results.back());
+
+	const fs::path outputPath = benchDir / L"bench.info";
+	auto runExport = [&](const std::string& name, const std::string& yaml, const fs::path& path = {}) {
+		const auto& target = path.empty() ? outputPath : path;
+		LCOVExporter exporter;
+		const auto cfg = MakeConfig(benchDir, yaml);
+		// The exporter's log goes to stdout; keep its formatting cost but not the console output.
+		std::ostringstream discarded;
+		const auto timing = BestOf(repetitions, [&] {
+			exporter.cfg = cfg;
+			auto* previous = std::cout.rdbuf(discarded.rdbuf());
+			exporter.Export(data, target.wstring());
+			std::cout.rdbuf(previous);
+			discarded.str({});
+		});
+		const auto bytes = fs::file_size(target);
+		record(name, timing, bytes);
+		return bytes;
+	};
+
+	const auto fullBytes = runExport("export/plain", "threads: 1\n");
+	const bool streamIdentical = SameBytes(streamPath, outputPath);
+	runExport("export/baseDir", "includeByBaseDir: true\nbaseDir: project\nthreads: 1\n");
+	// Thresholds that always pass, to measure the gate's bookkeeping against export/baseDir.
+	runExport("export/baseDir-thresholds", "includeByBaseDir: true\nbaseDir: project\nthreads: 1\nthresholds:\n  total: 0\n  file: 0\n");
+	runExport("export/baseDir-threads", "includeByBaseDir: true\nbaseDir: project\nthreads: auto\n");
+	runExport("export/gzip-threads", "threads: auto\n", benchDir / L"bench.info.gz");
+	const auto compactBytes = runExport("export/compact", "threads: 1\nprofile: compact\n");
+	const auto hitsOnlyBytes = runExport("export/hits-only", "threads: 1\nprofile: hits-only\n");
+
+	const auto baseDirConfig = MakeConfig(benchDir, "includeByBaseDir: true\nbaseDir: project\n");
+	std::size_t included = 0;
+	record("config/ShouldInclude+MakeSF", BestOf(repetitions, [&] {
+		included = 0;
+		for (const auto* file : files) {
+			if (baseDirConfig.ShouldIncludeInReportByPath(file->GetPath())) {
+				++included;
+				(void)baseDirConfig.MakeSFPath(file->GetPath());
+			}
+		}
+	}), 0);
+	record("resolver/Classify", BestOf(repetitions, [&] {
+		PathResolver resolver{baseDirConfig};
+		for (const auto* file : files)
+			(void)resolver.Classify(file->GetPath());
+	}), 0);
+	// The exporter's way: SF paths go into a session scratch arena that is rewound after every file.
+	record("resolver/Classify-scratch", BestOf(repetitions, [&] {
+		PathResolver resolver{baseDirConfig};
+		ExportSession session;
+		const auto scratch = session.Borrow();
+		for (const auto* file : files) {
+			scratch->Rewind();
+			std::pmr::string sfPath{scratch->Resource()};
+			(void)resolver.Classify(file->GetPath(), sfPath);
+		}
+	}), 0);
+
+	const fs::path legacyPath = benchDir / L"bench_wofstream.info";
+	const fs::path writerPath = benchDir / L"bench_recordwriter.info";
+	const auto legacy = BestOf(repetitions, [&] { ExportWithWofstream(data, legacyPath); });
+	record("writer/wofstream", legacy, fs::file_size(legacyPath));
+	const auto recordWriter = BestOf(repetitions, [&] { ExportWithRecordWriter(data, writerPath); });
+	record("writer/RecordWriter", recordWriter, fs::file_size(writerPath));
+
+	const bool identical = SameBytes(legacyPath, writerPath);
+	std::cout << "\nIncluded by baseDir: " << included << " of " << stats.files << " files\n";
+	std::cout << "Report size by profile: full " << SizeAgainst(fullBytes, fullBytes) << ", compact "
+		<< SizeAgainst(compactBytes, fullBytes) << ", hits-only " << SizeAgainst(hitsOnlyBytes, fullBytes) << '\n';
+	std::cout << "wofstream and RecordWriter outputs identical: " << (identical ? "yes" : "NO") << '\n';
+	std::cout << "Streamed and exported reports identical: " << (streamIdentical ? "yes" : "NO") << '\n';
+
+	if (!jsonPath.empty()) {
+		if (!WriteJson(jsonPath, options, stats, results)) {
+			std::cerr << "Cannot write " << jsonPath.string() << '\n';
+			return 1;
+		}
+		std::cout << "Results written to " << jsonPath.string() << '\n';
+	}
+
+	fs::remove_all(benchDir);
+	return identical && streamIdentical ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// Converts coverage files written by OpenCppCoverage's binary exporter (--export_type=binary) to LCOV tracefiles with
+// the lcov exporter, so the conversion can run on any machine, Linux included.
+//
+// Usage: lcovConvert [-o <output.info | directory>] [-j <files in parallel>] <input.cov | directory>...
+//
+// Each input is exported exactly as --export_type=lcov would, using the .covlcov found from the working directory, but
+// streamed one module at a time (see TracefileWriter).
+// With one input, -o names the output (default: the input with an .info extension; .gz compresses it). With several,
+// -o is a directory (default: next to each input) and every output is named after its input. Directories are expanded
+// to the *.cov files they contain. A report that misses the .covlcov "thresholds" counts as a failed conversion. With a
+// .covlcov "testIndex", each input's executed lines are filed under the input's file name without its extension.
+
+#include "BinaryCoverage.h"
+#include "ExporterConfig.h"
+#include "RecordWriter.h"
+#include "TracefileWriter.h"
+
+#include "Plugin/Exporter/ModuleCoverage.hpp"
+#include "Plugin/Exporter/FileCoverage.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <clocale>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+	int Usage() {
+		std::cerr << "Usage: lcovConvert [-o <output.info | directory>] [-j <files in parallel>] <input.cov | directory>...\n";
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	// Source paths are converted between UTF-8 and wide strings; use the environment's locale for that.
+	std::setlocale(LC_ALL, "");
+
+	fs::path outputPath;
+	unsigned threads = 0;
+	std::vector<fs::path> inputs;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+			outputPath = argv[++i];
+		} else if ((arg == "-j" || arg == "--threads") && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (fs::is_directory(arg)) {
+			for (const auto& entry : fs::directory_iterator(arg)) {
+				if (entry.is_regular_file() && entry.path().extension() == ".cov")
+					inputs.push_back(entry.path());
+			}
+		} else {
+			inputs.emplace_back(arg);
+		}
+	}
+	if (inputs.empty())
+		return Usage();
+	std::ranges::sort(inputs);
+
+	auto outputFor = [&](const fs::path& input) {
+		if (inputs.size() == 1 && !outputPath.empty() && !fs::is_directory(outputPath))
+			return outputPath;
+		auto name = input.filename();
+		name.replace_extension(".info");
+		return outputPath.empty() ? input.parent_path() / name : outputPath / name;
+	};
+	if (inputs.size() > 1 && !outputPath.empty())
+		fs::create_directories(outputPath);
+
+	// Files are converted independently, one per thread; each export renders with the .covlcov "threads" setting.
+	const auto start = std::chrono::steady_clock::now();
+	const auto workerCount = std::min<std::size_t>(threads == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : threads, inputs.size());
+	std::atomic<std::size_t> next{0};
+	std::atomic<std::size_t> failed{0};
+	auto convert = [&] {
+		for (auto i = next++; i < inputs.size(); i = next++) {
+			ExporterConfig cfg{fs::current_path()};
+			// Each module is written as soon as it is decoded and freed before the next, so a conversion holds one
+			// module at a time rather than the whole run. The writer is created with the first module, so nothing is
+			// written for an input that turns out not to be a coverage file.
+			std::optional<TracefileWriter> writer;
+			const bool read = ReadBinaryCoverageModules(inputs[i], cfg.Log, [&](const Plugin::ModuleCoverage& module) {
+				if (!writer)
+					writer.emplace(cfg, outputFor(inputs[i]));
+				writer->BeginModule(module.GetPath());
+				for (const auto& file : module.GetFiles())
+					writer->AddFile(*file);
+				writer->EndModule();
+			});
+			if (!read) {
+				cfg.Log.LogMessages();
+				++failed;
+				continue;
+			}
+			if (!writer)
+				writer.emplace(cfg, outputFor(inputs[i]));
+			std::string testName;
+			EncodePathUtf8(testName, inputs[i].stem().native(), false);
+			writer->SetTestName(std::move(testName));
+			// Also fails when the report is written but misses a threshold; the exporter's log lists which.
+			if (!writer->Finish())
+				++failed;
+		}
+	};
+	std::vector<std::thread> workers;
+	for (std::size_t t = 1; t < workerCount; ++t)
+		workers.emplace_back(convert);
+	convert();
+	for (auto& worker : workers)
+		worker.join();
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Converted " << inputs.size() - failed << " of " << inputs.size() << " binary coverage files in "
+		<< elapsed.count() << " s\n";
+	return failed == 0 ? 0 : 1;
+}
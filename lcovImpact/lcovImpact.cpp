@@ -0,0 +1,93 @@
+// Picks the tests to run for a change, from the test index the exporter builds with "testIndex" in .covlcov.
+//
+// Usage: lcovImpact <index> [--diff <changes.diff>] [<SF path>[:<first>[-<last>]]]...
+//        lcovImpact <index> --list
+//
+// The diff is read against the indexed version of the files: the lines it removes or modifies, and the lines on either
+// side of what it inserts. A path without lines stands for the whole file. Prints the tests that executed any changed
+// line, one per line. Changed files that no indexed test executed are listed on stderr and make it exit with 1, so CI
+// can fall back to the whole suite; a file that only matches several indexed files by a path suffix is listed there
+// too, with the tests of all of them picked. --list prints every indexed test with the number of lines it executed.
+
+#include "PatchCoverage.h"
+#include "TestIndex.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace {
+	int Usage() {
+		std::cerr << "Usage: lcovImpact <index> [--diff <changes.diff>] [<SF path>[:<first>[-<last>]]]...\n"
+			"       lcovImpact <index> --list\n";
+		return 2;
+	}
+
+	// Reads "<first>[-<last>]"; false when text is not a line range.
+	bool ParseLines(std::string_view text, LineInterval& lines) {
+		const auto end = text.data() + text.size();
+		auto result = std::from_chars(text.data(), end, lines.first);
+		if (result.ec != std::errc{} || lines.first == 0)
+			return false;
+		lines.last = lines.first;
+		if (result.ptr != end && *result.ptr == '-')
+			result = std::from_chars(result.ptr + 1, end, lines.last);
+		return result.ec == std::errc{} && result.ptr == end && lines.last >= lines.first;
+	}
+
+	// "<path>[:<lines>]"; the last ':' only starts a line range when one follows, so "C:\src\a.cpp" is a path.
+	void AddSpec(PatchCoverage& changes, std::string_view spec) {
+		LineInterval lines{1, UINT32_MAX};
+		if (const auto colon = spec.rfind(':'); colon != std::string_view::npos && ParseLines(spec.substr(colon + 1), lines))
+			spec = spec.substr(0, colon);
+		changes.AddChange(spec, lines);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3)
+		return Usage();
+
+	const std::filesystem::path indexPath = argv[1];
+	TestIndex index;
+	if (!index.Load(indexPath)) {
+		std::cerr << "Cannot read the test index " << indexPath.string() << "; export with \"testIndex\" in .covlcov\n";
+		return 2;
+	}
+
+	if (std::string_view(argv[2]) == "--list") {
+		const auto lines = index.LinesPerTest();
+		for (std::uint32_t test = 0; test < index.TestCount(); ++test)
+			std::cout << index.TestName(test) << '\t' << lines[test] << '\n';
+		return 0;
+	}
+
+	PatchCoverage changes;
+	for (int i = 2; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		if (arg == "--diff") {
+			if (i + 1 >= argc)
+				return Usage();
+			const std::filesystem::path diffPath = argv[++i];
+			if (!changes.LoadDiff(diffPath, DiffSide::Old)) {
+				std::cerr << "Cannot read " << diffPath.string() << '\n';
+				return 2;
+			}
+		} else {
+			AddSpec(changes, arg);
+		}
+	}
+
+	const auto impact = index.Affected(changes);
+	for (const auto test : impact.tests)
+		std::cout << index.TestName(test) << '\n';
+	for (const auto file : impact.ambiguousFiles)
+		std::cerr << "Matches several indexed files, the tests of each are listed: " << file << '\n';
+	for (const auto file : impact.unknownFiles)
+		std::cerr << "No indexed test executed: " << file << '\n';
+	return impact.unknownFiles.empty() ? 0 : 1;
+}
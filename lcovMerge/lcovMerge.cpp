@@ -0,0 +1,74 @@
+// Merges LCOV tracefiles written by the lcov exporter (e.g. one per test shard) into a single report.
+//
+// Usage: lcovMerge -o <output.info | output.snap> [-j <threads>] <input.info | input.snap | directory>...
+//
+// Inputs may be LCOV tracefiles (*.info, or *.gz when compressed) or coverage snapshots (*.snap); directories are
+// expanded to the *.info, *.gz and *.snap files they contain. When the output ends in .snap, the merge is written as a snapshot; if every input is a
+// snapshot, without going through LCOV records. When it ends in .gz, the merged tracefile is gzip-compressed.
+
+#include "CoverageSnapshot.h"
+#include "GzipWriter.h"
+#include "TracefileMerger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+	int Usage() {
+		std::cerr << "Usage: lcovMerge -o <output.info | output.snap> [-j <threads>] <input.info | input.snap | directory>...\n";
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	fs::path outputPath;
+	unsigned threads = 0;
+	std::vector<fs::path> inputs;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+			outputPath = argv[++i];
+		} else if ((arg == "-j" || arg == "--threads") && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (fs::is_directory(arg)) {
+			for (const auto& entry : fs::directory_iterator(arg)) {
+				const auto extension = entry.path().extension();
+				if (entry.is_regular_file() && (extension == ".info" || extension == ".snap" || IsGzipPath(entry.path())))
+					inputs.push_back(entry.path());
+			}
+		} else {
+			inputs.emplace_back(arg);
+		}
+	}
+	if (outputPath.empty() || inputs.empty())
+		return Usage();
+
+	const auto start = std::chrono::steady_clock::now();
+	const bool snapshotsOnly = std::ranges::all_of(inputs, [](const fs::path& input) { return input.extension() == ".snap"; });
+	if (outputPath.extension() == ".snap" && snapshotsOnly) {
+		ExporterConfigLog log;
+		const bool ok = MergeSnapshots(inputs, outputPath, log);
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		log.LogMessages();
+		std::cout << "Merged " << inputs.size() << " snapshots into " << outputPath.string() << " in " << elapsed.count() << " s\n";
+		return ok ? 0 : 1;
+	}
+
+	TracefileMerger merger{threads};
+	const bool readOk = merger.AddFiles(inputs);
+	const bool writeOk = merger.Write(outputPath);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	merger.Log.LogMessages();
+	std::cout << "Merged " << inputs.size() << " tracefiles (" << merger.SourceFileCount() << " source files) into "
+		<< outputPath.string() << " in " << elapsed.count() << " s\n";
+	return readOk && writeOk ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+// Looks up source files in an LCOV report through the index the exporter writes with "index: true", without reading
+// the rest of the report.
+//
+// Usage: lcovQuery <report.info> <SF path>...
+//        lcovQuery <report.info> --list
+//
+// For each SF path (as written in the report; '\' is read as '/'), prints an LCOV record with its DA lines, the hits
+// of all its records summed. --list prints every indexed path with its LF and LH. Exits with 1 when a path is not in
+// the report.
+
+#include "RecordWriter.h"
+#include "ReportIndex.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	int Usage() {
+		std::cerr << "Usage: lcovQuery <report.info> <SF path>...\n"
+			"       lcovQuery <report.info> --list\n";
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3)
+		return Usage();
+
+	const std::filesystem::path reportPath = argv[1];
+	ReportIndex index;
+	if (!index.Open(reportPath)) {
+		std::cerr << "Cannot open " << reportPath.string() << " with an index that matches it ("
+			<< ReportIndex::IndexPath(reportPath).string() << "); export it with \"index: true\" in .covlcov\n";
+		return 2;
+	}
+
+	RecordBuffer out;
+	if (std::string_view(argv[2]) == "--list") {
+		for (std::size_t i = 0; i < index.Size(); ++i) {
+			const auto entry = index.At(i);
+			out.Append(entry.sfPath);
+			out.Append('\t');
+			out.AppendUInt(entry.linesFound);
+			out.Append('\t');
+			out.AppendUInt(entry.linesHit);
+			out.Append('\n');
+		}
+		std::cout.write(out.Data(), static_cast<std::streamsize>(out.Size()));
+		return 0;
+	}
+
+	int missing = 0;
+	std::vector<LineHits> lines;
+	for (int i = 2; i < argc; ++i) {
+		std::string sfPath = argv[i];
+		std::ranges::replace(sfPath, '\\', '/');
+		if (!index.Lines(sfPath, lines)) {
+			std::cerr << "Not in the report: " << sfPath << '\n';
+			++missing;
+			continue;
+		}
+		RenderFileRecord(out, sfPath, lines);
+	}
+	std::cout.write(out.Data(), static_cast<std::streamsize>(out.Size()));
+	return missing == 0 ? 0 : 1;
+}
@@ -1,8 +1,38 @@
 #include "pch.h"
+#include "AsyncWriter.h"
+#include "BinaryCoverage.h"
+#include "ConfigTree.h"
+#include "CoverageGate.h"
+#include "CoverageSnapshot.h"
+#include "ExportSession.h"
+#include "ExportStats.h"
+#include "GzipWriter.h"
 #include "LCOVExporter.h"
+#include "LineBitmap.h"
+#include "ParallelRenderer.h"
+#include "PatchCoverage.h"
+#include "PathResolver.h"
+#include "RecordCache.h"
+#include "RecordWriter.h"
+#include "RenderedChunk.h"
+#include "ReportIndex.h"
+#include "ReportSummary.h"
+#include "ShardPlan.h"
+#include "TestIndex.h"
+#include "TracefileMerger.h"
+#include "TracefileWriter.h"
+#include <algorithm>
 #include <filesystem>
+#include <map>
 #include <fstream>
+#include <memory>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <yaml-cpp/yaml.h>
 
@@ -13,9 +43,55 @@
 #include "Plugin/Exporter/LineCoverage.hpp"
 
 #include <gtest/gtest.h>
+#include <zlib.h>
 
 namespace fs = std::filesystem;
 
+namespace {
+	// Contents of a file, byte for byte
+	std::string ReadFile(const fs::path& path) {
+		std::ifstream ifs(path, std::ios::binary);
+		std::stringstream buffer;
+		buffer << ifs.rdbuf();
+		return buffer.str();
+	}
+
+	// What one export through the plugin returned and logged
+	struct ExportOutcome {
+		std::optional<fs::path> result;
+		// Set when Export threw CoverageGateFailure
+		bool gateFailed = false;
+		std::vector<std::pair<ExporterConfigLog::MsgLevel, std::string>> messages;
+
+		[[nodiscard]] bool HasErrors() const {
+			return std::ranges::any_of(messages, [](const auto& message) { return message.first == ExporterConfigLog::MsgLevel::Error; });
+		}
+		// Every message, one per line
+		[[nodiscard]] std::string Text() const {
+			std::string text;
+			for (const auto& [level, msg] : messages)
+				text += msg + '\n';
+			return text;
+		}
+	};
+
+	// Exports as OpenCppCoverage does, with .covlcov settings given as YAML (none when empty) and the export argument
+	// ("<output>[;diff=...][;test=...]").
+	ExportOutcome ExportWith(const Plugin::CoverageData& data, const std::string& yaml, const std::wstring& argument) {
+		std::unique_ptr<LCOVExporter> exporter{static_cast<LCOVExporter*>(CreatePlugin())};
+		if (!yaml.empty())
+			exporter->cfg.LoadFromYaml(YAML::Load(yaml));
+		ExportOutcome outcome;
+		try {
+			outcome.result = exporter->Export(data, argument);
+		} catch (const CoverageGateFailure&) {
+			outcome.gateFailed = true;
+		}
+		outcome.messages = std::move(exporter->cfg.Log.messages);
+		return outcome;
+	}
+}
+
 TEST(TestCaseName, TestName) {
 	EXPECT_EQ(1, 1);
 	EXPECT_TRUE(true);
@@ -130,3 +206,1212 @@ TEST(LCOVExporterTest, GetArgumentHelpDescription) {
 	ASSERT_FALSE(help.empty());
 	ASSERT_NE(help.find(L"lcov exporter plugin help"), std::wstring::npos);
 }
+
+TEST(LCOVExporterTest, OutputProfiles) {
+	const std::vector<Plugin::LineCoverage> lines{{1, true}, {2, false}, {10, true}};
+	const std::vector<Plugin::LineCoverage> none;
+	const std::string_view sfPath = "src/main.cpp";
+	auto render = [&](const std::vector<Plugin::LineCoverage>& fileLines, OutputProfile profile) {
+		RecordBuffer buffer;
+		RenderFileRecord(buffer, sfPath, fileLines, profile);
+		EXPECT_EQ(FileRecordSize(sfPath.size(), fileLines, profile), buffer.Size());
+		return std::string(buffer.View());
+	};
+	EXPECT_EQ(render(lines, OutputProfile::Full), "TN:\nSF:src/main.cpp\nDA:1,1\nDA:2,0\nDA:10,1\nLF:3\nLH:2\nend_of_record\n");
+	EXPECT_EQ(render(lines, OutputProfile::Compact), "SF:src/main.cpp\nDA:1,1\nDA:2,0\nDA:10,1\nLF:3\nLH:2\nend_of_record\n");
+	EXPECT_EQ(render(lines, OutputProfile::HitsOnly), "SF:src/main.cpp\nDA:1,1\nDA:10,1\nLF:3\nLH:2\nend_of_record\n");
+	EXPECT_EQ(render(none, OutputProfile::Full), "TN:\nSF:src/main.cpp\nLF:0\nLH:0\nend_of_record\n");
+	EXPECT_EQ(render(none, OutputProfile::Compact), "");
+	EXPECT_EQ(render(none, OutputProfile::HitsOnly), "");
+
+	// Exported with a profile, files without lines get no record, and the index and summary still find the rest.
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"TestModule.exe");
+	for (int f = 0; f < 20; ++f) {
+		auto& file = module.AddFile(fs::current_path() / L"profiled" / (L"f" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= static_cast<unsigned>(f % 4); ++l)
+			file.AddLine(l, l != 2);
+	}
+
+	const fs::path outputPath = L"test_profile.info";
+	EXPECT_FALSE(ExportWith(data, "threads: 2\nprofile: compact\nindex: true\nsummary: true", outputPath.wstring()).HasErrors());
+	const auto compact = ReadFile(outputPath);
+	EXPECT_EQ(compact.find("TN:"), std::string::npos);
+	EXPECT_EQ(compact.find("f4.cpp"), std::string::npos);
+	ReportIndex index;
+	ASSERT_TRUE(index.Open(outputPath));
+	ASSERT_EQ(index.Size(), 15u);
+	const auto sfPathOf3 = (fs::current_path() / L"profiled" / L"f3.cpp").generic_string();
+	const auto [first, last] = index.Find(sfPathOf3);
+	ASSERT_EQ(last - first, 1u);
+	EXPECT_EQ(index.Record(index.At(first)), "SF:" + sfPathOf3 + "\nDA:1,1\nDA:2,0\nDA:3,1\nLF:3\nLH:2\nend_of_record\n");
+	index.Close();
+
+	EXPECT_FALSE(ExportWith(data, "threads: 2\nprofile: hits-only", outputPath.wstring()).HasErrors());
+	const auto hitsOnly = ReadFile(outputPath);
+	EXPECT_EQ(hitsOnly.find(",0\n"), std::string::npos);
+	EXPECT_NE(hitsOnly.find("SF:" + sfPathOf3 + "\nDA:1,1\nDA:3,1\nLF:3\nLH:2\nend_of_record\n"), std::string::npos);
+	EXPECT_FALSE(ExportWith(data, "threads: 2\nprofile: hits-only\npreallocate: true", outputPath.wstring()).HasErrors());
+	EXPECT_EQ(ReadFile(outputPath), hitsOnly);
+
+	fs::remove(outputPath);
+	fs::remove(ReportIndex::IndexPath(outputPath));
+	fs::remove(ReportSummary::SidecarPath(outputPath));
+}
+
+TEST(RecordWriterTest, RenderMatchesLegacyFormat) {
+	const std::vector<Plugin::LineCoverage> lines{{1, true}, {2, false}, {10, true}};
+	RecordBuffer buffer;
+	RenderFileRecord(buffer, L"src/main.cpp", lines);
+	ASSERT_EQ(buffer.View(), "TN:\nSF:src/main.cpp\nDA:1,1\nDA:2,0\nDA:10,1\nLF:3\nLH:2\nend_of_record\n");
+}
+
+TEST(RecordWriterTest, AppendUtf8EncodesNonAscii) {
+	RecordBuffer buffer;
+	buffer.AppendUtf8(L"caf\u00e9/\u6587\U0001F600");
+	ASSERT_EQ(buffer.View(), "caf\xC3\xA9/\xE6\x96\x87\xF0\x9F\x98\x80");
+}
+
+TEST(PathResolverTest, ClassifyMatchesExporterConfig) {
+	const fs::path root = fs::temp_directory_path() / L"covlcov_resolver_test";
+	fs::remove_all(root);
+	fs::create_directories(root / L"project" / L"src");
+	std::ofstream(root / L"project" / L".covlcov") << "includeByBaseDir: true\n";
+
+	ExporterConfig cfg{root / L"project"};
+	ASSERT_TRUE(cfg.IsLoaded());
+	PathResolver resolver{cfg};
+
+	const fs::path inside = root / L"project" / L"src" / L"a.cpp";
+	const fs::path sibling = root / L"project" / L"src" / L"b.cpp";
+	const fs::path outside = root / L"other" / L"c.cpp";
+	for (const auto& path : {inside, sibling, outside}) {
+		const auto [included, sfPath] = resolver.Classify(path);
+		EXPECT_EQ(included, cfg.ShouldIncludeInReportByPath(path)) << path.string();
+		EXPECT_EQ(sfPath, cfg.MakeSFPath(path)) << path.string();
+	}
+	EXPECT_EQ(resolver.Classify(inside).sfPath.generic_wstring(), L"src/a.cpp");
+	EXPECT_FALSE(resolver.Classify(outside).included);
+
+	// A source file that is itself a symlink is resolved like weakly_canonical does, by both overloads.
+	fs::create_directories(root / L"other");
+	std::ofstream(inside) << "int a;\n";
+	std::ofstream(outside) << "int c;\n";
+	const fs::path alias = root / L"project" / L"src" / L"alias.cpp";
+	const fs::path escape = root / L"project" / L"src" / L"escape.cpp";
+	std::error_code ec;
+	fs::create_symlink(inside, alias, ec);
+	if (!ec)
+		fs::create_symlink(outside, escape, ec);
+	if (ec) {
+		fs::remove_all(root);
+		GTEST_SKIP() << "cannot create symlinks: " << ec.message();
+	}
+	for (const auto& path : {alias, escape}) {
+		const auto [included, sfPath] = resolver.Classify(path);
+		EXPECT_EQ(included, cfg.ShouldIncludeInReportByPath(path)) << path.string();
+		EXPECT_EQ(sfPath, cfg.MakeSFPath(path)) << path.string();
+		std::pmr::string utf8;
+		EXPECT_EQ(resolver.Classify(path, utf8), included) << path.string();
+		EXPECT_EQ(std::string_view{utf8}, included ? sfPath.generic_string() : "") << path.string();
+	}
+	EXPECT_EQ(resolver.Classify(alias).sfPath.generic_wstring(), L"src/a.cpp");
+	EXPECT_FALSE(resolver.Classify(escape).included);
+
+	fs::remove_all(root);
+}
+
+TEST(ParallelRendererTest, SinkReceivesChunksInOrder) {
+	std::string rendered;
+	std::size_t logged = 0;
+	auto render = [](std::size_t begin, std::size_t end, RenderedChunk& chunk) {
+		for (auto i = begin; i < end; ++i) {
+			chunk.records.AppendUInt(i);
+			chunk.records.Append('\n');
+			chunk.log.AddMsg(ExporterConfigLog::MsgLevel::Info, std::to_string(i));
+		}
+	};
+	auto sink = [&](RenderedChunk& chunk) {
+		rendered.append(chunk.records.View());
+		for (const auto& [level, msg] : chunk.log.messages)
+			ASSERT_EQ(msg, std::to_string(logged++));
+	};
+
+	std::string expected;
+	for (int i = 0; i < 1000; ++i)
+		expected += std::to_string(i) + "\n";
+	// One renderer for several runs, as in an export; a run that throws leaves nothing behind for the next one.
+	for (unsigned threads : {1u, 4u}) {
+		ParallelRenderer renderer{threads};
+		for (int run = 0; run < 2; ++run) {
+			rendered.clear();
+			logged = 0;
+			renderer.Run(1000, render, sink);
+			ASSERT_EQ(rendered, expected);
+			ASSERT_EQ(logged, 1000u);
+			EXPECT_THROW(renderer.Run(1000, [&](std::size_t begin, std::size_t end, RenderedChunk& chunk) {
+				render(begin, end, chunk);
+				if (end > 500)
+					throw std::runtime_error("render failed");
+			}, [](RenderedChunk&) {}), std::runtime_error);
+		}
+	}
+}
+
+TEST(LCOVExporterTest, ParallelExportMatchesSerial) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	for (int m = 0; m < 3; ++m) {
+		auto& module = data.AddModule(L"Module" + std::to_wstring(m) + L".exe");
+		for (int f = 0; f < 200; ++f) {
+			auto& file = module.AddFile(fs::current_path() / (L"src" + std::to_wstring(m)) / (L"file" + std::to_wstring(f) + L".cpp"));
+			for (unsigned l = 1; l <= 20; ++l)
+				file.AddLine(l, (l + f) % 3 != 0);
+		}
+	}
+
+	const fs::path outputPath = L"test_parallel.info";
+	ExportWith(data, "threads: 1", outputPath.wstring());
+	const auto serial = ReadFile(outputPath);
+	ASSERT_FALSE(serial.empty());
+	for (const auto* threads : {"threads: 4", "threads: auto"}) {
+		ExportWith(data, threads, outputPath.wstring());
+		ASSERT_EQ(ReadFile(outputPath), serial);
+	}
+	fs::remove(outputPath);
+}
+
+TEST(TracefileMergerTest, MergesHitsPerSourceFile) {
+	TracefileMerger merger{2};
+	merger.AddText("TN:\nSF:b.cpp\nDA:1,1\nDA:2,0\nLF:2\nLH:1\nend_of_record\n"
+		"TN:\nSF:a.cpp\nDA:5,0\nLF:1\nLH:0\nend_of_record\n");
+	merger.AddText("TN:\r\nSF:b.cpp\r\nDA:3,1\r\nDA:2,1\r\nLF:2\r\nLH:2\r\nend_of_record\r\n");
+	ASSERT_EQ(merger.SourceFileCount(), 2u);
+
+	const fs::path outputPath = L"test_merged.info";
+	ASSERT_TRUE(merger.Write(outputPath));
+	const auto content = ReadFile(outputPath);
+	fs::remove(outputPath);
+
+	ASSERT_EQ(content,
+	          "TN:\nSF:a.cpp\nDA:5,0\nLF:1\nLH:0\nend_of_record\n"
+	          "TN:\nSF:b.cpp\nDA:1,1\nDA:2,1\nDA:3,1\nLF:3\nLH:3\nend_of_record\n");
+
+	// Tracefile inputs can be merged into a snapshot too (every hit here is 1, so nothing is lost).
+	const fs::path snapshotPath = L"test_merged.snap";
+	ASSERT_TRUE(merger.Write(snapshotPath));
+	std::string roundTrip;
+	{
+		SnapshotReader snapshot;
+		ASSERT_TRUE(snapshot.Open(snapshotPath));
+		ASSERT_EQ(snapshot.FileCount(), 2u);
+		ASSERT_TRUE(snapshot.WriteLcov(outputPath));
+		roundTrip = ReadFile(outputPath);
+	}
+	fs::remove(outputPath);
+	fs::remove(snapshotPath);
+	ASSERT_EQ(roundTrip, content);
+}
+
+TEST(TracefileMergerTest, AddFilesReportsMissingInput) {
+	TracefileMerger merger;
+	ASSERT_FALSE(merger.AddFiles({L"does_not_exist.info"}));
+	ASSERT_TRUE(merger.Log.HasErrors());
+
+	// A file that parses to no records is an error too, not an empty contribution.
+	const fs::path notTracefile = L"test_not_tracefile.info";
+	std::ofstream(notTracefile) << "not a tracefile\n";
+	TracefileMerger other;
+	ASSERT_FALSE(other.AddFiles({notTracefile}));
+	ASSERT_TRUE(other.Log.HasErrors());
+	fs::remove(notTracefile);
+}
+
+TEST(LCOVExporterTest, IncrementalExportReusesCachedRecords) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"Module.exe");
+	Plugin::FileCoverage* changedFile = nullptr;
+	for (int f = 0; f < 50; ++f) {
+		auto& file = module.AddFile(fs::current_path() / L"src" / (L"file" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= 10; ++l)
+			file.AddLine(l, (l + f) % 2 != 0);
+		if (f == 7)
+			changedFile = &file;
+	}
+
+	const fs::path outputPath = L"test_incremental.info";
+	const auto cachePath = RecordCache::SidecarPath(outputPath);
+	fs::remove(cachePath);
+	// Last "Incremental export reused N of M records" message, so reuse is checked and not just equal output
+	std::string reuse;
+	auto exportWith = [&](const std::string& yaml) {
+		const auto outcome = ExportWith(data, yaml, outputPath.wstring());
+		EXPECT_FALSE(outcome.HasErrors());
+		reuse.clear();
+		for (const auto& [level, msg] : outcome.messages)
+			if (msg.starts_with("Incremental export reused"))
+				reuse = msg;
+		return ReadFile(outputPath);
+	};
+
+	const auto full = exportWith("incremental: false");
+	ASSERT_EQ(exportWith("incremental: true"), full);
+	ASSERT_EQ(reuse, "Incremental export reused 0 of 50 records");
+	ASSERT_TRUE(fs::exists(cachePath));
+	ASSERT_EQ(exportWith("incremental: true\nthreads: 4"), full);
+	ASSERT_EQ(reuse, "Incremental export reused 50 of 50 records");
+
+	// A file whose coverage changed is rendered again; the rest still come from the cache.
+	changedFile->AddLine(11, true);
+	const auto changed = exportWith("incremental: true");
+	ASSERT_EQ(reuse, "Incremental export reused 49 of 50 records");
+	ASSERT_NE(changed, full);
+	ASSERT_EQ(exportWith("incremental: false"), changed);
+
+	fs::remove(outputPath);
+	fs::remove(cachePath);
+}
+
+TEST(CoverageSnapshotTest, ConvertsBackToExportedReport) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"Module.exe");
+	for (int f = 0; f < 20; ++f) {
+		auto& file = module.AddFile(fs::current_path() / L"src" / (L"file" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= 30; ++l)
+			file.AddLine(l * 7 % 31 + 200 * f, (l + f) % 3 != 0);
+	}
+	data.AddModule(L"Other.exe").AddFile(fs::current_path() / L"src" / L"file0.cpp").AddLine(1000, true);
+
+	const fs::path outputPath = L"test_snapshot.info";
+	const auto snapshotPath = SnapshotSidecarPath(outputPath);
+	ExportWith(data, "snapshot: true\nthreads: 4", outputPath.wstring());
+
+	// Readers are scoped so their mappings are released before the files are removed.
+	const fs::path convertedPath = L"test_snapshot_converted.info";
+	const fs::path mergedPath = L"test_snapshot_merged.snap";
+	std::string firstFile;
+	{
+		SnapshotReader snapshot;
+		ASSERT_TRUE(snapshot.Open(snapshotPath));
+		ASSERT_EQ(snapshot.FileCount(), 21u);
+		ASSERT_EQ(snapshot.SourceFile(20), snapshot.SourceFile(0));
+		ASSERT_LT(fs::file_size(snapshotPath) * 3, fs::file_size(outputPath));
+		ASSERT_TRUE(snapshot.WriteLcov(convertedPath));
+		firstFile = snapshot.SourceFile(0);
+	}
+	ASSERT_EQ(ReadFile(convertedPath), ReadFile(outputPath));
+
+	// Merging a snapshot with itself folds the duplicate file and keeps every line.
+	ExporterConfigLog log;
+	ASSERT_TRUE(MergeSnapshots({snapshotPath, snapshotPath}, mergedPath, log));
+	{
+		SnapshotReader merged;
+		ASSERT_TRUE(merged.Open(mergedPath));
+		ASSERT_EQ(merged.FileCount(), 20u);
+		std::vector<LineHits> lines;
+		for (std::size_t i = 0; i < merged.FileCount(); ++i) {
+			if (merged.SourceFile(i) == firstFile) {
+				merged.ReadLines(i, lines);
+				ASSERT_EQ(lines.size(), 31u);
+				ASSERT_EQ(lines.back().line, 1000u);
+				ASSERT_EQ(lines.back().hits, 1u);
+			}
+		}
+	}
+
+	fs::remove(outputPath);
+	fs::remove(snapshotPath);
+	fs::remove(convertedPath);
+	fs::remove(mergedPath);
+}
+
+TEST(PathFilterTest, IncludeAndExcludeRules) {
+	ExporterConfig cfg{fs::temp_directory_path()};
+	cfg.LoadFromYaml(YAML::Load(
+		"include:\n"
+		"  - src/\n"
+		"  - \"**/*.inl\"\n"
+		"exclude:\n"
+		"  - \"**/vcpkg_installed/**\"\n"
+		"  - \"**/*.g.[ch]pp\"\n"
+		"  - src/third_party\n"));
+	ASSERT_FALSE(cfg.Log.HasErrors());
+	ASSERT_FALSE(cfg.Filter().Empty());
+
+	const fs::path root = fs::weakly_canonical(fs::current_path());
+	const std::vector<std::pair<fs::path, bool>> cases = {
+		{root / L"src" / L"main.cpp", true},
+		{root / L"src" / L"deep" / L"dir" / L"a.h", true},
+		{root / L"srcx" / L"main.cpp", false},
+		{root / L"tests" / L"a.cpp", false},
+		{root / L"other" / L"inline.inl", true},
+		{root / L"src" / L"vcpkg_installed" / L"x64" / L"fmt.h", false},
+		{root / L"src" / L"ui" / L"Window.g.cpp", false},
+		{root / L"src" / L"ui" / L"Window.g.h", true},
+		{root / L"src" / L"third_party" / L"zlib.c", false},
+		{root / L"src" / L"third_party_glue.cpp", true},
+	};
+
+	PathResolver resolver{cfg};
+	for (const auto& [path, expected] : cases) {
+		EXPECT_EQ(cfg.Filter().Matches(path), expected) << path.string();
+		EXPECT_EQ(cfg.ShouldIncludeInReportByPath(path), expected) << path.string();
+		EXPECT_EQ(resolver.Classify(path).included, expected) << path.string();
+	}
+}
+
+TEST(GzipWriterTest, GzipExportInflatesToPlainReport) {
+	// Reads a whole (possibly multi-member) gzip file the way zcat does.
+	auto inflateFile = [](const fs::path& path) {
+		std::string text;
+		gzFile in = gzopen(path.string().c_str(), "rb");
+		char chunk[4096];
+		for (int n; in && (n = gzread(in, chunk, sizeof(chunk))) > 0;)
+			text.append(chunk, static_cast<std::size_t>(n));
+		if (in)
+			gzclose(in);
+		return text;
+	};
+
+	// Blocks become separate members but still read back as one stream, in order.
+	const fs::path membersPath = L"test_members.gz";
+	{
+		std::ofstream ofs(membersPath, std::ios::binary);
+		GzipWriter gzip{ofs, 6, 3};
+		for (int block = 0; block < 10; ++block)
+			ASSERT_TRUE(gzip.Write("block " + std::to_string(block) + "\n" + std::string(1000 * block, 'x')));
+		ASSERT_TRUE(gzip.Finish());
+	}
+	std::string expected;
+	for (int block = 0; block < 10; ++block)
+		expected += "block " + std::to_string(block) + "\n" + std::string(1000 * block, 'x');
+	ASSERT_EQ(inflateFile(membersPath), expected);
+
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"Module.exe");
+	for (int f = 0; f < 20; ++f) {
+		auto& file = module.AddFile(fs::current_path() / L"src" / (L"file" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= 10; ++l)
+			file.AddLine(l, (l + f) % 2 != 0);
+	}
+	const fs::path plainPath = L"test_gzip.info";
+	const fs::path gzipPath = L"test_gzip.info.gz";
+	for (const auto& path : {plainPath, gzipPath})
+		EXPECT_FALSE(ExportWith(data, "threads: 2\ncompressionLevel: 9", path.wstring()).HasErrors());
+	const auto plain = ReadFile(plainPath);
+	ASSERT_FALSE(plain.empty());
+	ASSERT_EQ(inflateFile(gzipPath), plain);
+	ASSERT_LT(fs::file_size(gzipPath), fs::file_size(plainPath));
+
+	// lcovMerge reads the compressed report like the plain one.
+	std::string inflated;
+	ASSERT_TRUE(Gunzip(ReadFile(membersPath), inflated));
+	ASSERT_EQ(inflated, expected);
+	const fs::path mergedPath = L"test_gzip_merged.info";
+	for (const auto& path : {plainPath, gzipPath}) {
+		TracefileMerger merger;
+		ASSERT_TRUE(merger.AddFiles({path}));
+		ASSERT_TRUE(merger.Write(mergedPath));
+		ASSERT_EQ(merger.SourceFileCount(), 20u);
+	}
+
+	// Nothing written is still one (empty) gzip member, not a zero-byte file.
+	const fs::path emptyPath = L"test_empty.gz";
+	{
+		std::ofstream ofs(emptyPath, std::ios::binary);
+		GzipWriter gzip{ofs, 6, 2};
+		ASSERT_TRUE(gzip.Finish());
+	}
+	ASSERT_GT(fs::file_size(emptyPath), 0u);
+	ASSERT_TRUE(Gunzip(ReadFile(emptyPath), inflated));
+	ASSERT_TRUE(inflated.empty());
+	ASSERT_FALSE(Gunzip("not gzip", inflated));
+
+	fs::remove(membersPath);
+	fs::remove(plainPath);
+	fs::remove(gzipPath);
+	fs::remove(mergedPath);
+	fs::remove(emptyPath);
+}
+
+TEST(ExportStatsTest, StatsSidecarCountsFiles) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"Module.exe");
+	for (int f = 0; f < 30; ++f) {
+		const auto dir = fs::current_path() / (f % 3 == 0 ? L"other" : L"src");
+		auto& file = module.AddFile(dir / (L"file" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= 5; ++l)
+			file.AddLine(l, l % 2 != 0);
+	}
+
+	const fs::path outputPath = L"test_stats.info";
+	const auto statsPath = ExportStats::SidecarPath(outputPath);
+	fs::remove(statsPath);
+	EXPECT_FALSE(ExportWith(data, "stats: true\nthreads: 2\nexclude: \"**/other/**\"", outputPath.wstring()).HasErrors());
+
+	// The sidecar is JSON, which YAML reads as well.
+	const auto json = YAML::LoadFile(statsPath.string());
+	const auto counters = json["counters"];
+	ASSERT_EQ(counters["filesSeen"].as<int>(), 30);
+	ASSERT_EQ(counters["filesIncluded"].as<int>(), 20);
+	ASSERT_EQ(counters["filesExcluded"].as<int>(), 10);
+	ASSERT_EQ(counters["linesWritten"].as<int>(), 100);
+	ASSERT_EQ(counters["bytesWritten"].as<std::uintmax_t>(), fs::file_size(outputPath));
+	ASSERT_GT(counters["canonicalizations"].as<int>(), 0);
+	ASSERT_GE(json["phasesMs"]["total"].as<double>(), json["phasesMs"]["flush"].as<double>());
+
+	fs::remove(outputPath);
+	fs::remove(statsPath);
+}
+
+TEST(ConfigTreeTest, NearestCovLcovGovernsEachFile) {
+	const auto root = fs::current_path() / L"test_nested";
+	fs::remove_all(root);
+	fs::create_directories(root / L"compA" / L"src");
+	fs::create_directories(root / L"compB" / L"gen");
+	fs::create_directories(root / L"other");
+	std::ofstream(root / L"compA" / L".covlcov") << "baseDir: .\n";
+	std::ofstream(root / L"compB" / L".covlcov") << "exclude: \"**/gen/**\"\n";
+
+	ExporterConfig cfg{root / L"missing"};
+	cfg.LoadFromYaml(YAML::Load("nestedConfigs: true"));
+	ConfigTree tree{cfg};
+
+	const auto inA = tree.Classify(root / L"compA" / L"src" / L"a.cpp");
+	ASSERT_TRUE(inA.included);
+	ASSERT_EQ(inA.sfPath.generic_wstring(), L"src/a.cpp");
+	ASSERT_FALSE(tree.Classify(root / L"compB" / L"gen" / L"x.cpp").included);
+	const auto inB = tree.Classify(root / L"compB" / L"y.cpp");
+	ASSERT_TRUE(inB.included);
+	ASSERT_EQ(inB.sfPath, root / L"compB" / L"y.cpp");
+	// No .covlcov above: the root configuration applies.
+	ASSERT_TRUE(tree.Classify(root / L"other" / L"z.cpp").included);
+	ASSERT_EQ(tree.NestedConfigCount(), 2u);
+
+	// Every directory is probed once, however many files it holds.
+	const auto probes = tree.ProbeCount();
+	for (int f = 0; f < 100; ++f)
+		tree.Classify(root / L"compA" / L"src" / (L"file" + std::to_wstring(f) + L".cpp"));
+	ASSERT_EQ(tree.ProbeCount(), probes);
+	ASSERT_NE(tree.FingerprintFor(root / L"compA" / L"src" / L"a.cpp"), tree.FingerprintFor(root / L"compB" / L"y.cpp"));
+
+	// Only directories are probed: a drive name ("C:") is not, its root directory is.
+	ConfigTree fresh{cfg};
+	fresh.Classify(root / L"other" / L"z.cpp");
+	const auto dir = root / L"other";
+	const auto directories = static_cast<std::uint64_t>(std::distance(dir.begin(), dir.end())) - (dir.has_root_name() ? 1 : 0);
+	ASSERT_EQ(fresh.ProbeCount(), directories);
+
+	fs::remove_all(root);
+}
+
+TEST(ExporterConfigLogTest, LevelsSummariesAndLogFile) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"Module.exe");
+	for (int f = 0; f < 40; ++f) {
+		const auto dir = fs::current_path() / (f < 30 ? L"third_party" : L"src");
+		module.AddFile(dir / (L"file" + std::to_wstring(f) + L".cpp")).AddLine(1, true);
+	}
+	auto count = [](const std::string& text, const std::string& needle) {
+		std::size_t found = 0;
+		for (auto pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1))
+			++found;
+		return found;
+	};
+
+	// Info: one summary for the directory instead of a line per file.
+	auto messages = ExportWith(data, "threads: 2\nexclude: third_party/", L"test_logging.info").Text();
+	ASSERT_EQ(count(messages, "Excluding file"), 0u);
+	ASSERT_EQ(count(messages, "Excluded 30 of 40 files"), 1u);
+	ASSERT_EQ(count(messages, "30 excluded under"), 1u);
+
+	// Error level keeps nothing else on the console, but the log file gets every detail.
+	const auto logPath = fs::current_path() / L"test_logging.log";
+	messages = ExportWith(data, "threads: 2\nexclude: third_party/\nlogLevel: error\nlogFile: " + logPath.string(), L"test_logging.info").Text();
+	ASSERT_TRUE(messages.empty());
+	const auto logged = ReadFile(logPath);
+	ASSERT_EQ(count(logged, "Excluding file"), 30u);
+	ASSERT_EQ(count(logged, "Excluded 30 of 40 files"), 1u);
+
+	// The console buffer is bounded; errors are always kept.
+	ExporterConfigLog log;
+	for (std::size_t i = 0; i < ExporterConfigLog::MaxMessages * 2; ++i)
+		log.AddMsg(ExporterConfigLog::MsgLevel::Info, [&] { return std::to_string(i); });
+	log.AddMsg(ExporterConfigLog::MsgLevel::Error, "error");
+	ASSERT_EQ(log.messages.size(), ExporterConfigLog::MaxMessages + 1);
+	ASSERT_TRUE(log.HasErrors());
+
+	fs::remove(L"test_logging.info");
+	fs::remove(logPath);
+}
+
+TEST(ExporterConfigLogTest, MalformedValuesAreLogged) {
+	ExporterConfig cfg{fs::temp_directory_path()};
+	ASSERT_NO_THROW(cfg.LoadFromYaml(YAML::Load(
+		"stats: maybe\n"
+		"threads: [1, 2]\n"
+		"include:\n"
+		"  - {a: b}\n"
+		"profile: compact\n")));
+	ASSERT_TRUE(cfg.Log.HasErrors());
+	auto logged = [&](const std::string& needle) {
+		return std::any_of(cfg.Log.messages.begin(), cfg.Log.messages.end(), [&](const auto& message) {
+			return message.first == ExporterConfigLog::MsgLevel::Error && message.second.find(needle) != std::string::npos;
+		});
+	};
+	ASSERT_TRUE(logged("stats must be true or false, got: maybe"));
+	ASSERT_TRUE(logged("threads"));
+	ASSERT_TRUE(logged("include"));
+
+	// Invalid keys keep their defaults; valid ones are still applied.
+	ASSERT_FALSE(cfg.Stats());
+	ASSERT_TRUE(cfg.Filter().Empty());
+	ASSERT_EQ(cfg.Profile(), OutputProfile::Compact);
+}
+
+TEST(ShardPlanTest, ShardsAreStandaloneTracefiles) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	for (int m = 0; m < 4; ++m) {
+		auto& module = data.AddModule(L"Module" + std::to_wstring(m) + L".dll");
+		for (int f = 0; f < 10; ++f) {
+			auto& file = module.AddFile(fs::current_path() / (L"dir" + std::to_wstring(f % 3)) / (L"m" + std::to_wstring(m) + L"f" + std::to_wstring(f) + L".cpp"));
+			for (unsigned l = 1; l <= 5; ++l)
+				file.AddLine(l, (l + f) % 2 != 0);
+		}
+	}
+	// Excluded files take no place in a shard's file count.
+	auto& vendor = data.AddModule(L"Vendor.dll");
+	for (int f = 0; f < 5; ++f)
+		vendor.AddFile(fs::current_path() / L"vendor" / (L"v" + std::to_wstring(f) + L".cpp")).AddLine(1, true);
+
+	ASSERT_EQ(ShardPath(L"out/coverage.info", 3), fs::path(L"out/coverage.3.info"));
+	ASSERT_EQ(ShardPath(L"coverage.info.gz", 0), fs::path(L"coverage.0.info.gz"));
+	ASSERT_EQ(ShardPath(L"cov.v2.info", 1), fs::path(L"cov.v2.1.info"));
+	ASSERT_EQ(ShardPath(L"out/coverage", 2), fs::path(L"out/coverage.2"));
+	ASSERT_EQ(ShardPath(L"coverage.gz", 2), fs::path(L"coverage.2.gz"));
+
+	const fs::path outputPath = L"test_shards.info";
+	for (const auto* shardBy : {"module", "directory", "hash"}) {
+		const auto outcome = ExportWith(data, std::string("threads: 2\nshards: 3\nexclude: \"**/vendor/**\"\nshardBy: ") + shardBy, outputPath.wstring());
+		EXPECT_FALSE(outcome.HasErrors());
+		const auto& result = outcome.result;
+		ASSERT_EQ(*result, ShardManifestPath(outputPath));
+
+		// Every file lands in exactly one shard, as a complete record.
+		TracefileMerger merger{1};
+		std::size_t records = 0;
+		const auto manifest = YAML::LoadFile(result->string());
+		ASSERT_EQ(manifest["shards"].size(), 3u);
+		for (std::size_t shard = 0; shard < 3; ++shard) {
+			const auto text = ReadFile(ShardPath(outputPath, shard));
+			ASSERT_EQ(manifest["shards"][shard]["path"].as<std::string>(), ShardPath(outputPath, shard).string());
+			ASSERT_EQ(manifest["shards"][shard]["bytes"].as<std::size_t>(), text.size());
+			std::size_t shardRecords = 0;
+			for (auto pos = text.find("end_of_record"); pos != std::string::npos; pos = text.find("end_of_record", pos + 1))
+				++shardRecords;
+			ASSERT_EQ(manifest["shards"][shard]["files"].as<std::size_t>(), shardRecords);
+			records += shardRecords;
+			merger.AddText(text);
+			fs::remove(ShardPath(outputPath, shard));
+		}
+		ASSERT_EQ(records, 40u);
+		ASSERT_EQ(merger.SourceFileCount(), 40u);
+		if (std::string(shardBy) == "module") {
+			// Whole modules stay together: ten files per module, so no shard holds a partial module.
+			for (const auto& shard : manifest["shards"])
+				ASSERT_EQ(shard["files"].as<int>() % 10, 0);
+		}
+		fs::remove(*result);
+	}
+}
+
+TEST(PatchCoverageTest, ChangedLinesOfTouchedFilesOnly) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"TestModule.exe");
+	auto& changed = module.AddFile(fs::current_path() / L"src" / L"changed.cpp");
+	for (unsigned l = 1; l <= 10; ++l)
+		changed.AddLine(l, l % 2 != 0);
+	auto& untouched = module.AddFile(fs::current_path() / L"src" / L"untouched.cpp");
+	untouched.AddLine(1, false);
+	// Ends with the diff path too, but src/changed.cpp is the file the diff names.
+	module.AddFile(fs::current_path() / L"third_party" / L"src" / L"changed.cpp").AddLine(2, true);
+
+	// Adds lines 2-3 and replaces line 8; the file outside the coverage data is ignored.
+	const fs::path diffPath = L"test_patch.diff";
+	std::ofstream(diffPath, std::ios::binary) << "diff --git a/src/changed.cpp b/src/changed.cpp\n"
+		"--- a/src/changed.cpp\n+++ b/src/changed.cpp\n"
+		"@@ -1,2 +1,4 @@\n line1\n+line2\n+line3\n line4\n"
+		"@@ -6,3 +8,3 @@ int f()\n-old8\n+line8\n line9\n line10\n"
+		"--- /dev/null\n+++ b/docs/notes.md\n@@ -0,0 +1 @@\n+notes\n";
+
+	const fs::path outputPath = L"test_patch.info";
+	const auto outcome = ExportWith(data, "", outputPath.wstring() + L";diff=" + diffPath.wstring());
+	EXPECT_FALSE(outcome.HasErrors());
+	ASSERT_EQ(*outcome.result, outputPath);
+
+	const auto report = YAML::LoadFile(PatchCoverage::JsonPath(outputPath).string());
+	ASSERT_EQ(report["linesFound"].as<int>(), 3);
+	ASSERT_EQ(report["linesHit"].as<int>(), 1);
+	ASSERT_EQ(report["files"].size(), 1u);
+	ASSERT_EQ(report["files"][0]["uncovered"].size(), 2u);
+	ASSERT_EQ(report["files"][0]["uncovered"][0].as<int>(), 2);
+	ASSERT_EQ(report["files"][0]["uncovered"][1].as<int>(), 8);
+
+	ASSERT_EQ(ReadFile(PatchCoverage::LcovPath(outputPath)), "TN:\nSF:" + (fs::current_path() / L"src" / L"changed.cpp").generic_string() +
+	                                                         "\nDA:2,0\nDA:3,1\nDA:8,0\nLF:3\nLH:1\nend_of_record\n");
+
+	// A path only suffixes match counts when one report file does, and is reported when several do.
+	Plugin::CoverageData moved{L"TestRun", 0};
+	auto& movedModule = moved.AddModule(L"TestModule.exe");
+	movedModule.AddFile(fs::current_path() / L"app" / L"tools" / L"gen.cpp").AddLine(1, true);
+	for (const auto* copy : {L"a", L"b"})
+		movedModule.AddFile(fs::current_path() / copy / L"lib" / L"util.cpp").AddLine(1, false);
+	std::ofstream(diffPath, std::ios::binary) << "--- a/tools/gen.cpp\n+++ b/tools/gen.cpp\n@@ -1 +1 @@\n-old\n+new\n"
+		"--- a/lib/util.cpp\n+++ b/lib/util.cpp\n@@ -1 +1 @@\n-old\n+new\n";
+	std::size_t ambiguous = 0;
+	for (const auto& [level, msg] : ExportWith(moved, "", outputPath.wstring() + L";diff=" + diffPath.wstring()).messages)
+		ambiguous += level == ExporterConfigLog::MsgLevel::Error && msg.find("lib/util.cpp in the diff matches 2 report files") != std::string::npos;
+	EXPECT_EQ(ambiguous, 1u);
+	const auto suffixReport = YAML::LoadFile(PatchCoverage::JsonPath(outputPath).string());
+	ASSERT_EQ(suffixReport["files"].size(), 1u);
+	ASSERT_EQ(suffixReport["files"][0]["path"].as<std::string>(), (fs::current_path() / L"app" / L"tools" / L"gen.cpp").generic_string());
+	ASSERT_EQ(suffixReport["linesFound"].as<int>(), 1);
+
+	for (const auto& path : {outputPath, PatchCoverage::JsonPath(outputPath), PatchCoverage::LcovPath(outputPath), diffPath})
+		fs::remove(path);
+}
+
+TEST(LineBitmapTest, MergeDuplicatesUnionsSharedFiles) {
+	LineBitmap bitmap;
+	bitmap.Add({{70, false}, {130, true}});
+	bitmap.Add({{3, true}, {70, true}, {131, false}});
+	const auto lines = bitmap.Lines();
+	ASSERT_EQ(lines.size(), 4u);
+	ASSERT_EQ(bitmap.LineCount(), 4u);
+	ASSERT_EQ(lines[0].GetLineNumber(), 3u);
+	ASSERT_TRUE(lines[1].HasBeenExecuted());
+	ASSERT_EQ(lines[3].GetLineNumber(), 131u);
+
+	Plugin::CoverageData data{L"TestRun", 0};
+	const auto shared = fs::current_path() / L"include" / L"shared.h";
+	for (int m = 0; m < 3; ++m) {
+		auto& module = data.AddModule(L"Module" + std::to_wstring(m) + L".dll");
+		auto& file = module.AddFile(shared);
+		file.AddLine(1, m == 0);
+		file.AddLine(2, m == 2);
+		file.AddLine(3, false);
+		module.AddFile(fs::current_path() / (L"own" + std::to_wstring(m) + L".cpp")).AddLine(1, true);
+	}
+
+	const fs::path outputPath = L"test_merge_duplicates.info";
+	EXPECT_FALSE(ExportWith(data, "threads: 2\nmergeDuplicates: true", outputPath.wstring()).HasErrors());
+	const auto text = ReadFile(outputPath);
+	const auto sf = "SF:" + shared.generic_string() + "\n";
+	ASSERT_EQ(text.find(sf), text.rfind(sf));
+	ASSERT_NE(text.find(sf + "DA:1,1\nDA:2,1\nDA:3,0\nLF:3\nLH:2\n"), std::string::npos);
+	ASSERT_NE(text.find("own2.cpp"), std::string::npos);
+	fs::remove(outputPath);
+}
+
+TEST(AsyncWriterTest, BlocksInOrderAndErrorsReported) {
+	std::ostringstream out;
+	AsyncWriter writer{out, 2, 16};
+	std::string expected;
+	for (int i = 0; i < 100; ++i) {
+		std::string block = "block " + std::to_string(i) + "\n";
+		expected += block;
+		ASSERT_TRUE(writer.Write(block));
+		ASSERT_TRUE(block.empty());
+	}
+	ASSERT_TRUE(writer.Finish());
+	ASSERT_EQ(out.str(), expected);
+
+	std::ostringstream broken;
+	broken.setstate(std::ios::badbit);
+	AsyncWriter failing{broken, 2, 16};
+	std::string block = "lost";
+	failing.Write(block);
+	ASSERT_FALSE(failing.Finish());
+
+	// A report that cannot be created is logged and yields no output path.
+	Plugin::CoverageData data{L"TestRun", 0};
+	data.AddModule(L"TestModule.exe").AddFile(fs::current_path() / L"a.cpp").AddLine(1, true);
+	const auto outcome = ExportWith(data, "", (fs::current_path() / L"missing_dir" / L"out.info").wstring());
+	ASSERT_FALSE(outcome.result.has_value());
+	ASSERT_TRUE(outcome.HasErrors());
+}
+
+TEST(MappedOutputTest, PreallocatedReportMatchesStreamedReport) {
+	const std::vector<Plugin::LineCoverage> lines{{1, true}, {9, false}, {10, true}, {12345, true}};
+	RecordBuffer record;
+	RenderFileRecord(record, L"src/module.cpp", lines);
+	ASSERT_EQ(FileRecordSize(std::string_view("src/module.cpp").size(), lines), record.Size());
+
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"TestModule.exe");
+	for (int f = 0; f < 50; ++f) {
+		auto& file = module.AddFile(fs::current_path() / (f % 5 == 0 ? L"skip" : L"src") / (L"f" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= static_cast<unsigned>(f * 7 + 1); ++l)
+			file.AddLine(l * 3, (l + f) % 3 != 0);
+	}
+
+	const fs::path outputPath = L"test_mapped.info";
+	auto outcome = ExportWith(data, "threads: 3\nexclude: [\"skip/**\"]", outputPath.wstring());
+	EXPECT_FALSE(outcome.HasErrors());
+	const auto streamed = ReadFile(outputPath);
+	outcome = ExportWith(data, "threads: 3\nexclude: [\"skip/**\"]\npreallocate: true", outputPath.wstring());
+	EXPECT_FALSE(outcome.HasErrors());
+	EXPECT_EQ(outcome.result, outputPath);
+	ASSERT_FALSE(streamed.empty());
+	ASSERT_EQ(ReadFile(outputPath), streamed);
+	fs::remove(outputPath);
+}
+
+TEST(BinaryCoverageTest, DecodesOpenCppCoverageBinaryExport) {
+	// Length-delimited protobuf messages, as OpenCppCoverage's binary exporter writes them.
+	auto varint = [](std::string& out, std::uint64_t value) {
+		for (; value >= 0x80; value >>= 7)
+			out.push_back(static_cast<char>(value | 0x80));
+		out.push_back(static_cast<char>(value));
+	};
+	auto bytesField = [&](std::string& out, int field, const std::string& bytes) {
+		varint(out, field << 3 | 2);
+		varint(out, bytes.size());
+		out += bytes;
+	};
+	auto varintField = [&](std::string& out, int field, std::uint64_t value) {
+		varint(out, field << 3);
+		varint(out, value);
+	};
+	auto message = [&](std::string& out, const std::string& body) {
+		varint(out, body.size());
+		out += body;
+	};
+
+	const auto source = (fs::current_path() / L"src" / L"main.cpp").generic_string();
+	std::string file = "BinaryCoverageMarker";
+	std::string body;
+	bytesField(body, 1, "Run");
+	varintField(body, 2, 1);
+	varintField(body, 3, static_cast<std::uint64_t>(-3));
+	message(file, body);
+	body.clear();
+	bytesField(body, 1, "App.exe");
+	varintField(body, 2, 1);
+	message(file, body);
+	body.clear();
+	bytesField(body, 1, source);
+	for (const auto& [line, executed] : {std::pair{3, 1}, std::pair{4, 0}, std::pair{200, 1}}) {
+		std::string lineBody;
+		varintField(lineBody, 1, line);
+		varintField(lineBody, 2, executed);
+		bytesField(body, 2, lineBody);
+	}
+	message(file, body);
+
+	const auto data = DecodeBinaryCoverage(file);
+	ASSERT_NE(data, nullptr);
+	ASSERT_EQ(data->GetName(), L"Run");
+	ASSERT_EQ(data->GetExitCode(), -3);
+	ASSERT_EQ(data->GetModules().size(), 1u);
+	const auto& files = data->GetModules()[0]->GetFiles();
+	ASSERT_EQ(files.size(), 1u);
+	ASSERT_EQ(files[0]->GetPath().generic_string(), source);
+	ASSERT_EQ(files[0]->GetLines().size(), 3u);
+	ASSERT_TRUE(files[0]->GetLines()[2].HasBeenExecuted());
+	ASSERT_EQ(DecodeBinaryCoverage(file.substr(0, file.size() - 1)), nullptr);
+
+	// Written to disk and exported like the in-process plugin would.
+	const fs::path binaryPath = L"test_binary.cov";
+	std::ofstream(binaryPath, std::ios::binary) << file;
+	ExporterConfigLog log;
+	const auto read = ReadBinaryCoverage(binaryPath, log);
+	ASSERT_NE(read, nullptr);
+	const fs::path outputPath = L"test_binary.info";
+	ASSERT_EQ(ExportWith(*read, "", outputPath.wstring()).result, outputPath);
+	ASSERT_EQ(ReadFile(outputPath), "TN:\nSF:" + source + "\nDA:3,1\nDA:4,0\nDA:200,1\nLF:3\nLH:2\nend_of_record\n");
+
+	// Module by module: nothing is handed out from a file that does not decode to the end.
+	std::vector<std::size_t> lineCounts;
+	auto countLines = [&](const Plugin::ModuleCoverage& module) { lineCounts.push_back(module.GetFiles()[0]->GetLines().size()); };
+	ASSERT_TRUE(ReadBinaryCoverageModules(binaryPath, log, countLines));
+	ASSERT_EQ(lineCounts, std::vector<std::size_t>{3});
+	std::ofstream(binaryPath, std::ios::binary | std::ios::app) << '\x01';
+	ASSERT_FALSE(ReadBinaryCoverageModules(binaryPath, log, countLines));
+	ASSERT_EQ(lineCounts.size(), 1u);
+	fs::remove(outputPath);
+	fs::remove(binaryPath);
+}
+
+TEST(ReportSummaryTest, OffsetsAndDirectoryRollups) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"TestModule.exe");
+	const std::vector<fs::path> sources{L"summary/a/x.cpp", L"summary/a/b/y.cpp", L"summary/a/b/z.cpp", L"summary/c/w.cpp"};
+	for (std::size_t f = 0; f < sources.size(); ++f) {
+		auto& file = module.AddFile(fs::current_path() / sources[f]);
+		for (unsigned l = 1; l <= 4 + f; ++l)
+			file.AddLine(l, l % 2 == 0);
+	}
+
+	const fs::path outputPath = L"test_summary.info";
+	// The second export reuses cached records; offsets must hold for them too.
+	for (int run = 0; run < 2; ++run) {
+		EXPECT_FALSE(ExportWith(data, "threads: 2\nsummary: true\nincremental: true\ninclude: [\"summary/**\"]", outputPath.wstring()).HasErrors());
+		const auto report = ReadFile(outputPath);
+		const auto summary = YAML::LoadFile(ReportSummary::SidecarPath(outputPath).string());
+		ASSERT_EQ(summary["files"].as<int>(), 4);
+		ASSERT_EQ(summary["lf"].as<int>(), 4 + 5 + 6 + 7);
+		ASSERT_EQ(summary["lh"].as<int>(), 2 + 2 + 3 + 3);
+		for (const auto& file : summary["sourceFiles"]) {
+			const auto record = report.substr(file["offset"].as<std::size_t>(), file["bytes"].as<std::size_t>());
+			ASSERT_EQ(record.rfind("TN:\nSF:" + file["path"].as<std::string>() + "\n", 0), 0u);
+			ASSERT_TRUE(record.ends_with("end_of_record\n"));
+			ASSERT_NE(record.find("LF:" + file["lf"].as<std::string>() + "\nLH:" + file["lh"].as<std::string>()), std::string::npos);
+		}
+
+		std::map<std::string, std::pair<int, int>> dirs;
+		for (const auto& dir : summary["directories"])
+			dirs[dir["path"].as<std::string>()] = {dir["files"].as<int>(), dir["lf"].as<int>()};
+		const auto root = (fs::current_path() / L"summary").generic_string();
+		ASSERT_EQ(dirs[root], std::make_pair(4, 22));
+		ASSERT_EQ(dirs[root + "/a"], std::make_pair(3, 15));
+		ASSERT_EQ(dirs[root + "/a/b"], std::make_pair(2, 11));
+		ASSERT_EQ(dirs[root + "/c"], std::make_pair(1, 7));
+	}
+
+	// A serial export renders in several chunks through one reused chunk object; nothing may be counted twice.
+	Plugin::CoverageData many{L"TestRun", 0};
+	auto& manyModule = many.AddModule(L"TestModule.exe");
+	for (int f = 0; f < 600; ++f)
+		manyModule.AddFile(fs::current_path() / L"summary" / (L"f" + std::to_wstring(f) + L".cpp")).AddLine(1, true);
+	ExportWith(many, "threads: 1\nsummary: true", outputPath.wstring());
+	const auto summary = YAML::LoadFile(ReportSummary::SidecarPath(outputPath).string());
+	EXPECT_EQ(summary["files"].as<int>(), 600);
+	EXPECT_EQ(summary["sourceFiles"].size(), 600u);
+	for (const auto& path : {outputPath, ReportSummary::SidecarPath(outputPath), RecordCache::SidecarPath(outputPath)})
+		fs::remove(path);
+}
+
+TEST(ExportSessionTest, ScratchClassifyMatchesPathClassify) {
+	const fs::path root = fs::temp_directory_path() / L"covlcov_session_test";
+	fs::remove_all(root);
+	fs::create_directories(root / L"project" / L"src" / L"gen");
+	std::ofstream(root / L"project" / L".covlcov") << "includeByBaseDir: true\nexclude:\n  - src/gen\n";
+
+	ExporterConfig cfg{root / L"project"};
+	ASSERT_TRUE(cfg.IsLoaded());
+	PathResolver resolver{cfg};
+	ExportSession session;
+
+	const fs::path paths[] = {
+		root / L"project" / L"main.cpp",
+		root / L"project" / L"src" / L"a.cpp",
+		root / L"project" / L"src" / L"b.cpp",
+		root / L"project" / L"src" / L"gen" / L"c.cpp",
+		root / L"project" / L"src" / L".." / L"d.cpp",
+		root / L"other" / L"e.cpp",
+	};
+	for (const auto& path : paths) {
+		const auto scratch = session.Borrow();
+		std::pmr::string sfPath{scratch->Resource()};
+		const auto [included, expected] = resolver.Classify(path);
+		EXPECT_EQ(resolver.Classify(path, sfPath), included) << path.string();
+		RecordBuffer utf8;
+		if (included)
+			utf8.AppendUtf8(expected.generic_wstring());
+		EXPECT_EQ(std::string_view{sfPath}, utf8.View()) << path.string();
+	}
+	std::pmr::string sfPath;
+	EXPECT_TRUE(resolver.Classify(paths[4], sfPath));
+	EXPECT_EQ(sfPath, "d.cpp");
+
+	// Leases are given back rewound and reused; kept text lives as long as the session.
+	EXPECT_EQ(session.ScratchCount(), 1u);
+	{
+		const auto first = session.Borrow();
+		const auto second = session.Borrow();
+		EXPECT_EQ(session.ScratchCount(), 2u);
+	}
+	const auto kept = session.Keep("src/a.cpp");
+	for (int i = 0; i < 100; ++i)
+		session.Keep(std::string(64, 'x'));
+	EXPECT_EQ(kept, "src/a.cpp");
+
+	fs::remove_all(root);
+}
+
+TEST(ReportIndexTest, LooksUpRecordsByPath) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	for (int m = 0; m < 2; ++m) {
+		auto& module = data.AddModule(L"Module" + std::to_wstring(m) + L".dll");
+		for (int f = 0; f < 50; ++f) {
+			auto& file = module.AddFile(fs::current_path() / L"indexed" / (L"f" + std::to_wstring(49 - f) + L".cpp"));
+			for (unsigned l = 1; l <= 3; ++l)
+				file.AddLine(l, l == static_cast<unsigned>(1 + m) || f == 0);
+		}
+	}
+
+	const fs::path outputPath = L"test_index.info";
+	EXPECT_FALSE(ExportWith(data, "threads: 2\nindex: true", outputPath.wstring()).HasErrors());
+
+	ReportIndex index;
+	ASSERT_TRUE(index.Open(outputPath));
+	ASSERT_EQ(index.Size(), 100u);
+	for (std::size_t i = 1; i < index.Size(); ++i)
+		ASSERT_LE(index.At(i - 1).sfPath, index.At(i).sfPath);
+
+	// Each file is listed by both modules; its lines are summed over the two records.
+	const auto sfPath = (fs::current_path() / L"indexed" / L"f7.cpp").generic_string();
+	const auto [first, last] = index.Find(sfPath);
+	EXPECT_EQ(last - first, 2u);
+	EXPECT_EQ(index.At(first).linesFound, 3u);
+	EXPECT_EQ(index.At(first).linesHit, 1u);
+	EXPECT_TRUE(index.Record(index.At(first)).starts_with("TN:\nSF:" + sfPath + "\n"));
+	std::vector<LineHits> lines;
+	ASSERT_TRUE(index.Lines(sfPath, lines));
+	ASSERT_EQ(lines.size(), 3u);
+	EXPECT_EQ(lines[0].hits, 1u);
+	EXPECT_EQ(lines[1].hits, 1u);
+	EXPECT_EQ(lines[2].hits, 0u);
+	EXPECT_FALSE(index.Lines(sfPath + ".bak", lines));
+
+	// An index no longer matching its report is refused.
+	index.Close();
+	std::ofstream(outputPath, std::ios::binary | std::ios::app) << "TN:\n";
+	EXPECT_FALSE(index.Open(outputPath));
+}
+
+TEST(CoverageGateTest, ThresholdsCheckedWhileExporting) {
+	Plugin::CoverageData data{L"TestRun", 0};
+	auto& module = data.AddModule(L"TestModule.exe");
+	// gated/core: 160 of 200 lines hit; gated/util: 93 of 100, u0.cpp alone 3 of 10.
+	for (int f = 0; f < 20; ++f) {
+		auto& file = module.AddFile(fs::current_path() / L"gated" / L"core" / (L"c" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= 10; ++l)
+			file.AddLine(l, l <= 8);
+	}
+	for (int f = 0; f < 10; ++f) {
+		auto& file = module.AddFile(fs::current_path() / L"gated" / L"util" / (L"u" + std::to_wstring(f) + L".cpp"));
+		for (unsigned l = 1; l <= 10; ++l)
+			file.AddLine(l, f != 0 || l <= 3);
+	}
+
+	const fs::path outputPath = L"test_gate.info";
+	const auto root = (fs::current_path() / L"gated").generic_string();
+	auto gateYaml = [&](const std::string& core) {
+		return "threads: 2\nthresholds:\n  total: 70\n  file: 50\n"
+		       "  directories:\n    " + root + "/core: " + core + "\n    " + root + "/util/: 90\n    " + root + "/missing: 50\n"
+		       "  files:\n    " + root + "/util/u0.cpp: 30\n";
+	};
+
+	// The directory misses its minimum: the report is still written, then the export fails.
+	auto outcome = ExportWith(data, gateYaml("90"), outputPath.wstring());
+	EXPECT_TRUE(outcome.gateFailed);
+	EXPECT_FALSE(outcome.result);
+	EXPECT_TRUE(outcome.HasErrors());
+	auto text = outcome.Text();
+	EXPECT_NE(text.find("Coverage thresholds: FAILED (4 of 5 met)"), std::string::npos);
+	EXPECT_NE(text.find("LCOV Exporter: 1 of 5 coverage thresholds not met"), std::string::npos);
+	EXPECT_NE(text.find("directory " + root + "/core: 80.00% (160 of 200 lines), minimum 90% - FAILED"), std::string::npos);
+	EXPECT_NE(text.find("directory " + root + "/util: 93.00% (93 of 100 lines), minimum 90% - passed"), std::string::npos);
+	EXPECT_NE(text.find(root + "/missing: no files in the report"), std::string::npos);
+	// u0.cpp has its own minimum and is not held to the per-file one.
+	EXPECT_NE(text.find("file " + root + "/util/u0.cpp: 30.00% (3 of 10 lines), minimum 30% - passed"), std::string::npos);
+	EXPECT_NE(text.find("0 files below the per-file minimum of 50% - passed"), std::string::npos);
+	const auto report = ReadFile(outputPath);
+	std::size_t records = 0;
+	for (auto pos = report.find("end_of_record"); pos != std::string::npos; pos = report.find("end_of_record", pos + 1))
+		++records;
+	EXPECT_EQ(records, 30u);
+
+	outcome = ExportWith(data, gateYaml("80"), outputPath.wstring());
+	EXPECT_FALSE(outcome.gateFailed);
+	EXPECT_EQ(outcome.result, outputPath);
+	EXPECT_FALSE(outcome.HasErrors());
+	text = outcome.Text();
+	EXPECT_NE(text.find("Coverage thresholds: PASSED (5 of 5 met)"), std::string::npos);
+
+	// The gate on its own: a file below the floor is listed.
+	CoverageThresholds thresholds;
+	thresholds.file = 50;
+	CoverageGate gate{thresholds};
+	gate.Add("a.cpp", 10, 4);
+	gate.Add("b.cpp", 0, 0);
+	gate.Add("c.cpp", 10, 5);
+	ExporterConfigLog log;
+	EXPECT_FALSE(gate.Evaluate(log));
+	EXPECT_EQ(gate.FailedCount(), 1u);
+	ASSERT_EQ(log.messages.size(), 3u);
+	EXPECT_EQ(log.messages[2].second, "    a.cpp: 40.00% (4 of 10 lines)");
+
+	ExporterConfig invalid{fs::temp_directory_path()};
+	invalid.LoadFromYaml(YAML::Load("thresholds:\n  total: 120\n  directories:\n    src: high\n"));
+	EXPECT_TRUE(invalid.Log.HasErrors());
+	EXPECT_TRUE(invalid.Thresholds().Empty());
+
+	fs::remove(outputPath);
+}
+
+TEST(TracefileWriterTest, StreamedModulesMatchExport) {
+	// The same run, as a whole and as modules built and freed one at a time.
+	auto fill = [](Plugin::ModuleCoverage& module, int m) {
+		for (int f = 0; f < 300; ++f) {
+			// shared.h is compiled into every module
+			auto& file = module.AddFile(fs::current_path() / L"streamed" / (f == 0 ? L"shared.h" : L"m" + std::to_wstring(m) + L"_" + std::to_wstring(f) + L".cpp"));
+			for (unsigned l = 1; l <= 5; ++l)
+				file.AddLine(l + static_cast<unsigned>(m), (l + f + m) % 3 == 0);
+		}
+	};
+	Plugin::CoverageData data{L"TestRun", 0};
+	for (int m = 0; m < 3; ++m)
+		fill(data.AddModule(L"Module" + std::to_wstring(m) + L".dll"), m);
+
+	const fs::path exportedPath = L"test_exported.info";
+	const fs::path streamedPath = L"test_streamed.info";
+	// Plain output is written module by module; mergeDuplicates makes the writer keep copies until Finish.
+	for (const std::string yaml : {"threads: 2\nsummary: true", "threads: 2\nmergeDuplicates: true\nsummary: true"}) {
+		ASSERT_EQ(ExportWith(data, yaml, exportedPath.wstring()).result, exportedPath);
+		const auto exportedSummary = ReadFile(ReportSummary::SidecarPath(exportedPath));
+
+		ExporterConfig cfg{fs::temp_directory_path()};
+		cfg.LoadFromYaml(YAML::Load(yaml));
+		TracefileWriter writer{cfg, streamedPath};
+		for (int m = 0; m < 3; ++m) {
+			auto module = std::make_unique<Plugin::ModuleCoverage>(L"Module" + std::to_wstring(m) + L".dll");
+			fill(*module, m);
+			writer.BeginModule(module->GetPath());
+			for (const auto& file : module->GetFiles())
+				writer.AddFile(*file);
+			writer.EndModule();
+		}
+		// A file added outside a module is left out of the report, with an error.
+		Plugin::ModuleCoverage stray{L"Stray.dll"};
+		writer.AddFile(stray.AddFile(fs::current_path() / L"streamed" / L"stray.cpp"));
+		ASSERT_EQ(writer.Finish(), streamedPath);
+		ASSERT_EQ(std::ranges::count_if(cfg.Log.messages, [](const auto& message) { return message.first == ExporterConfigLog::MsgLevel::Error; }), 1);
+		EXPECT_TRUE(std::ranges::any_of(cfg.Log.messages, [](const auto& message) {
+			return message.second == "LCOV Exporter: 1 files were added outside BeginModule/EndModule and are not in the report";
+		}));
+
+		const auto exported = ReadFile(exportedPath);
+		ASSERT_EQ(ReadFile(streamedPath), exported);
+		// The summary differs only in the report it names.
+		auto streamedSummary = ReadFile(ReportSummary::SidecarPath(streamedPath));
+		const auto name = streamedSummary.find("test_streamed.info");
+		ASSERT_NE(name, std::string::npos);
+		streamedSummary.replace(name, std::string("test_streamed.info").size(), "test_exported.info");
+		ASSERT_EQ(streamedSummary, exportedSummary);
+	}
+	for (const auto& path : {exportedPath, streamedPath, ReportSummary::SidecarPath(exportedPath), ReportSummary::SidecarPath(streamedPath)})
+		fs::remove(path);
+}
+
+TEST(TestIndexTest, PicksTestsThatExecutedChangedLines) {
+	// Alpha runs lines 1-5 of a.cpp, Beta lines 5-10 and line 3 of b.cpp.
+	auto run = [](const std::wstring& name, unsigned firstHit, unsigned lastHit, bool withB) {
+		auto data = std::make_unique<Plugin::CoverageData>(name, 0);
+		auto& module = data->AddModule(L"Tests.exe");
+		auto& a = module.AddFile(fs::current_path() / L"impact" / L"a.cpp");
+		for (unsigned l = 1; l <= 10; ++l)
+			a.AddLine(l, l >= firstHit && l <= lastHit);
+		auto& b = module.AddFile(fs::current_path() / L"impact" / L"b.cpp");
+		for (unsigned l = 1; l <= 4; ++l)
+			b.AddLine(l, withB && l == 3);
+		return data;
+	};
+	const fs::path indexPath = L"test_impact.idx";
+	const fs::path outputPath = L"test_impact.info";
+	fs::remove(indexPath);
+	const auto yaml = "testIndex: " + indexPath.string();
+	// The argument names the first run; the second is named after the run itself.
+	EXPECT_FALSE(ExportWith(*run(L"RunA", 1, 5, false), yaml, outputPath.wstring() + L";test=Alpha").HasErrors());
+	EXPECT_FALSE(ExportWith(*run(L"Beta", 5, 10, true), yaml, outputPath.wstring()).HasErrors());
+
+	auto testsFor = [&](std::string_view diff) {
+		TestIndex index;
+		EXPECT_TRUE(index.Load(indexPath));
+		PatchCoverage changes;
+		changes.ParseDiff(diff, DiffSide::Old);
+		const auto impact = index.Affected(changes);
+		std::vector<std::string> names;
+		for (const auto test : impact.tests)
+			names.emplace_back(index.TestName(test));
+		for (const auto file : impact.unknownFiles)
+			names.push_back("unknown:" + std::string(file));
+		return names;
+	};
+	using Names = std::vector<std::string>;
+	const std::string_view changeLine2 = "--- a/impact/a.cpp\n+++ b/impact/a.cpp\n@@ -2 +2 @@\n-x\n+y\n";
+	EXPECT_EQ(testsFor(changeLine2), (Names{"Alpha"}));
+	EXPECT_EQ(testsFor("--- a/impact/a.cpp\n+++ b/impact/a.cpp\n@@ -5,2 +5 @@\n-x\n-x\n+y\n"), (Names{"Alpha", "Beta"}));
+	// An insertion after line 7 touches lines 7 and 8 of the indexed file.
+	EXPECT_EQ(testsFor("--- a/impact/a.cpp\n+++ b/impact/a.cpp\n@@ -7,0 +8 @@\n+y\n"), (Names{"Beta"}));
+	EXPECT_EQ(testsFor("--- a/impact/b.cpp\n+++ /dev/null\n@@ -1,4 +0,0 @@\n-a\n-b\n-c\n-d\n"), (Names{"Beta"}));
+	EXPECT_EQ(testsFor("--- a/impact/b.cpp\n+++ b/impact/b.cpp\n@@ -1 +1 @@\n-x\n+y\n"), Names{});
+	EXPECT_EQ(testsFor("--- a/impact/c.cpp\n+++ b/impact/c.cpp\n@@ -1 +1 @@\n-x\n+y\n"), (Names{"unknown:impact/c.cpp"}));
+	// A file the diff adds is not in the index yet either.
+	EXPECT_EQ(testsFor("--- /dev/null\n+++ b/impact/new.cpp\n@@ -0,0 +1,2 @@\n+a\n+b\n"), (Names{"unknown:impact/new.cpp"}));
+
+	// A rerun replaces what the test executed before.
+	EXPECT_FALSE(ExportWith(*run(L"RunA", 9, 9, false), yaml, outputPath.wstring() + L";test=Alpha").HasErrors());
+	EXPECT_EQ(testsFor(changeLine2), Names{});
+	TestIndex index;
+	ASSERT_TRUE(index.Load(indexPath));
+	ASSERT_EQ(index.TestCount(), 2u);
+	EXPECT_EQ(index.LinesPerTest(), (std::vector<std::uint64_t>{1, 7}));
+	PatchCoverage wholeFile;
+	wholeFile.AddChange("impact/a.cpp", {1, UINT32_MAX});
+	EXPECT_EQ(index.Affected(wholeFile).tests, (std::vector<std::uint32_t>{0, 1}));
+
+	// Magic and version of a valid index
+	const auto header = ReadFile(indexPath).substr(0, std::string_view("covlcovT").size() + sizeof(std::uint32_t));
+
+	// An index that cannot be read is left in place, not replaced by one run.
+	std::ofstream(indexPath, std::ios::binary | std::ios::trunc) << "not an index";
+	const auto unreadable = ExportWith(*run(L"Gamma", 1, 1, false), yaml, outputPath.wstring());
+	EXPECT_TRUE(unreadable.HasErrors());
+	EXPECT_FALSE(unreadable.result);
+	EXPECT_FALSE(index.Load(indexPath));
+
+	// Zero runs may not add up to more words than a set can use: one test, one set of three runs of one zero word.
+	std::ofstream(indexPath, std::ios::binary | std::ios::trunc) << header << std::string{1, 1, 'A', 1, 3, 1, 0, 1, 0, 1, 0, 0};
+	EXPECT_FALSE(index.Load(indexPath));
+
+	fs::remove(indexPath);
+	fs::remove(outputPath);
+}
+
+TEST(TestIndexTest, ConcurrentExportsKeepEveryTest) {
+	const fs::path indexPath = L"test_concurrent.idx";
+	fs::remove(indexPath);
+	const auto yaml = "testIndex: " + indexPath.string();
+
+	// Each export waits for the index's lock file, so none overwrites another's run.
+	constexpr int exports = 6;
+	std::vector<std::thread> threads;
+	std::vector<bool> failed(exports);
+	for (int t = 0; t < exports; ++t) {
+		threads.emplace_back([&, t] {
+			Plugin::CoverageData data{L"Run" + std::to_wstring(t), 0};
+			auto& file = data.AddModule(L"Tests.exe").AddFile(fs::current_path() / L"concurrent" / L"a.cpp");
+			for (unsigned l = 1; l <= 20; ++l)
+				file.AddLine(l, l % exports == static_cast<unsigned>(t));
+			failed[t] = ExportWith(data, yaml, L"test_concurrent" + std::to_wstring(t) + L".info").HasErrors();
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	TestIndex index;
+	ASSERT_TRUE(index.Load(indexPath));
+	EXPECT_EQ(index.TestCount(), static_cast<std::size_t>(exports));
+	for (int t = 0; t < exports; ++t) {
+		EXPECT_FALSE(failed[t]);
+		fs::remove(L"test_concurrent" + std::to_wstring(t) + L".info");
+	}
+	// Temporary files are renamed over the index; only the lock file stays next to it.
+	for (const auto& entry : fs::directory_iterator(fs::current_path()))
+		EXPECT_FALSE(entry.path().filename().string().starts_with("test_concurrent.idx.") && entry.path().extension() == ".tmp");
+
+	fs::remove(indexPath);
+	fs::remove(L"test_concurrent.idx.lock");
+}